@@ -0,0 +1,76 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+
+#include "common/coro.h"
+#include "latency.h"
+
+using namespace common;
+
+namespace {
+
+coro::Task<> echo(WaitQueue<int64_t>& ping, WaitQueue<int64_t>& pong)
+{
+    for (;;) {
+        const int64_t ts = co_await coro::pop(ping);
+        if (ts < 0)
+            break;
+        pong.push(bench::now_ns() - ts);
+    }
+}
+
+// one-way latency of a push to a suspended coroutine, measured in a ping-pong
+void BM_coro_pop_latency(benchmark::State& state)
+{
+    WaitQueue<int64_t> ping;
+    WaitQueue<int64_t> pong;
+    coro::ThreadPool pool(1);
+    coro::spawn(pool, echo(ping, pong));
+    bench::LatencyRecorder recorder;
+
+    for (auto _: state) {
+        ping.push(bench::now_ns());
+        recorder.record(pong.pop());
+    }
+    ping.push(-1);
+
+    recorder.report(state);
+    state.SetItemsProcessed(state.iterations());
+}
+
+coro::Task<> session(WaitQueue<int64_t>& in, WaitQueue<int64_t>& out)
+{
+    for (;;) {
+        const int64_t v = co_await coro::pop(in);
+        if (v < 0)
+            break;
+        out.push(v);
+    }
+}
+
+// range(0) sessions suspended on one queue, served by 4 threads
+void BM_coro_sessions(benchmark::State& state)
+{
+    WaitQueue<int64_t> in;
+    WaitQueue<int64_t> out;
+    const int64_t nb_sessions = state.range(0);
+    coro::ThreadPool pool(4);
+    for (int64_t i = 0; i < nb_sessions; i++)
+        coro::spawn(pool, session(in, out));
+
+    for (auto _: state) {
+        for (int64_t i = 0; i < 64; i++)
+            in.push(i);
+        for (int64_t i = 0; i < 64; i++)
+            benchmark::DoNotOptimize(out.pop());
+    }
+    for (int64_t i = 0; i < nb_sessions; i++)
+        in.push(-1);
+
+    state.SetItemsProcessed(state.iterations() * 64);
+}
+
+} /* namespace */
+
+BENCHMARK(BM_coro_pop_latency)->UseRealTime();
+BENCHMARK(BM_coro_sessions)->Arg(64)->Arg(1 << 14)->UseRealTime();
@@ -0,0 +1,81 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+
+#include "common/event_loop.h"
+#include "latency.h"
+
+using namespace common;
+
+namespace {
+
+// one-way latency of a push to a queue watched by a loop blocked in
+// epoll_wait, measured in a ping-pong
+void BM_event_loop_queue_latency(benchmark::State& state)
+{
+    WaitQueue<int64_t> ping;
+    WaitQueue<int64_t> pong;
+    EventLoopThread t;
+    t.loop().watch(ping, [&](int64_t ts) {pong.push(bench::now_ns() - ts);});
+    t.start(true);
+    bench::LatencyRecorder recorder;
+
+    for (auto _: state) {
+        ping.push(bench::now_ns());
+        recorder.record(pong.pop());
+    }
+    t.stop();
+    t.join();
+
+    recorder.report(state);
+    state.SetItemsProcessed(state.iterations());
+}
+
+// throughput of a producer thread pushing to a watched queue
+void BM_event_loop_queue_throughput(benchmark::State& state)
+{
+    WaitQueue<int64_t> queue;
+    WaitQueue<int64_t> done;
+    const int64_t burst = state.range(0);
+    int64_t received = 0;
+    EventLoopThread t;
+    t.loop().watch(queue, [&](int64_t v)
+        {
+            if (++received % burst == 0)
+                done.push(v);
+        });
+    t.start(true);
+
+    for (auto _: state) {
+        for (int64_t i = 0; i < burst; i++)
+            queue.push(i);
+        done.pop();
+    }
+    t.stop();
+    t.join();
+
+    state.SetItemsProcessed(state.iterations() * burst);
+}
+
+// cost of a post() round trip to the loop thread
+void BM_event_loop_post(benchmark::State& state)
+{
+    WaitQueue<int> done;
+    EventLoopThread t;
+    t.start(true);
+
+    for (auto _: state) {
+        t.loop().post([&] {done.push(0);});
+        done.pop();
+    }
+    t.stop();
+    t.join();
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+} /* namespace */
+
+BENCHMARK(BM_event_loop_queue_latency)->UseRealTime();
+BENCHMARK(BM_event_loop_queue_throughput)->Arg(64)->UseRealTime();
+BENCHMARK(BM_event_loop_post)->UseRealTime();
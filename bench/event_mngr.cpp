@@ -0,0 +1,94 @@
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "common/event_mngr.h"
+#include "latency.h"
+
+using namespace common;
+
+namespace {
+
+enum class Event {
+    ping,
+    pong,
+    stop
+};
+
+void BM_event_mngr_notify_erase(benchmark::State& state)
+{
+    EventMngr<int> events;
+    for (auto _: state) {
+        events.notify(1);
+        benchmark::DoNotOptimize(events.erase(1));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_event_mngr_contains(benchmark::State& state)
+{
+    EventMngr<int> events;
+    for (int i = 0; i < state.range(0); i++)
+        events.notify(i);
+    int e = 0;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(events.contains(e));
+        e = (e + 1) % (2 * state.range(0));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// concurrent notifiers on distinct events
+void BM_event_mngr_notify_mt(benchmark::State& state)
+{
+    static EventMngr<int> events;
+    const int e = state.thread_index();
+    for (auto _: state) {
+        events.notify(e);
+        benchmark::DoNotOptimize(events.erase(e));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// one-way latency from notify() to the return of wait() in another thread
+void BM_event_mngr_wait_latency(benchmark::State& state)
+{
+    EventMngr<Event> events;
+    bench::LatencyRecorder recorder;
+    std::atomic<int64_t> ts {0};
+    std::atomic<int64_t> latency {0};
+
+    std::thread waiter([&]
+        {
+            for (;;) {
+                events.wait_any({Event::ping, Event::stop});
+                if (events.contains(Event::stop))
+                    break;
+                latency = bench::now_ns() - ts;
+                events.erase(Event::ping);
+                events.notify(Event::pong);
+            }
+        });
+
+    for (auto _: state) {
+        ts = bench::now_ns();
+        events.notify(Event::ping);
+        events.wait(Event::pong);
+        events.erase(Event::pong);
+        recorder.record(latency);
+    }
+    events.notify(Event::stop);
+    waiter.join();
+
+    recorder.report(state);
+    state.SetItemsProcessed(state.iterations());
+}
+
+} /* namespace */
+
+BENCHMARK(BM_event_mngr_notify_erase);
+BENCHMARK(BM_event_mngr_contains)->Arg(8)->Arg(1024);
+BENCHMARK(BM_event_mngr_notify_mt)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_event_mngr_wait_latency)->UseRealTime();
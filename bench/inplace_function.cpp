@@ -0,0 +1,80 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <functional>
+
+#include "common/inplace_function.h"
+#include "common/statemachine.h"
+#include "common/timeout_queue.h"
+
+using namespace common;
+
+namespace {
+
+template<typename Sig>
+using Inplace = InplaceFunction<Sig, 48>;
+
+enum class states {
+    idle,
+    busy
+};
+
+// wakeup() switching state at each call, the handlers capture 24 bytes, more
+// than the small buffer of std::function
+template<template<typename> class Function>
+void BM_inplace_function_wakeup(benchmark::State& state)
+{
+    using SM = Statemachine<states, Function>;
+    int64_t a = 0, b = 0, nb_transitions = 0;
+    auto go = [&a, &b, &nb_transitions]
+        {
+            a++;
+            b++;
+            benchmark::DoNotOptimize(nb_transitions);
+            return transition_status::goto_next_state;
+        };
+    typename SM::StateList states_list;
+    states_list.push_back({"idle", states::idle, {}});
+    states_list.back().transitions.push_back({states::busy, go});
+    states_list.push_back({"busy", states::busy, {}});
+    states_list.back().transitions.push_back({states::idle, go});
+    SM sm("bench", std::move(states_list), states::idle);
+    sm.set_transition_handler([&](const typename SM::State *, const typename SM::State *)
+        {
+            nb_transitions++;
+        });
+
+    for (auto _: state)
+        sm.wakeup();
+    state.SetItemsProcessed(nb_transitions);
+}
+
+// adding then dispatching a batch of range(0) due timers whose callbacks
+// capture 24 bytes
+template<template<typename> class Function>
+void BM_inplace_function_timer_dispatch(benchmark::State& state)
+{
+    using Queue = BasicTimeoutQueue<std::allocator<void>, Function>;
+    Queue queue;
+    const int64_t batch = state.range(0);
+    int64_t fired = 0, sum = 0, now = 0;
+
+    for (auto _: state) {
+        for (int64_t i = 0; i < batch; i++)
+            queue.add(now, i % 16, [&fired, &sum, i](typename Queue::Id, int64_t)
+                {
+                    fired++;
+                    sum += i;
+                });
+        now += 16;
+        benchmark::DoNotOptimize(queue.run_once(now));
+    }
+    state.SetItemsProcessed(fired);
+}
+
+} /* namespace */
+
+BENCHMARK_TEMPLATE(BM_inplace_function_wakeup, std::function);
+BENCHMARK_TEMPLATE(BM_inplace_function_wakeup, Inplace);
+BENCHMARK_TEMPLATE(BM_inplace_function_timer_dispatch, std::function)->Arg(64);
+BENCHMARK_TEMPLATE(BM_inplace_function_timer_dispatch, Inplace)->Arg(64);
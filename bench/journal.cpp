@@ -0,0 +1,95 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <string>
+
+#include <unistd.h>
+
+#include "common/journal.h"
+
+using namespace common;
+
+namespace {
+
+std::string journal_path(const char * name)
+{
+    return "/tmp/common_bench_" + std::string(name) + "." + std::to_string(::getpid());
+}
+
+void BM_journal_append(benchmark::State& state)
+{
+    const std::string path = journal_path("append");
+    {
+        Journal journal(path);
+        const std::string payload(state.range(0), 'x');
+        for (auto _: state)
+            journal.append(1, payload.data(), payload.size());
+        state.SetBytesProcessed(state.iterations() * payload.size());
+    }
+    ::unlink(path.c_str());
+}
+
+void BM_persistent_wait_queue_push_pop(benchmark::State& state)
+{
+    const std::string path = journal_path("queue");
+    {
+        Journal journal(path);
+        PersistentWaitQueue<int64_t> queue(journal);
+        int64_t v = 0;
+        for (auto _: state) {
+            queue.push(v);
+            benchmark::DoNotOptimize(v = queue.pop());
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    ::unlink(path.c_str());
+}
+
+// durable pushes from several threads: concurrent sync() share a flush
+void BM_persistent_wait_queue_group_commit(benchmark::State& state)
+{
+    static std::string                    path;
+    static Journal                      * journal;
+    static PersistentWaitQueue<int64_t> * queue;
+    if (state.thread_index() == 0) {
+        path    = journal_path("group_commit");
+        journal = new Journal(path);
+        queue   = new PersistentWaitQueue<int64_t>(*journal);
+    }
+    for (auto _: state) {
+        queue->push(1);
+        journal->sync();
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        delete queue;
+        delete journal;
+        ::unlink(path.c_str());
+    }
+}
+
+// restart time of a queue holding state.range(0) elements
+void BM_persistent_wait_queue_replay(benchmark::State& state)
+{
+    const std::string path = journal_path("replay");
+    {
+        Journal journal(path);
+        PersistentWaitQueue<std::string> queue(journal);
+        for (int64_t i = 0; i < state.range(0); i++)
+            queue.push(std::string(64, 'x'));
+    }
+    for (auto _: state) {
+        Journal journal(path);
+        PersistentWaitQueue<std::string> queue(journal);
+        benchmark::DoNotOptimize(queue.size());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    ::unlink(path.c_str());
+}
+
+} /* namespace */
+
+BENCHMARK(BM_journal_append)->Arg(16)->Arg(256);
+BENCHMARK(BM_persistent_wait_queue_push_pop);
+BENCHMARK(BM_persistent_wait_queue_group_commit)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_persistent_wait_queue_replay)->Arg(1 << 10)->Arg(1 << 16);
@@ -0,0 +1,174 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common/json.h"
+#include "common/json_binary.h"
+
+using namespace common;
+
+namespace {
+
+struct Sample
+{
+    std::string         sensor;
+    uint64_t            timestamp;
+    int32_t             channel;
+    double              gain;
+    bool                saturated;
+    std::vector<double> values;
+};
+COMMON_JSON_BIND(Sample, sensor, timestamp, channel, gain, saturated, values)
+
+Sample make_sample(int i, std::size_t nb_values)
+{
+    Sample s{"probe-" + std::to_string(i % 8), 1600000000000ull + i, i % 64, 0.5 * i, i % 7 == 0, {}};
+    for (std::size_t k = 0; k < nb_values; k++)
+        s.values.push_back(0.001 * static_cast<double>(i * k));
+    return s;
+}
+
+json to_json(const Sample& s)
+{
+    return {{"sensor", s.sensor}, {"timestamp", s.timestamp}, {"channel", s.channel},
+            {"gain", s.gain}, {"saturated", s.saturated}, {"values", s.values}};
+}
+
+// small control message, single record with samples, batch of records
+json make_payload(int kind)
+{
+    switch (kind) {
+        case 0:
+            return {{"cmd", "set_gain"}, {"channel", 3}, {"value", 1.5}, {"ack", true}};
+        case 1:
+            return to_json(make_sample(1, 64));
+        default: {
+            json batch = json::array();
+            for (int i = 0; i < 100; i++)
+                batch.push_back(to_json(make_sample(i, 16)));
+            return batch;
+        }
+    }
+}
+
+const char * payload_name(int kind)
+{
+    return kind == 0 ? "control" : kind == 1 ? "record" : "batch";
+}
+
+void BM_text_encode(benchmark::State& state)
+{
+    const json j = make_payload(state.range(0));
+    std::size_t size = 0;
+    for (auto _: state) {
+        auto s = j.dump();
+        size = s.size();
+        benchmark::DoNotOptimize(s);
+    }
+    state.SetLabel(payload_name(state.range(0)));
+    state.counters["size"] = size;
+    state.SetBytesProcessed(state.iterations() * size);
+}
+
+void BM_text_decode(benchmark::State& state)
+{
+    const std::string s = make_payload(state.range(0)).dump();
+    for (auto _: state) {
+        auto j = json::parse(s);
+        benchmark::DoNotOptimize(j);
+    }
+    state.SetLabel(payload_name(state.range(0)));
+    state.counters["size"] = s.size();
+    state.SetBytesProcessed(state.iterations() * s.size());
+}
+
+template<BinaryFormat F>
+void BM_binary_encode(benchmark::State& state)
+{
+    const json j = make_payload(state.range(0));
+    BinaryEncoder encoder(F);
+    std::size_t size = 0;
+    for (auto _: state) {
+        const auto& b = encoder.encode(j);
+        size = b.size();
+        benchmark::DoNotOptimize(b.data());
+    }
+    state.SetLabel(payload_name(state.range(0)));
+    state.counters["size"] = size;
+    state.SetBytesProcessed(state.iterations() * size);
+}
+
+template<BinaryFormat F>
+void BM_binary_decode(benchmark::State& state)
+{
+    const Bytes b = BinaryEncoder(F).encode(make_payload(state.range(0)));
+    for (auto _: state) {
+        auto j = decode(b, F);
+        benchmark::DoNotOptimize(j);
+    }
+    state.SetLabel(payload_name(state.range(0)));
+    state.counters["size"] = b.size();
+    state.SetBytesProcessed(state.iterations() * b.size());
+}
+
+void BM_struct_encode(benchmark::State& state)
+{
+    const Sample s = make_sample(1, 64);
+    MsgpackWriter writer;
+    std::size_t size = 0;
+    for (auto _: state) {
+        const auto& b = writer.encode(s);
+        size = b.size();
+        benchmark::DoNotOptimize(b.data());
+    }
+    state.counters["size"] = size;
+    state.SetBytesProcessed(state.iterations() * size);
+}
+
+void BM_struct_decode(benchmark::State& state)
+{
+    MsgpackWriter writer;
+    const Bytes b = writer.encode(make_sample(1, 64));
+    for (auto _: state) {
+        auto s = decode<Sample>(b.data(), b.size());
+        benchmark::DoNotOptimize(s);
+    }
+    state.counters["size"] = b.size();
+    state.SetBytesProcessed(state.iterations() * b.size());
+}
+
+void BM_stream_decode(benchmark::State& state)
+{
+    BinaryEncoder encoder;
+    const json j = make_payload(1);
+    for (int i = 0; i < 100; i++)
+        encoder.append_frame(j);
+    const Bytes stream = encoder.buffer();
+    const std::size_t chunk = state.range(0);
+
+    for (auto _: state) {
+        StreamDecoder decoder;
+        json out;
+        for (std::size_t pos = 0; pos < stream.size(); pos += chunk) {
+            decoder.feed(stream.data() + pos, std::min(chunk, stream.size() - pos));
+            while (decoder.next(out))
+                benchmark::DoNotOptimize(out);
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * stream.size());
+}
+
+} /* namespace */
+
+BENCHMARK(BM_text_encode)->DenseRange(0, 2);
+BENCHMARK(BM_text_decode)->DenseRange(0, 2);
+BENCHMARK_TEMPLATE(BM_binary_encode, BinaryFormat::cbor)->DenseRange(0, 2);
+BENCHMARK_TEMPLATE(BM_binary_decode, BinaryFormat::cbor)->DenseRange(0, 2);
+BENCHMARK_TEMPLATE(BM_binary_encode, BinaryFormat::msgpack)->DenseRange(0, 2);
+BENCHMARK_TEMPLATE(BM_binary_decode, BinaryFormat::msgpack)->DenseRange(0, 2);
+BENCHMARK(BM_struct_encode);
+BENCHMARK(BM_struct_decode);
+BENCHMARK(BM_stream_decode)->Arg(512)->Arg(64 * 1024);
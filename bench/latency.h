@@ -0,0 +1,51 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace bench {
+
+inline int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Collect latency samples and report their percentiles (in ns) as benchmark
+ * counters, so that they end up in the json output next to the throughput.
+ */
+class LatencyRecorder
+{
+public:
+    explicit LatencyRecorder(std::size_t reserve = 1 << 20) {samples_.reserve(reserve);}
+
+    void record(int64_t ns) {samples_.push_back(ns);}
+
+    void report(benchmark::State& state)
+    {
+        if (samples_.empty())
+            return;
+        std::sort(samples_.begin(), samples_.end());
+        state.counters["p50_ns"]  = percentile(0.50);
+        state.counters["p90_ns"]  = percentile(0.90);
+        state.counters["p99_ns"]  = percentile(0.99);
+        state.counters["p999_ns"] = percentile(0.999);
+        state.counters["max_ns"]  = samples_.back();
+        samples_.clear();
+    }
+
+private:
+    double percentile(double p) const
+    {
+        return samples_[static_cast<std::size_t>(p * (samples_.size() - 1))];
+    }
+
+    std::vector<int64_t> samples_;
+};
+
+} /* namespace bench */
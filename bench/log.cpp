@@ -0,0 +1,73 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+
+#include "common/log.h"
+#include "spdlog/sinks/null_sink.h"
+
+using namespace common;
+
+namespace {
+
+Logger null_logger()
+{
+    static Logger logger = []
+        {
+            auto l = spdlog::create<spdlog::sinks::null_sink_mt>("bench_null");
+            l->set_pattern("[%T:%e][%^%l%$] %s:%#:%! | %v");
+            l->set_level(spdlog::level::info);
+            return l;
+        }();
+    return logger;
+}
+
+// message below the logger level: only the level check is paid
+void BM_log_filtered(benchmark::State& state)
+{
+    auto logger = null_logger();
+    int64_t i = 0;
+    for (auto _: state)
+        log_debug(logger, "filtered message {} {}", i++, 3.14);
+    state.SetItemsProcessed(state.iterations());
+}
+
+// formatted message written to a null sink
+void BM_log_enabled(benchmark::State& state)
+{
+    auto logger = null_logger();
+    int64_t i = 0;
+    for (auto _: state)
+        log_info(logger, "enabled message {} {}", i++, 3.14);
+    state.SetItemsProcessed(state.iterations());
+}
+
+// several threads logging to the same (mutex protected) sink
+void BM_log_enabled_mt(benchmark::State& state)
+{
+    auto logger = null_logger();
+    int64_t i = 0;
+    for (auto _: state)
+        log_info(logger, "enabled message {} {}", i++, 3.14);
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_log_die_zero(benchmark::State& state)
+{
+    auto logger = null_logger();
+    auto f = [&](int64_t v) -> int
+        {
+            common_die_zero(logger, v, -1, "negative value {}", v);
+            return 0;
+        };
+    int64_t i = 0;
+    for (auto _: state)
+        benchmark::DoNotOptimize(f(i++ % 2 ? 1 : -1));
+    state.SetItemsProcessed(state.iterations());
+}
+
+} /* namespace */
+
+BENCHMARK(BM_log_filtered);
+BENCHMARK(BM_log_enabled);
+BENCHMARK(BM_log_enabled_mt)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_log_die_zero);
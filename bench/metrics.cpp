@@ -0,0 +1,97 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+
+#include "common/metrics.h"
+#include "common/metrics_registry.h"
+#include "common/timeout_queue.h"
+#include "common/wait_queue.h"
+
+using namespace common;
+
+namespace {
+
+void BM_metrics_counter_add(benchmark::State& state)
+{
+    static metrics::Counter counter;
+    for (auto _: state)
+        counter.add();
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_metrics_gauge_set(benchmark::State& state)
+{
+    static metrics::Gauge gauge;
+    int64_t i = 0;
+    for (auto _: state)
+        gauge.set(i++);
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_metrics_histogram_record(benchmark::State& state)
+{
+    static metrics::Histogram histogram;
+    uint64_t v = 1;
+    for (auto _: state) {
+        histogram.record(v);
+        v = v * 6364136223846793005ull + 1442695040888963407ull;
+        v >>= 44;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_metrics_scoped_timer(benchmark::State& state)
+{
+    metrics::Histogram histogram;
+    for (auto _: state)
+        metrics::ScopedTimer t(histogram);
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_metrics_snapshot(benchmark::State& state)
+{
+    metrics::Registry registry;
+    for (int64_t i = 0; i < state.range(0); i++) {
+        registry.counter("counter." + std::to_string(i)).add(i);
+        registry.histogram("histogram." + std::to_string(i)).record(i);
+    }
+    for (auto _: state)
+        benchmark::DoNotOptimize(registry.snapshot());
+}
+
+// overhead of the instrumentation hooks of the primitives
+void BM_metrics_wait_queue_push_pop(benchmark::State& state)
+{
+    WaitQueue<int64_t> queue;
+    metrics::Gauge depth;
+    metrics::Histogram wait_time;
+    queue.set_metrics(&depth, &wait_time);
+    for (auto _: state) {
+        queue.push(1);
+        benchmark::DoNotOptimize(queue.pop());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_metrics_timeout_queue_run_once(benchmark::State& state)
+{
+    TimeoutQueue queue;
+    metrics::Histogram lag;
+    queue.set_lag_histogram(&lag);
+    int64_t now = 0;
+    for (auto _: state) {
+        queue.add(now, 1, [](TimeoutQueue::Id, int64_t) {});
+        benchmark::DoNotOptimize(queue.run_once(++now));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+} /* namespace */
+
+BENCHMARK(BM_metrics_counter_add)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_metrics_gauge_set)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_metrics_histogram_record)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_metrics_scoped_timer);
+BENCHMARK(BM_metrics_snapshot)->Arg(10)->Arg(100);
+BENCHMARK(BM_metrics_wait_queue_push_pop);
+BENCHMARK(BM_metrics_timeout_queue_run_once);
@@ -0,0 +1,113 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "common/event_mngr.h"
+#include "common/pool.h"
+#include "common/timeout_queue.h"
+#include "common/wait_queue.h"
+
+using namespace common;
+
+namespace {
+
+// allocate a burst of blocks then free them, as a queue in steady state does
+void BM_pool_malloc(benchmark::State& state)
+{
+    const std::size_t size = state.range(0);
+    std::vector<void*> blocks(64);
+    for (auto _: state) {
+        for (auto& b: blocks)
+            b = std::malloc(size);
+        benchmark::DoNotOptimize(blocks.data());
+        for (auto b: blocks)
+            std::free(b);
+    }
+    state.SetItemsProcessed(state.iterations() * blocks.size());
+}
+
+void BM_pool_fixed_size(benchmark::State& state)
+{
+    auto& pool = FixedSizePool::for_size(state.range(0));
+    std::vector<void*> blocks(64);
+    for (auto _: state) {
+        for (auto& b: blocks)
+            b = pool.allocate();
+        benchmark::DoNotOptimize(blocks.data());
+        for (auto b: blocks)
+            pool.deallocate(b);
+    }
+    state.SetItemsProcessed(state.iterations() * blocks.size());
+}
+
+void BM_pool_arena(benchmark::State& state)
+{
+    MonotonicArena arena;
+    const std::size_t size = state.range(0);
+    for (auto _: state) {
+        for (int i = 0; i < 64; i++)
+            benchmark::DoNotOptimize(arena.allocate(size));
+        arena.reset();
+    }
+    state.SetItemsProcessed(state.iterations() * 64);
+}
+
+// elements pushed by even threads, popped by odd threads
+template<typename Queue>
+void BM_pool_wait_queue(benchmark::State& state)
+{
+    static Queue queue;
+    const bool producer = state.thread_index() % 2 == 0;
+    for (auto _: state) {
+        if (producer) {
+            for (int i = 0; i < 64; i++)
+                queue.push(i);
+        } else {
+            for (int i = 0; i < 64; i++)
+                benchmark::DoNotOptimize(queue.pop());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * 64);
+}
+
+template<typename Mngr>
+void BM_pool_event_mngr(benchmark::State& state)
+{
+    Mngr events;
+    for (auto _: state) {
+        for (int i = 0; i < 64; i++)
+            events.notify(i);
+        events.clear();
+    }
+    state.SetItemsProcessed(state.iterations() * 64);
+}
+
+template<typename Queue>
+void BM_pool_timeout_queue(benchmark::State& state)
+{
+    Queue queue;
+    int64_t now = 0;
+    for (auto _: state) {
+        for (int i = 0; i < 64; i++)
+            queue.add(now, i, [](int64_t, int64_t) {});
+        now += 64;
+        queue.run_once(now);
+    }
+    state.SetItemsProcessed(state.iterations() * 64);
+}
+
+} /* namespace */
+
+BENCHMARK(BM_pool_malloc)->Arg(64)->Arg(512)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_pool_fixed_size)->Arg(64)->Arg(512)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_pool_arena)->Arg(64)->Arg(512);
+BENCHMARK_TEMPLATE(BM_pool_wait_queue, WaitQueue<int64_t>)
+    ->ThreadRange(2, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_pool_wait_queue, WaitQueue<int64_t, PoolAllocator<int64_t>>)
+    ->ThreadRange(2, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_pool_event_mngr, EventMngr<int>);
+BENCHMARK_TEMPLATE(BM_pool_event_mngr, EventMngr<int, PoolAllocator<int>>);
+BENCHMARK_TEMPLATE(BM_pool_timeout_queue, TimeoutQueue);
+BENCHMARK_TEMPLATE(BM_pool_timeout_queue, BasicTimeoutQueue<PoolAllocator<void>>);
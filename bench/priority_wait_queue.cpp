@@ -0,0 +1,83 @@
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+#include <cstdint>
+
+#include "common/priority_wait_queue.h"
+#include "common/wait_queue.h"
+
+using namespace common;
+
+namespace {
+
+void BM_priority_wait_queue_push_pop(benchmark::State& state)
+{
+    PriorityWaitQueue<int64_t> queue;
+    int64_t v = 0;
+    for (auto _: state) {
+        queue.push(v, 1);
+        benchmark::DoNotOptimize(v = queue.pop());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_deadline_wait_queue_push_pop(benchmark::State& state)
+{
+    DeadlineWaitQueue<int64_t> queue;
+    int64_t v = 0;
+    for (auto _: state) {
+        queue.push(v, std::chrono::milliseconds(1));
+        benchmark::DoNotOptimize(v = queue.pop());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// number of pops before a control message pushed behind a backlog of
+// state.range(0) bulk messages is served
+void BM_fifo_control_behind_backlog(benchmark::State& state)
+{
+    WaitQueue<int64_t> queue;
+    const int64_t backlog = state.range(0);
+    int64_t pops = 0;
+    for (auto _: state) {
+        for (int64_t i = 0; i < backlog; i++)
+            queue.push(0);
+        queue.push(1);
+        for (;;) {
+            pops++;
+            if (queue.pop())
+                break;
+        }
+    }
+    state.counters["pops_to_control"] = double(pops) / state.iterations();
+}
+
+void BM_priority_control_behind_backlog(benchmark::State& state)
+{
+    PriorityWaitQueue<int64_t, 2> queue;
+    const int64_t backlog = state.range(0);
+    int64_t pops = 0;
+    for (auto _: state) {
+        for (int64_t i = 0; i < backlog; i++)
+            queue.push(0);
+        queue.push(1, 0);
+        for (;;) {
+            pops++;
+            if (queue.pop())
+                break;
+        }
+        // drain the backlog out of the measure
+        state.PauseTiming();
+        while (!queue.empty())
+            queue.pop();
+        state.ResumeTiming();
+    }
+    state.counters["pops_to_control"] = double(pops) / state.iterations();
+}
+
+} /* namespace */
+
+BENCHMARK(BM_priority_wait_queue_push_pop);
+BENCHMARK(BM_deadline_wait_queue_push_pop);
+BENCHMARK(BM_fifo_control_behind_backlog)->Arg(64)->Arg(4096);
+BENCHMARK(BM_priority_control_behind_backlog)->Arg(64)->Arg(4096);
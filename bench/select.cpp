@@ -0,0 +1,66 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "common/select.h"
+#include "common/wait_queue.h"
+
+using namespace common;
+
+namespace {
+
+// cost of a select over state.range(0) queues, one of them being ready
+void BM_select_ready(benchmark::State& state)
+{
+    std::vector<WaitQueue<int64_t>> queues(state.range(0));
+    Selector sel;
+    for (auto& q: queues)
+        sel.add(q);
+
+    int64_t v = 0;
+    std::size_t i = 0;
+    for (auto _: state) {
+        queues[i].push(v);
+        const std::size_t ready = sel.wait();
+        queues[ready].try_pop(v);
+        i = (i + 1) % queues.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// one consumer thread serving state.range(0) queues, each fed by a producer
+void BM_select_consumer(benchmark::State& state)
+{
+    const std::size_t nb_queues = state.range(0);
+    const int64_t     per_queue = 1 << 14;
+    for (auto _: state) {
+        std::vector<WaitQueue<int64_t>> queues(nb_queues);
+        Selector sel;
+        for (auto& q: queues)
+            sel.add(q);
+
+        std::vector<std::thread> producers;
+        for (auto& q: queues)
+            producers.emplace_back([&q, per_queue]
+                {
+                    for (int64_t i = 0; i < per_queue; i++)
+                        q.push(i);
+                });
+
+        int64_t v;
+        for (int64_t n = 0; n < int64_t(nb_queues) * per_queue;) {
+            if (queues[sel.wait()].try_pop(v))
+                n++;
+        }
+        for (auto& t: producers)
+            t.join();
+    }
+    state.SetItemsProcessed(state.iterations() * nb_queues * per_queue);
+}
+
+} /* namespace */
+
+BENCHMARK(BM_select_ready)->Arg(2)->Arg(16);
+BENCHMARK(BM_select_consumer)->Arg(2)->Arg(8)->UseRealTime();
@@ -0,0 +1,108 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <string>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "common/shm_queue.h"
+#include "latency.h"
+
+using namespace common;
+
+namespace {
+
+std::string queue_name(const char * name)
+{
+    return "/common_bench_" + std::string(name) + "." + std::to_string(::getpid());
+}
+
+void BM_shm_queue_push_pop(benchmark::State& state)
+{
+    const std::string name = queue_name("push_pop");
+    {
+        ShmWaitQueue<int64_t> queue(name, 1024);
+        int64_t v = 0;
+        for (auto _: state) {
+            queue.push(v);
+            benchmark::DoNotOptimize(v = queue.pop());
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+    ShmWaitQueue<int64_t>::unlink(name);
+}
+
+// 4 KB elements, copied through a local one (0) or written and read in
+// place in their slot (1)
+void BM_shm_queue_large(benchmark::State& state)
+{
+    struct Message
+    {
+        int64_t data[512];
+    };
+
+    const std::string name = queue_name("large");
+    const bool in_place = state.range(0);
+    {
+        ShmWaitQueue<Message> queue(name, 64);
+        Message local {};
+        int64_t seq = 0, sum = 0;
+        for (auto _: state) {
+            seq++;
+            if (in_place) {
+                queue.push_in_place([&](Message& m) {m.data[0] = seq; m.data[511] = seq;});
+                queue.pop_in_place([&](const Message& m) {sum += m.data[0] + m.data[511];});
+            } else {
+                local.data[0] = local.data[511] = seq;
+                queue.push(local);
+                const Message m = queue.pop();
+                sum += m.data[0] + m.data[511];
+            }
+        }
+        benchmark::DoNotOptimize(sum);
+        state.SetItemsProcessed(state.iterations());
+    }
+    ShmWaitQueue<Message>::unlink(name);
+}
+
+// one-way latency of a push to a consumer blocked in another process,
+// measured in a ping-pong
+void BM_shm_queue_handoff_latency(benchmark::State& state)
+{
+    const std::string ping_name = queue_name("ping");
+    const std::string pong_name = queue_name("pong");
+    {
+        ShmWaitQueue<int64_t> ping(ping_name, 64);
+        ShmWaitQueue<int64_t> pong(pong_name, 64);
+        bench::LatencyRecorder recorder;
+
+        const pid_t pid = ::fork();
+        if (pid == 0) {
+            for (;;) {
+                const int64_t ts = ping.pop();
+                if (ts < 0)
+                    ::_exit(0);
+                pong.push(bench::now_ns() - ts);
+            }
+        }
+
+        for (auto _: state) {
+            ping.push(bench::now_ns());
+            recorder.record(pong.pop());
+        }
+        ping.push(-1);
+        ::waitpid(pid, nullptr, 0);
+
+        recorder.report(state);
+        state.SetItemsProcessed(state.iterations());
+    }
+    ShmWaitQueue<int64_t>::unlink(ping_name);
+    ShmWaitQueue<int64_t>::unlink(pong_name);
+}
+
+} /* namespace */
+
+BENCHMARK(BM_shm_queue_push_pop);
+BENCHMARK(BM_shm_queue_large)->Arg(0)->Arg(1);
+BENCHMARK(BM_shm_queue_handoff_latency)->UseRealTime();
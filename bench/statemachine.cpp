@@ -0,0 +1,89 @@
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "common/statemachine.h"
+#include "latency.h"
+
+using namespace common;
+
+namespace {
+
+enum class states {
+    idle,
+    busy
+};
+
+using SM = Statemachine<states>;
+
+// wakeup() evaluating range(0) transitions that all stay in the current state
+void BM_statemachine_wakeup_stay(benchmark::State& state)
+{
+    std::vector<SM::Transition> transitions;
+    for (int64_t i = 0; i < state.range(0); i++)
+        transitions.push_back({states::busy, [] {return transition_status::stay_curr_state;}});
+    SM sm("bench", {{"idle", states::idle, transitions},
+                    {"busy", states::busy, {}}}, states::idle);
+
+    for (auto _: state)
+        sm.wakeup();
+    state.SetItemsProcessed(state.iterations());
+}
+
+// wakeup() switching state at each call, with a transition handler
+void BM_statemachine_wakeup_transition(benchmark::State& state)
+{
+    auto go = [] {return transition_status::goto_next_state;};
+    SM sm("bench", {{"idle", states::idle, {{states::busy, go}}},
+                    {"busy", states::busy, {{states::idle, go}}}}, states::idle);
+    int64_t nb_transitions = 0;
+    sm.set_transition_handler([&](const SM::State *, const SM::State *) {nb_transitions++;});
+
+    for (auto _: state)
+        sm.wakeup();
+    state.SetItemsProcessed(nb_transitions);
+}
+
+// latency from the transition done by wakeup() to the return of wait() in
+// another thread
+void BM_statemachine_wait_latency(benchmark::State& state)
+{
+    std::atomic_bool request {false};
+    std::atomic_bool done {false};
+    auto start = [&] {return request ? transition_status::goto_next_state
+                                     : transition_status::stay_curr_state;};
+    auto stop  = [&] {return request ? transition_status::stay_curr_state
+                                     : transition_status::goto_next_state;};
+    SM sm("bench", {{"idle", states::idle, {{states::busy, start}}},
+                    {"busy", states::busy, {{states::idle, stop}}}}, states::idle);
+    bench::LatencyRecorder recorder;
+    std::atomic<int64_t> ts {0};
+    sm.set_transition_handler([&](const SM::State *, const SM::State *) {ts = bench::now_ns();});
+
+    std::thread driver([&]
+        {
+            while (!done)
+                sm.wakeup();
+        });
+
+    for (auto _: state) {
+        request = true;
+        sm.wait(states::busy);
+        recorder.record(bench::now_ns() - ts);
+        request = false;
+        sm.wait(states::idle);
+    }
+    done = true;
+    driver.join();
+
+    recorder.report(state);
+    state.SetItemsProcessed(state.iterations());
+}
+
+} /* namespace */
+
+BENCHMARK(BM_statemachine_wakeup_stay)->Arg(1)->Arg(8);
+BENCHMARK(BM_statemachine_wakeup_transition);
+BENCHMARK(BM_statemachine_wait_latency)->UseRealTime();
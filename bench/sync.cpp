@@ -0,0 +1,112 @@
+#include <benchmark/benchmark.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "common/sync.h"
+#include "latency.h"
+
+using namespace common;
+
+namespace {
+
+// std::mutex + std::condition_variable semaphore, the baseline
+class CvSemaphore
+{
+public:
+    void post()
+    {
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            count_++;
+        }
+        cv_.notify_one();
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lk(mutex_);
+        cv_.wait(lk, [this] {return count_ > 0;});
+        count_--;
+    }
+
+private:
+    std::mutex              mutex_;
+    std::condition_variable cv_;
+    int64_t                 count_ = 0;
+};
+
+// one-way wakeup latency of a sleeping thread, measured in a ping-pong
+template<typename Sem>
+void BM_sync_ping_pong(benchmark::State& state)
+{
+    Sem ping;
+    Sem pong;
+    std::atomic<int64_t> ts {0};
+    std::atomic_bool done {false};
+    bench::LatencyRecorder recorder;
+
+    std::thread other([&]
+        {
+            for (;;) {
+                ping.wait();
+                if (done)
+                    break;
+                ts = bench::now_ns() - ts;
+                pong.post();
+            }
+        });
+
+    for (auto _: state) {
+        ts = bench::now_ns();
+        ping.post();
+        pong.wait();
+        recorder.record(ts);
+    }
+    done = true;
+    ping.post();
+    other.join();
+
+    recorder.report(state);
+    state.SetItemsProcessed(state.iterations());
+}
+
+template<typename M>
+void BM_sync_lock_unlock(benchmark::State& state)
+{
+    static M mutex;
+    static int64_t counter = 0;
+    for (auto _: state) {
+        std::lock_guard<M> lk(mutex);
+        benchmark::DoNotOptimize(++counter);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// cost of a notification nobody waits for, paid by every push of a queue
+void BM_sync_event_count_notify(benchmark::State& state)
+{
+    EventCount ec;
+    for (auto _: state)
+        ec.notify();
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_sync_cv_notify(benchmark::State& state)
+{
+    std::condition_variable cv;
+    for (auto _: state)
+        cv.notify_one();
+    state.SetItemsProcessed(state.iterations());
+}
+
+} /* namespace */
+
+BENCHMARK_TEMPLATE(BM_sync_ping_pong, CvSemaphore)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_sync_ping_pong, Semaphore)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_sync_lock_unlock, std::mutex)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_sync_lock_unlock, Mutex)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_sync_event_count_notify);
+BENCHMARK(BM_sync_cv_notify);
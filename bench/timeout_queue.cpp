@@ -0,0 +1,106 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "common/timeout_queue.h"
+#include "latency.h"
+
+using namespace common;
+
+namespace {
+
+// add + erase of a timer with range(0) timers already pending
+void BM_timeout_queue_add_erase(benchmark::State& state)
+{
+    TimeoutQueue queue;
+    for (int64_t i = 0; i < state.range(0); i++)
+        queue.add(0, i, [](TimeoutQueue::Id, int64_t) {});
+
+    int64_t delay = 0;
+    for (auto _: state) {
+        auto id = queue.add(0, delay, [](TimeoutQueue::Id, int64_t) {});
+        benchmark::DoNotOptimize(queue.erase(id));
+        delay = (delay + 7919) % (state.range(0) + 1);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// cost of adding then dispatching a batch of range(0) due timers
+void BM_timeout_queue_run_once(benchmark::State& state)
+{
+    TimeoutQueue queue;
+    const int64_t batch = state.range(0);
+    int64_t fired = 0;
+    int64_t now = 0;
+    for (auto _: state) {
+        for (int64_t i = 0; i < batch; i++)
+            queue.add(now, i % 16, [&fired](TimeoutQueue::Id, int64_t) {fired++;});
+        now += 16;
+        benchmark::DoNotOptimize(queue.run_once(now));
+    }
+    state.SetItemsProcessed(fired);
+}
+
+// repeating timers dispatched at each tick
+void BM_timeout_queue_repeating(benchmark::State& state)
+{
+    TimeoutQueue queue;
+    int64_t fired = 0;
+    for (int64_t i = 0; i < state.range(0); i++)
+        queue.add_repeating(0, 1, [&fired](TimeoutQueue::Id, int64_t) {fired++;});
+
+    int64_t now = 0;
+    for (auto _: state)
+        benchmark::DoNotOptimize(queue.run_once(++now));
+    state.SetItemsProcessed(fired);
+}
+
+// latency distribution of run_once() with range(0) pending timers and a
+// single one due
+void BM_timeout_queue_run_once_latency(benchmark::State& state)
+{
+    TimeoutQueue queue;
+    bench::LatencyRecorder recorder;
+    for (int64_t i = 0; i < state.range(0); i++)
+        queue.add(0, 1ll << 40, [](TimeoutQueue::Id, int64_t) {});
+
+    int64_t now = 0;
+    for (auto _: state) {
+        queue.add(now, 1, [](TimeoutQueue::Id, int64_t) {});
+        const int64_t start = bench::now_ns();
+        benchmark::DoNotOptimize(queue.run_once(++now));
+        recorder.record(bench::now_ns() - start);
+    }
+    recorder.report(state);
+}
+
+// keep-alive timers added one per time unit with the same delay and a slack
+// of range(0): number of distinct expirations, i.e. of wakeups of a loop
+// sleeping until the next expiration
+void BM_timeout_queue_coalescing(benchmark::State& state)
+{
+    const int64_t nb_timers = 100000;
+    const int64_t slack     = state.range(0);
+    int64_t wakeups = 0;
+    for (auto _: state) {
+        TimeoutQueue queue;
+        for (int64_t i = 0; i < nb_timers; i++)
+            queue.add(i, 30000, slack, [](TimeoutQueue::Id, int64_t) {});
+        for (int64_t next = queue.next_expiration();
+             next != std::numeric_limits<int64_t>::max();
+             next = queue.run_once(next))
+            wakeups++;
+    }
+    state.counters["wakeups"] = double(wakeups) / state.iterations();
+    state.SetItemsProcessed(state.iterations() * nb_timers);
+}
+
+} /* namespace */
+
+BENCHMARK(BM_timeout_queue_add_erase)->Arg(0)->Arg(1024)->Arg(100000);
+BENCHMARK(BM_timeout_queue_run_once)->Arg(1)->Arg(64)->Arg(4096);
+BENCHMARK(BM_timeout_queue_repeating)->Arg(16)->Arg(1024);
+BENCHMARK(BM_timeout_queue_run_once_latency)->Arg(0)->Arg(100000);
+BENCHMARK(BM_timeout_queue_coalescing)->Arg(0)->Arg(100)->Arg(1000);
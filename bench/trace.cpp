@@ -0,0 +1,53 @@
+#include <benchmark/benchmark.h>
+
+#include <sstream>
+
+#include "common/trace.h"
+
+using namespace common;
+
+namespace {
+
+void BM_trace_scope_disabled(benchmark::State& state)
+{
+    trace::Tracer::instance().disable();
+    for (auto _: state) {
+        COMMON_TRACE_SCOPE("disabled");
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_trace_scope_enabled(benchmark::State& state)
+{
+    trace::Tracer::instance().enable();
+    for (auto _: state) {
+        COMMON_TRACE_SCOPE("enabled");
+        benchmark::ClobberMemory();
+    }
+    trace::Tracer::instance().disable();
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_trace_export(benchmark::State& state)
+{
+    auto& tracer = trace::Tracer::instance();
+    tracer.clear();
+    tracer.enable();
+    for (int64_t i = 0; i < state.range(0); i++)
+        COMMON_TRACE_SCOPE("exported");
+    tracer.disable();
+
+    for (auto _: state) {
+        std::ostringstream os;
+        tracer.write_chrome_trace(os);
+        benchmark::DoNotOptimize(os.str());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+} /* namespace */
+
+BENCHMARK(BM_trace_scope_disabled)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_trace_scope_enabled)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_trace_export)->Arg(1 << 12);
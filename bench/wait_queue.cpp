@@ -0,0 +1,85 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <thread>
+
+#include "common/wait_queue.h"
+#include "latency.h"
+
+using namespace common;
+
+namespace {
+
+void BM_wait_queue_push_pop(benchmark::State& state)
+{
+    WaitQueue<int64_t> queue;
+    int64_t v = 0;
+    for (auto _: state) {
+        queue.push(v);
+        benchmark::DoNotOptimize(v = queue.pop());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_wait_queue_burst(benchmark::State& state)
+{
+    WaitQueue<int64_t> queue;
+    const int64_t burst = state.range(0);
+    for (auto _: state) {
+        for (int64_t i = 0; i < burst; i++)
+            queue.push(i);
+        for (int64_t i = 0; i < burst; i++)
+            benchmark::DoNotOptimize(queue.pop());
+    }
+    state.SetItemsProcessed(state.iterations() * burst);
+}
+
+// even threads push, odd threads pop: each thread runs the same number of
+// iterations so pushes and pops are balanced
+void BM_wait_queue_mpmc(benchmark::State& state)
+{
+    static WaitQueue<int64_t> queue;
+    const bool producer = state.thread_index() % 2 == 0;
+    for (auto _: state) {
+        if (producer)
+            queue.push(1);
+        else
+            benchmark::DoNotOptimize(queue.pop());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// one-way latency of a push to a blocked consumer, measured in a ping-pong
+void BM_wait_queue_handoff_latency(benchmark::State& state)
+{
+    WaitQueue<int64_t> ping;
+    WaitQueue<int64_t> pong;
+    bench::LatencyRecorder recorder;
+
+    std::thread consumer([&]
+        {
+            for (;;) {
+                const int64_t ts = ping.pop();
+                if (ts < 0)
+                    break;
+                pong.push(bench::now_ns() - ts);
+            }
+        });
+
+    for (auto _: state) {
+        ping.push(bench::now_ns());
+        recorder.record(pong.pop());
+    }
+    ping.push(-1);
+    consumer.join();
+
+    recorder.report(state);
+    state.SetItemsProcessed(state.iterations());
+}
+
+} /* namespace */
+
+BENCHMARK(BM_wait_queue_push_pop);
+BENCHMARK(BM_wait_queue_burst)->Arg(16)->Arg(1024);
+BENCHMARK(BM_wait_queue_mpmc)->ThreadRange(2, 8)->UseRealTime();
+BENCHMARK(BM_wait_queue_handoff_latency)->UseRealTime();
@@ -0,0 +1,217 @@
+/**
+ * Injectable clock of the timed waits of Statemachine, EventMngr and Thread.
+ *
+ *  - SteadyClock: std::chrono::steady_clock and futex timeouts, the default
+ *    (Clock::steady()).
+ *  - VirtualClock: time only moves when advance() / set() is called, and the
+ *    timed waits expire when it moves past their deadline, so that timeouts
+ *    can be tested deterministically and without sleeping.
+ *
+ *     common::VirtualClock clock;
+ *     common::EventMngr<int> events(clock);
+ *     std::thread t([&] {events.wait_for(1, std::chrono::seconds(10));});
+ *     clock.wait_waiters(1);                  // t is blocked
+ *     clock.advance(std::chrono::seconds(10));  // its wait_for times out
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "sync.h"
+
+namespace common {
+
+class Clock
+{
+public:
+    using duration   = std::chrono::steady_clock::duration;
+    using time_point = std::chrono::steady_clock::time_point;
+
+    virtual ~Clock() = default;
+
+    virtual time_point now() = 0;
+
+    /**
+     * Block until now() >= deadline.
+     */
+    virtual void sleep_until(time_point deadline) = 0;
+
+    /**
+     * EventCount::wait(key) returning false once now() >= deadline.
+     */
+    virtual bool wait_until(EventCount& ec, EventCount::Key key, time_point deadline) = 0;
+
+    template<typename Rep, typename Period>
+    void sleep_for(std::chrono::duration<Rep, Period> d)
+    {
+        sleep_until(now() + std::chrono::duration_cast<duration>(d));
+    }
+
+    /**
+     * EventCount::wait_for(lk, timeout, pred) measuring the timeout with this
+     * clock. Return the last value of pred().
+     */
+    template<typename Lock, typename Rep, typename Period, typename Predicate>
+    bool wait_for(EventCount& ec, Lock& lk, std::chrono::duration<Rep, Period> timeout,
+                  Predicate pred)
+    {
+        const auto deadline = now() + std::chrono::duration_cast<duration>(timeout);
+        while (!pred()) {
+            const auto key = ec.prepare_wait();
+            lk.unlock();
+            const bool notified = wait_until(ec, key, deadline);
+            lk.lock();
+            if (!notified)
+                return pred();
+        }
+        return true;
+    }
+
+    /**
+     * Process wide SteadyClock.
+     */
+    static Clock& steady();
+};
+
+class SteadyClock: public Clock
+{
+public:
+    time_point now() override {return std::chrono::steady_clock::now();}
+
+    void sleep_until(time_point deadline) override {std::this_thread::sleep_until(deadline);}
+
+    bool wait_until(EventCount& ec, EventCount::Key key, time_point deadline) override
+    {
+        return ec.wait_until(key, deadline);
+    }
+};
+
+inline Clock& Clock::steady()
+{
+    static SteadyClock clock;
+    return clock;
+}
+
+/**
+ * Manually advanced clock, starting at the epoch of the steady clock (or at
+ * start).
+ */
+class VirtualClock: public Clock
+{
+public:
+    explicit VirtualClock(time_point start = time_point()): now_(start) {}
+
+    time_point now() override
+    {
+        std::lock_guard<Mutex> lk(mutex_);
+        return now_;
+    }
+
+    void sleep_until(time_point deadline) override
+    {
+        std::unique_lock<Mutex> lk(mutex_);
+        nb_waiters_++;
+        waiters_changed_.notify_all();
+        tick_.wait(lk, [&] {return now_ >= deadline;});
+        nb_waiters_--;
+    }
+
+    bool wait_until(EventCount& ec, EventCount::Key key, time_point deadline) override
+    {
+        Timed t {&ec, deadline, false};
+        {
+            std::lock_guard<Mutex> lk(mutex_);
+            if (now_ >= deadline) {
+                ec.cancel_wait();
+                return false;
+            }
+            timed_.push_back(&t);
+            nb_waiters_++;
+        }
+        waiters_changed_.notify_all();
+
+        // woken up by a notification, or by advance() past the deadline
+        ec.wait(key);
+
+        std::lock_guard<Mutex> lk(mutex_);
+        timed_.erase(std::find(timed_.begin(), timed_.end(), &t));
+        nb_waiters_--;
+        return !t.expired;
+    }
+
+    /**
+     * Move the time forward by d, expiring the waits whose deadline is passed.
+     */
+    template<typename Rep, typename Period>
+    void advance(std::chrono::duration<Rep, Period> d)
+    {
+        std::unique_lock<Mutex> lk(mutex_);
+        set(lk, now_ + std::chrono::duration_cast<duration>(d));
+    }
+
+    /**
+     * Set the time, which never goes backward.
+     */
+    void set(time_point t)
+    {
+        std::unique_lock<Mutex> lk(mutex_);
+        set(lk, std::max(t, now_));
+    }
+
+    /**
+     * Number of threads blocked in a timed wait or a sleep of this clock.
+     */
+    std::size_t nb_waiters()
+    {
+        std::lock_guard<Mutex> lk(mutex_);
+        return nb_waiters_;
+    }
+
+    /**
+     * Block until at least n threads are blocked in a timed wait or a sleep
+     * of this clock, to advance the time once they are.
+     */
+    void wait_waiters(std::size_t n)
+    {
+        std::unique_lock<Mutex> lk(mutex_);
+        waiters_changed_.wait(lk, [&] {return nb_waiters_ >= n;});
+    }
+
+private:
+    struct Timed
+    {
+        EventCount * ec;
+        time_point   deadline;
+        bool         expired;
+    };
+
+    void set(std::unique_lock<Mutex>& lk, time_point t)
+    {
+        now_ = t;
+        for (auto * w: timed_) {
+            if (!w->expired && w->deadline <= now_) {
+                w->expired = true;
+                // spurious wakeup of the other waiters of the event count,
+                // which check their condition again
+                w->ec->notify_all();
+            }
+        }
+        lk.unlock();
+        tick_.notify_all();
+    }
+
+    time_point           now_;
+    std::vector<Timed*>  timed_;
+    std::size_t          nb_waiters_ = 0;
+    Mutex                mutex_;
+    EventCount           tick_;
+    EventCount           waiters_changed_;
+};
+
+} /* namespace common */
@@ -0,0 +1,453 @@
+/**
+ * C++20 coroutine support: tasks, executors and awaitables for WaitQueue,
+ * EventMngr, Statemachine and timers.
+ *
+ *     common::coro::ThreadPool pool(4);
+ *     common::coro::spawn(pool, session(queue, loop));
+ *
+ *     common::coro::Task<> session(WaitQueue<Msg>& queue, EventLoop& loop)
+ *     {
+ *         for (;;) {
+ *             Msg m = co_await common::coro::pop(queue);
+ *             co_await common::coro::sleep_for(loop, std::chrono::milliseconds(10));
+ *             ...
+ *         }
+ *     }
+ *
+ * A suspended coroutine is resumed on the executor it was running on, so a
+ * few threads can serve any number of coroutines. Waiting coroutines hold no
+ * thread; they are subscribed to their source, which schedules them on the
+ * next push / notify / state change (the condition is checked again on
+ * resume, as with a condition variable).
+ *
+ * The module is only available in C++20 (COMMON_HAS_COROUTINES is 1): in
+ * C++17 this header is empty and the rest of the library is unaffected.
+ */
+
+#pragma once
+
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+
+#define COMMON_HAS_COROUTINES 1
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "event_loop.h"
+#include "event_mngr.h"
+#include "statemachine.h"
+#include "timeout_queue.h"
+#include "wait_queue.h"
+#include "waiter.h"
+
+namespace common {
+namespace coro {
+
+/**
+ * Resumes coroutines. current() is the executor running the calling thread,
+ * null outside of an executor.
+ */
+class Executor
+{
+public:
+    virtual ~Executor() = default;
+    virtual void schedule(std::coroutine_handle<> h) = 0;
+
+    static Executor * current() {return current_ref();}
+
+protected:
+    /**
+     * Resume h with this executor as the current one.
+     */
+    void resume(std::coroutine_handle<> h)
+    {
+        Executor * prev = current_ref();
+        current_ref() = this;
+        h.resume();
+        current_ref() = prev;
+    }
+
+private:
+    static Executor *& current_ref()
+    {
+        thread_local Executor * current = nullptr;
+        return current;
+    }
+};
+
+/**
+ * Fixed number of threads resuming the coroutines from a shared WaitQueue.
+ */
+class ThreadPool: public Executor
+{
+public:
+    explicit ThreadPool(std::size_t nb_threads = std::thread::hardware_concurrency())
+    {
+        for (std::size_t i = 0; i < std::max<std::size_t>(nb_threads, 1); i++)
+            threads_.emplace_back([this] {work();});
+    }
+
+    /**
+     * Coroutines still suspended are not resumed nor destroyed.
+     */
+    ~ThreadPool()
+    {
+        for (std::size_t i = 0; i < threads_.size(); i++)
+            queue_.push(std::coroutine_handle<>());
+        for (auto& t: threads_)
+            t.join();
+    }
+
+    void schedule(std::coroutine_handle<> h) override {queue_.push(h);}
+
+private:
+    void work()
+    {
+        for (;;) {
+            auto h = queue_.pop();
+            if (!h)
+                return;
+            resume(h);
+        }
+    }
+
+    WaitQueue<std::coroutine_handle<>> queue_;
+    std::vector<std::thread>           threads_;
+};
+
+/**
+ * Resume the coroutines in the thread of an EventLoop.
+ */
+class LoopExecutor: public Executor
+{
+public:
+    explicit LoopExecutor(EventLoop& loop): loop_(loop) {}
+
+    void schedule(std::coroutine_handle<> h) override
+    {
+        loop_.post([this, h] {resume(h);});
+    }
+
+private:
+    EventLoop& loop_;
+};
+
+namespace detail {
+
+inline Executor& current_executor()
+{
+    Executor * e = Executor::current();
+    if (!e)
+        throw std::logic_error("coroutine not running on a common::coro::Executor");
+    return *e;
+}
+
+template<typename T>
+struct TaskResult
+{
+    std::optional<T>   value;
+    std::exception_ptr error;
+
+    template<typename U>
+    void return_value(U&& v) {value.emplace(std::forward<U>(v));}
+
+    T get()
+    {
+        if (error)
+            std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template<>
+struct TaskResult<void>
+{
+    std::exception_ptr error;
+
+    void return_void() {}
+
+    void get()
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+};
+
+} /* namespace detail */
+
+/**
+ * Lazy coroutine returning a T. It starts when awaited, or when spawned for
+ * a Task<void>.
+ */
+template<typename T = void>
+class [[nodiscard]] Task
+{
+public:
+    struct promise_type: detail::TaskResult<T>
+    {
+        Task get_return_object()
+        {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept {return {};}
+
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept {return false;}
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+            {
+                // resume the awaiting coroutine only if it is already
+                // suspended, else it continues when the task is resumed
+                auto& p = h.promise();
+                if (p.done.exchange(true, std::memory_order_acq_rel))
+                    return p.continuation;
+                return std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+
+        FinalAwaiter final_suspend() noexcept {return {};}
+
+        void unhandled_exception() {this->error = std::current_exception();}
+
+        std::coroutine_handle<> continuation;
+        std::atomic_bool        done {false};
+    };
+
+    Task(Task&& other) noexcept: handle_(std::exchange(other.handle_, nullptr)) {}
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other) {
+            if (handle_)
+                handle_.destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    ~Task()
+    {
+        if (handle_)
+            handle_.destroy();
+    }
+
+    auto operator co_await() && noexcept
+    {
+        struct Awaiter
+        {
+            std::coroutine_handle<promise_type> h;
+
+            bool await_ready() noexcept {return false;}
+            // a task completing without suspending does not resume the
+            // awaiting coroutine from its final suspend point, which would
+            // nest one stack frame per co_await when the compiler does not
+            // turn the symmetric transfer into a tail call (unoptimized or
+            // sanitized builds)
+            bool await_suspend(std::coroutine_handle<> c) noexcept
+            {
+                h.promise().continuation = c;
+                h.resume();
+                return !h.promise().done.exchange(true, std::memory_order_acq_rel);
+            }
+            T await_resume() {return h.promise().get();}
+        };
+        return Awaiter{handle_};
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> h): handle_(h) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail {
+
+// self destroying coroutine running a spawned task
+struct Detached
+{
+    struct promise_type
+    {
+        Detached get_return_object()
+        {
+            return {std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() noexcept {return {};}
+        std::suspend_never  final_suspend() noexcept {return {};}
+        void return_void() {}
+        void unhandled_exception() {std::terminate();}
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+inline Detached run_detached(Task<> task)
+{
+    co_await std::move(task);
+}
+
+} /* namespace detail */
+
+/**
+ * Run task on executor, without waiting for it. An exception escaping from
+ * the task terminates the program, as for a std::thread.
+ */
+inline void spawn(Executor& executor, Task<> task)
+{
+    executor.schedule(detail::run_detached(std::move(task)).handle);
+}
+
+namespace detail {
+
+/**
+ * Suspend until the next change of a source, unless subscribe() (which
+ * atomically checks the awaited condition and subscribes) returns false.
+ * co_await returns whether the coroutine was suspended, i.e. whether the
+ * condition has to be checked again.
+ */
+template<typename Subscribe>
+class ChangeAwaiter: public Waiter
+{
+public:
+    explicit ChangeAwaiter(Subscribe subscribe): subscribe_(std::move(subscribe)) {}
+
+    bool await_ready() {return false;}
+
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        executor_  = &current_executor();
+        handle_    = h;
+        // once subscribed, the coroutine can be resumed and the awaiter
+        // destroyed by another thread: *this is not touched afterwards, and
+        // suspended_ is set before (the source lock and the executor order
+        // this write before the resume)
+        suspended_ = true;
+        auto subscribe = subscribe_;
+        if (!subscribe(this)) {
+            suspended_ = false;
+            return false;
+        }
+        return true;
+    }
+
+    bool await_resume() {return suspended_;}
+
+    // called with the lock of the source held: only schedule, the awaiter
+    // can be destroyed as soon as the coroutine is resumed
+    bool notify() override
+    {
+        executor_->schedule(handle_);
+        return false;
+    }
+
+private:
+    Subscribe               subscribe_;
+    Executor              * executor_ = nullptr;
+    std::coroutine_handle<> handle_;
+    bool                    suspended_ = false;
+};
+
+template<typename Subscribe>
+ChangeAwaiter<Subscribe> next_change(Subscribe subscribe)
+{
+    return ChangeAwaiter<Subscribe>(std::move(subscribe));
+}
+
+} /* namespace detail */
+
+/**
+ * Pop an element of queue, suspending while it is empty.
+ */
+template<typename T, typename Policy>
+Task<T> pop(BasicWaitQueue<T, Policy>& queue)
+{
+    for (;;) {
+        if (auto elt = queue.try_pop())
+            co_return std::move(*elt);
+        co_await detail::next_change([&](Waiter * w) {return queue.subscribe_if_empty(w);});
+    }
+}
+
+/**
+ * Suspend until the event e is notified to events.
+ */
+template<typename EventType, typename Allocator>
+Task<> wait(EventMngr<EventType, Allocator>& events, EventType e)
+{
+    while (co_await detail::next_change([&](Waiter * w) {return events.subscribe_if_absent(w, e);}))
+        ;
+}
+
+/**
+ * Suspend until sm is in the state st.
+ */
+template<typename T, template<typename> class Function>
+Task<> wait(Statemachine<T, Function>& sm, T st)
+{
+    while (co_await detail::next_change([&](Waiter * w) {return sm.subscribe_if_not_in(w, st);}))
+        ;
+}
+
+/**
+ * Suspend for d, using a timer of loop.
+ */
+template<typename Rep, typename Period>
+auto sleep_for(EventLoop& loop, std::chrono::duration<Rep, Period> d)
+{
+    struct Awaiter
+    {
+        EventLoop               & loop;
+        std::chrono::milliseconds delay;
+
+        bool await_ready() {return delay.count() <= 0;}
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            Executor * executor = &detail::current_executor();
+            loop.add_timer(delay, [executor, h](TimeoutQueue::Id, int64_t) {executor->schedule(h);});
+        }
+        void await_resume() {}
+    };
+    return Awaiter{loop, std::chrono::ceil<std::chrono::milliseconds>(d)};
+}
+
+/**
+ * Suspend for delay time units of timer, added at now. The coroutine resumes
+ * when timer is run past now + delay.
+ */
+template<typename Allocator, template<typename> class Function>
+auto sleep_for(BasicTimeoutQueue<Allocator, Function>& timer, int64_t now, int64_t delay)
+{
+    struct Awaiter
+    {
+        BasicTimeoutQueue<Allocator, Function>& timer;
+        int64_t                                 now;
+        int64_t                                 delay;
+
+        bool await_ready() {return false;}
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            Executor * executor = &detail::current_executor();
+            timer.add(now, delay, [executor, h](int64_t, int64_t) {executor->schedule(h);});
+        }
+        void await_resume() {}
+    };
+    return Awaiter{timer, now, delay};
+}
+
+} /* namespace coro */
+} /* namespace common */
+
+#else
+
+#define COMMON_HAS_COROUTINES 0
+
+#endif
@@ -0,0 +1,494 @@
+/**
+ * Event loop multiplexing file descriptors, timers, WaitQueues and EventMngrs
+ * on a single thread (Linux epoll, eventfd and timerfd).
+ *
+ *     common::EventLoopThread t;
+ *     auto& loop = t.loop();
+ *     loop.add_fd(sock, EPOLLIN, [&](uint32_t events) {...});
+ *     loop.watch(queue, [&](Message m) {...});
+ *     loop.add_repeating_timer(std::chrono::milliseconds(100), [&](auto, auto) {...});
+ *     t.start(true);
+ *     ...
+ *     t.stop();
+ *     t.join();
+ *
+ * Handlers are called from the thread running the loop. Pushes to a watched
+ * queue, event notifications, post() and timers added from other threads wake
+ * the loop through an eventfd, so it never polls.
+ *
+ * Watched queues and event managers must outlive the loop, or be unwatched
+ * first. Elements of watched queues need not be default constructible.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "event_mngr.h"
+#include "thread.h"
+#include "timeout_queue.h"
+#include "wait_queue.h"
+#include "waiter.h"
+
+namespace common {
+
+class EventLoop
+{
+public:
+    using FdHandler = std::function<void(uint32_t events)>;
+    using Task      = std::function<void()>;
+    using TimerId   = TimeoutQueue::Id;
+    using WatchId   = uint64_t;
+
+    /**
+     * Maximum number of elements taken from a watched queue per iteration, so
+     * that a busy queue does not starve the other sources.
+     */
+    static constexpr std::size_t max_batch = 64;
+
+    EventLoop()
+    {
+        epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd_ < 0)
+            throw std::system_error(errno, std::generic_category(), "epoll_create1");
+        event_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        timer_fd_ = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (event_fd_ < 0 || timer_fd_ < 0) {
+            const int err = errno;
+            close_fds();
+            throw std::system_error(err, std::generic_category(), "eventfd / timerfd_create");
+        }
+        try {
+            ctl(EPOLL_CTL_ADD, event_fd_, EPOLLIN);
+            ctl(EPOLL_CTL_ADD, timer_fd_, EPOLLIN);
+        } catch (...) {
+            close_fds();
+            throw;
+        }
+    }
+
+    ~EventLoop()
+    {
+        for (auto& w: watches_)
+            w.second->unsubscribe();
+        close_fds();
+    }
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    /**
+     * Call handler with the ready events (EPOLLIN, EPOLLOUT, ...) each time fd
+     * is ready for one of events. fd is not owned by the loop.
+     */
+    void add_fd(int fd, uint32_t events, FdHandler handler)
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        ctl(EPOLL_CTL_ADD, fd, events);
+        fds_[fd] = std::make_shared<FdHandler>(std::move(handler));
+    }
+
+    void modify_fd(int fd, uint32_t events)
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        ctl(EPOLL_CTL_MOD, fd, events);
+    }
+
+    /**
+     * Stop watching fd, which must be done before closing it.
+     */
+    void remove_fd(int fd)
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        if (fds_.erase(fd))
+            ctl(EPOLL_CTL_DEL, fd, 0);
+    }
+
+    /**
+     * Call handler with each element pushed to queue.
+     */
+    template<typename T, typename Policy, typename Handler>
+    WatchId watch(BasicWaitQueue<T, Policy>& queue, Handler handler)
+    {
+        return add_watch(std::make_shared<QueueWatch<T, Policy, Handler>>(
+                this, queue, std::move(handler)));
+    }
+
+    /**
+     * Call handler each time the event e is notified to events. The event is
+     * erased from events before handler is called.
+     */
+    template<typename EventType, typename Allocator, typename Handler>
+    WatchId watch(EventMngr<EventType, Allocator>& events, EventType e, Handler handler)
+    {
+        return add_watch(std::make_shared<EventWatch<EventType, Allocator, Handler>>(
+                this, events, e, std::move(handler)));
+    }
+
+    /**
+     * Stop watching. Once unwatch() returns, the handler is not running and is
+     * not called anymore, so that the queue or event manager can be destroyed.
+     * Called from another thread than the loop, it waits for a running call
+     * of the handler to return.
+     */
+    bool unwatch(WatchId id)
+    {
+        std::shared_ptr<Watch> w;
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            auto search = watches_.find(id);
+            if (search == watches_.end())
+                return false;
+            w = std::move(search->second);
+            watches_.erase(search);
+        }
+        w->unsubscribe();
+        if (loop_thread_.load() == std::this_thread::get_id()) {
+            // from a handler: the watch is not being dispatched, or by the
+            // caller, which stops the dispatch once the handler returns
+            w->active = false;
+        } else {
+            std::lock_guard<std::mutex> lk(w->dispatch_mutex);
+            w->active = false;
+        }
+        return true;
+    }
+
+    /**
+     * Timers, in milliseconds of the steady clock. callback receives the id
+     * of the timer and the current time.
+     */
+    TimerId add_timer(std::chrono::milliseconds delay, TimeoutQueue::Callback callback)
+    {
+        const auto id = timers_.add(now_ms(), delay.count(), std::move(callback));
+        wakeup();
+        return id;
+    }
+
+    TimerId add_repeating_timer(std::chrono::milliseconds interval, TimeoutQueue::Callback callback)
+    {
+        const auto id = timers_.add_repeating(now_ms(), interval.count(), std::move(callback));
+        wakeup();
+        return id;
+    }
+
+    /**
+     * Timers that can fire up to slack late, coalesced with the other timers
+     * in this window to save wakeups (see TimeoutQueue::add()).
+     */
+    TimerId add_timer(std::chrono::milliseconds delay, std::chrono::milliseconds slack,
+                      TimeoutQueue::Callback callback)
+    {
+        const auto id = timers_.add(now_ms(), delay.count(), slack.count(), std::move(callback));
+        wakeup();
+        return id;
+    }
+
+    TimerId add_repeating_timer(std::chrono::milliseconds interval, std::chrono::milliseconds slack,
+                                TimeoutQueue::Callback callback)
+    {
+        const auto id = timers_.add_repeating(now_ms(), interval.count(), slack.count(),
+                                              std::move(callback));
+        wakeup();
+        return id;
+    }
+
+    bool cancel_timer(TimerId id) {return timers_.erase(id);}
+
+    /**
+     * Run task in the loop thread, at the next iteration.
+     */
+    void post(Task task)
+    {
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            tasks_.push_back(std::move(task));
+        }
+        wakeup();
+    }
+
+    /**
+     * Wake the loop up if it is blocked waiting.
+     */
+    void wakeup()
+    {
+        const uint64_t one = 1;
+        [[maybe_unused]] auto ret = ::write(event_fd_, &one, sizeof(one));
+    }
+
+    /**
+     * Run the loop until stop() is called.
+     */
+    void run()
+    {
+        while (!stop_.exchange(false))
+            run_once(-1);
+    }
+
+    /**
+     * Make run() return, from any thread.
+     */
+    void stop()
+    {
+        stop_ = true;
+        wakeup();
+    }
+
+    /**
+     * Wait up to timeout_ms (-1 for no limit) for something to happen and
+     * dispatch it: ready fds, posted tasks, watched queues and events, due
+     * timers.
+     */
+    void run_once(int timeout_ms)
+    {
+        loop_thread_ = std::this_thread::get_id();
+        // before sleeping rather than after the timers ran, which a throwing
+        // handler interrupts
+        arm_timer();
+
+        epoll_event events[max_events];
+        const int n = ::epoll_wait(epoll_fd_, events, max_events, timeout_ms);
+        if (n < 0 && errno != EINTR)
+            throw std::system_error(errno, std::generic_category(), "epoll_wait");
+
+        for (int i = 0; i < n; i++) {
+            const int fd = events[i].data.fd;
+            if (fd == event_fd_ || fd == timer_fd_) {
+                uint64_t count;
+                [[maybe_unused]] auto ret = ::read(fd, &count, sizeof(count));
+                // the timerfd is disarmed once expired: re-arm it even on the
+                // same expiration, e.g. for the timers kept when one throws
+                if (fd == timer_fd_)
+                    armed_ = std::numeric_limits<int64_t>::max();
+                continue;
+            }
+            std::shared_ptr<FdHandler> handler;
+            {
+                std::lock_guard<std::mutex> lk(mutex_);
+                auto search = fds_.find(fd);
+                if (search == fds_.end())
+                    continue;   // removed by a previous handler
+                handler = search->second;
+            }
+            (*handler)(events[i].events);
+        }
+
+        run_tasks();
+        run_watches();
+        timers_.run_once(now_ms());
+    }
+
+    static int64_t now_ms()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    static constexpr int max_events = 64;
+
+    struct Watch: Waiter
+    {
+        explicit Watch(EventLoop * loop): loop(loop) {}
+
+        bool notify() override
+        {
+            if (!pending.exchange(true))
+                loop->wakeup();
+            return true;
+        }
+
+        virtual void dispatch() = 0;
+        virtual void subscribe() = 0;
+        virtual void unsubscribe() = 0;
+
+        EventLoop      * loop;
+        std::atomic_bool pending {false};
+        // held while dispatching, active is cleared under it by unwatch()
+        std::mutex       dispatch_mutex;
+        std::atomic_bool active {true};
+    };
+
+    template<typename T, typename Policy, typename Handler>
+    struct QueueWatch: Watch
+    {
+        QueueWatch(EventLoop * loop, BasicWaitQueue<T, Policy>& queue, Handler&& handler):
+            Watch(loop), queue(queue), handler(std::move(handler)) {}
+
+        void dispatch() override
+        {
+            for (std::size_t i = 0; i < max_batch; i++) {
+                // unwatched by the handler
+                if (!active)
+                    return;
+                auto elt = queue.try_pop();
+                if (!elt)
+                    return;
+                handler(std::move(*elt));
+            }
+            // elements left, come back at the next iteration
+            notify();
+        }
+
+        void subscribe() override   {queue.subscribe(this);}
+        void unsubscribe() override {queue.unsubscribe(this);}
+
+        BasicWaitQueue<T, Policy>& queue;
+        Handler                    handler;
+    };
+
+    template<typename EventType, typename Allocator, typename Handler>
+    struct EventWatch: Watch
+    {
+        EventWatch(EventLoop * loop, EventMngr<EventType, Allocator>& events, EventType e,
+                   Handler&& handler):
+            Watch(loop), events(events), e(e), handler(std::move(handler)) {}
+
+        void dispatch() override
+        {
+            if (events.erase(e))
+                handler(e);
+        }
+
+        void subscribe() override   {events.subscribe(this);}
+        void unsubscribe() override {events.unsubscribe(this);}
+
+        EventMngr<EventType, Allocator>& events;
+        EventType                        e;
+        Handler                          handler;
+    };
+
+    WatchId add_watch(std::shared_ptr<Watch> w)
+    {
+        WatchId id;
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            id = next_watch_id_++;
+            watches_[id] = w;
+        }
+        w->subscribe();
+        // elements already queued / event already notified
+        w->notify();
+        return id;
+    }
+
+    void run_tasks()
+    {
+        std::vector<Task> tasks;
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            tasks.swap(tasks_);
+        }
+        for (auto& t: tasks)
+            t();
+    }
+
+    void run_watches()
+    {
+        std::vector<std::shared_ptr<Watch>> pending;
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            for (auto& w: watches_)
+                if (w.second->pending.exchange(false))
+                    pending.push_back(w.second);
+        }
+        for (auto& w: pending) {
+            std::lock_guard<std::mutex> lk(w->dispatch_mutex);
+            if (w->active)
+                w->dispatch();
+        }
+    }
+
+    // arm the timerfd on the next timer expiration, if it changed
+    void arm_timer()
+    {
+        const int64_t next = timers_.next_expiration();
+        if (next == armed_)
+            return;
+        armed_ = next;
+
+        itimerspec spec {};
+        if (next != std::numeric_limits<int64_t>::max()) {
+            // 0 would disarm the timer
+            const int64_t ms = std::max<int64_t>(next, 1);
+            spec.it_value.tv_sec  = ms / 1000;
+            spec.it_value.tv_nsec = (ms % 1000) * 1000000;
+        }
+        if (::timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr) < 0)
+            throw std::system_error(errno, std::generic_category(), "timerfd_settime");
+    }
+
+    void ctl(int op, int fd, uint32_t events)
+    {
+        epoll_event ev {};
+        ev.events  = events;
+        ev.data.fd = fd;
+        if (::epoll_ctl(epoll_fd_, op, fd, &ev) < 0)
+            throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+    }
+
+    void close_fds()
+    {
+        for (int fd: {timer_fd_, event_fd_, epoll_fd_})
+            if (fd >= 0)
+                ::close(fd);
+    }
+
+    int epoll_fd_ = -1;
+    int event_fd_ = -1;
+    int timer_fd_ = -1;
+
+    TimeoutQueue timers_;
+    int64_t      armed_ = std::numeric_limits<int64_t>::max();
+
+    std::map<int, std::shared_ptr<FdHandler>> fds_;
+    std::map<WatchId, std::shared_ptr<Watch>> watches_;
+    WatchId                                   next_watch_id_ = 1;
+    std::vector<Task>                         tasks_;
+    std::mutex                                mutex_;
+
+    std::atomic_bool              stop_ {false};
+    std::atomic<std::thread::id>  loop_thread_;
+};
+
+/**
+ * Thread running an EventLoop until stopped.
+ */
+class EventLoopThread: public Thread
+{
+public:
+    EventLoop& loop() {return loop_;}
+
+    void run() override
+    {
+        notify_running();
+        loop_.run();
+    }
+
+    void stop() override
+    {
+        Thread::stop();
+        loop_.stop();
+    }
+
+private:
+    EventLoop loop_;
+};
+
+} /* namespace common */
@@ -1,39 +1,63 @@
 #pragma once
 
+#include <chrono>
 #include <mutex>
 #include <condition_variable>
 #include <set>
 #include <vector>
 #include <algorithm>
+#include <functional>
+#include <memory>
+
+#include "clock.h"
+#include "sync.h"
+#include "waiter.h"
 
 namespace common {
 
-template<typename EventType>
+/**
+ * Set of pending events that threads can wait on.
+ *
+ * @param Allocator allocator of the underlying set (e.g. PoolAllocator<EventType>)
+ */
+template<typename EventType, typename Allocator = std::allocator<EventType>>
 class EventMngr
 {
 public:
+    EventMngr() = default;
+    explicit EventMngr(const Allocator& alloc): events_(alloc) {}
+
+    /**
+     * @param clock clock measuring the timeouts of wait_for()
+     */
+    explicit EventMngr(Clock& clock, const Allocator& alloc = Allocator()):
+        events_(alloc), clock_(&clock) {}
+
     void notify(EventType e)
     {
-        std::lock_guard<std::mutex> lk(mutex_);
-        events_.insert(e);
+        {
+            std::lock_guard<Mutex> lk(mutex_);
+            events_.insert(e);
+            waiters_.notify();
+        }
         cv_.notify_all();
     }
 
     void wait()
     {
-        std::unique_lock<std::mutex> lk(mutex_);
+        std::unique_lock<Mutex> lk(mutex_);
         cv_.wait(lk, [&]{return !events_.empty();});
     }
 
     void wait(EventType e)
     {
-        std::unique_lock<std::mutex> lk(mutex_);
+        std::unique_lock<Mutex> lk(mutex_);
         cv_.wait(lk, [&]{return (events_.find(e) != events_.end());});
     }
 
     void wait_any(std::vector<EventType> events)
     {
-        std::unique_lock<std::mutex> lk(mutex_);
+        std::unique_lock<Mutex> lk(mutex_);
         cv_.wait(lk, [&]
             {
                 return std::any_of(events.cbegin(), events.cend(),
@@ -43,7 +67,7 @@ public:
 
     void wait_all(std::vector<EventType> events)
     {
-        std::unique_lock<std::mutex> lk(mutex_);
+        std::unique_lock<Mutex> lk(mutex_);
         cv_.wait(lk, [&]
             {
                 return std::all_of(events.cbegin(), events.cend(),
@@ -53,32 +77,63 @@ public:
 
     std::cv_status wait_for(EventType e, std::chrono::milliseconds timeout)
     {
-        std::unique_lock<std::mutex> lk(mutex_);
-        return cv_.wait(lk, timeout, [&]{return (events_.find(e) != events_.end());});
+        std::unique_lock<Mutex> lk(mutex_);
+        return clock_->wait_for(cv_, lk, timeout, [&]{return (events_.find(e) != events_.end());}) ?
+            std::cv_status::no_timeout : std::cv_status::timeout;
     }
 
     bool erase(EventType e)
     {
-        std::lock_guard<std::mutex> lk(mutex_);
+        std::lock_guard<Mutex> lk(mutex_);
         return events_.erase(e);
     }
 
     bool contains(EventType e)
     {
-        std::lock_guard<std::mutex> lk(mutex_);
+        std::lock_guard<Mutex> lk(mutex_);
         return !(events_.find(e) == events_.end());
     }
 
     void clear()
     {
-        std::lock_guard<std::mutex> lk(mutex_);
+        std::lock_guard<Mutex> lk(mutex_);
         events_.clear();
     }
 
+    /**
+     * Notify w after each notify(), until it is unsubscribed.
+     */
+    void subscribe(Waiter * w)
+    {
+        std::lock_guard<Mutex> lk(mutex_);
+        waiters_.add(w);
+    }
+
+    /**
+     * Subscribe w if the event e is not pending, atomically. Return false,
+     * without subscribing, if it is.
+     */
+    bool subscribe_if_absent(Waiter * w, EventType e)
+    {
+        std::lock_guard<Mutex> lk(mutex_);
+        if (events_.find(e) != events_.end())
+            return false;
+        waiters_.add(w);
+        return true;
+    }
+
+    void unsubscribe(Waiter * w)
+    {
+        std::lock_guard<Mutex> lk(mutex_);
+        waiters_.remove(w);
+    }
+
 private:
-    std::set<EventType>     events_;
-    std::mutex              mutex_;
-    std::condition_variable cv_;
+    std::set<EventType, std::less<EventType>, Allocator> events_;
+    Mutex                   mutex_;
+    EventCount              cv_;
+    WaiterList              waiters_;
+    Clock                 * clock_ = &Clock::steady();
 };
 
 } /* namespace common */
@@ -0,0 +1,175 @@
+/**
+ * Move-only polymorphic function wrapper with inline storage.
+ *
+ * Unlike std::function, InplaceFunction never allocates: the callable is
+ * stored in a Capacity bytes buffer inside the object (too large callables are
+ * rejected at compile time), and it accepts move-only callables (lambdas
+ * capturing a unique_ptr, ...). It can not be copied.
+ *
+ *     common::InplaceFunction<void(int), 64> f = [buf = std::move(buf)](int v) {...};
+ *
+ * It can be used as the Function parameter of Statemachine and
+ * BasicTimeoutQueue in place of std::function, through a template of a single
+ * parameter such as InplaceFunctionOf:
+ *
+ *     common::BasicTimeoutQueue<std::allocator<void>, common::InplaceFunctionOf> timers;
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace common {
+
+template<typename Signature, std::size_t Capacity = 32,
+         std::size_t Alignment = alignof(std::max_align_t)>
+class InplaceFunction;
+
+namespace detail {
+
+template<typename T>
+struct is_inplace_function: std::false_type {};
+
+template<typename Signature, std::size_t Capacity, std::size_t Alignment>
+struct is_inplace_function<InplaceFunction<Signature, Capacity, Alignment>>: std::true_type {};
+
+} /* namespace detail */
+
+template<typename R, typename... Args, std::size_t Capacity, std::size_t Alignment>
+class InplaceFunction<R(Args...), Capacity, Alignment>
+{
+public:
+    InplaceFunction() noexcept = default;
+    InplaceFunction(std::nullptr_t) noexcept {}
+
+    template<typename F, typename D = std::decay_t<F>,
+             typename = std::enable_if_t<!detail::is_inplace_function<D>::value &&
+                                         std::is_invocable_r_v<R, D&, Args...>>>
+    InplaceFunction(F&& f)
+    {
+        static_assert(sizeof(D) <= Capacity, "callable too large for the inline storage");
+        static_assert(Alignment % alignof(D) == 0, "callable alignment not supported");
+        static_assert(std::is_nothrow_move_constructible_v<D>,
+                      "callable must be nothrow move constructible");
+
+        // a function passed by reference (decaying to a pointer) is never null
+        if constexpr (std::is_pointer_v<std::remove_reference_t<F>> ||
+                      std::is_member_pointer_v<std::remove_reference_t<F>>) {
+            if (f == nullptr)
+                return;
+        }
+        ::new (static_cast<void*>(&storage_)) D(std::forward<F>(f));
+        ops_ = &ops_for<D>;
+    }
+
+    InplaceFunction(InplaceFunction&& other) noexcept
+    {
+        if (other.ops_) {
+            other.ops_->move(&storage_, &other.storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+
+    InplaceFunction& operator=(InplaceFunction&& other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            if (other.ops_) {
+                other.ops_->move(&storage_, &other.storage_);
+                ops_ = other.ops_;
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    InplaceFunction& operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+
+    template<typename F, typename D = std::decay_t<F>,
+             typename = std::enable_if_t<!detail::is_inplace_function<D>::value &&
+                                         std::is_invocable_r_v<R, D&, Args...>>>
+    InplaceFunction& operator=(F&& f)
+    {
+        return *this = InplaceFunction(std::forward<F>(f));
+    }
+
+    InplaceFunction(const InplaceFunction&) = delete;
+    InplaceFunction& operator=(const InplaceFunction&) = delete;
+
+    ~InplaceFunction() {reset();}
+
+    R operator()(Args... args) const
+    {
+        if (!ops_)
+            throw std::bad_function_call();
+        return ops_->invoke(&storage_, std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const noexcept {return ops_ != nullptr;}
+
+    friend bool operator==(const InplaceFunction& f, std::nullptr_t) noexcept {return !f;}
+    friend bool operator!=(const InplaceFunction& f, std::nullptr_t) noexcept {return static_cast<bool>(f);}
+
+private:
+    using Storage = std::aligned_storage_t<Capacity, Alignment>;
+
+    struct Ops
+    {
+        R    (*invoke)(void *, Args&&...);
+        void (*move)(void * dst, void * src);
+        void (*destroy)(void *);
+    };
+
+    template<typename D>
+    static constexpr Ops ops_for = {
+        [](void * s, Args&&... args) -> R
+        {
+            // the result of the callable, if any, is discarded for a void R
+            if constexpr (std::is_void_v<R>)
+                std::invoke(*static_cast<D*>(s), std::forward<Args>(args)...);
+            else
+                return std::invoke(*static_cast<D*>(s), std::forward<Args>(args)...);
+        },
+        [](void * dst, void * src)
+        {
+            ::new (dst) D(std::move(*static_cast<D*>(src)));
+            static_cast<D*>(src)->~D();
+        },
+        [](void * s)
+        {
+            static_cast<D*>(s)->~D();
+        }
+    };
+
+    void reset() noexcept
+    {
+        if (ops_) {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    // callables are invoked as non-const, like std::function does
+    mutable Storage storage_;
+    const Ops     * ops_ = nullptr;
+};
+
+/**
+ * InplaceFunction with the default capacity and alignment. Passing
+ * InplaceFunction itself as a template<typename> class parameter relies on
+ * P0522 (matching of the default arguments), which some compilers (Clang
+ * before 19) do not enable.
+ */
+template<typename Signature>
+using InplaceFunctionOf = InplaceFunction<Signature>;
+
+} /* namespace common */
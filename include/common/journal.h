@@ -0,0 +1,918 @@
+/**
+ * Write-ahead journal persisting the content of a WaitQueue or a TimeoutQueue
+ * across restarts.
+ *
+ *  - Journal: append-only file of checksummed records, written through a
+ *    shared memory mapping. sync() makes the appended records durable, the
+ *    threads calling it concurrently sharing one fdatasync (group commit).
+ *    compact() atomically replaces the records by a snapshot of the state,
+ *    compact_async() does the same from a background thread.
+ *  - PersistentWaitQueue<T>: FIFO WaitQueue journaling its pushes and pops,
+ *    refilled from the journal on construction.
+ *  - PersistentTimeoutQueue: timeout queue whose timers carry a payload
+ *    instead of a callback, every timer being dispatched to a single handler,
+ *    so that they can be restored from the journal.
+ *
+ *     common::Journal journal("/var/lib/app/queue.journal");
+ *     common::PersistentWaitQueue<Job> queue(journal);   // replayed
+ *     queue.push(job);
+ *     journal.sync();                                     // durable
+ *
+ * Both compact their journal once it grows past twice its size after the last
+ * compaction (and past min_compact_size), so the restart time is bounded by the
+ * size of the state rather than by its history. The snapshot is taken with
+ * the queue locked, the journal is rewritten by a background thread.
+ *
+ * A journal is owned by a single queue and must outlive it. Records are in
+ * the host byte order: a journal is not portable between architectures.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sync.h"
+#include "timeout_queue.h"
+#include "wait_queue.h"
+
+namespace common {
+
+namespace detail {
+
+inline uint32_t crc32(const void * data, std::size_t size, uint32_t crc = 0)
+{
+    static const auto table = []
+        {
+            std::array<uint32_t, 256> t;
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                    c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+                t[i] = c;
+            }
+            return t;
+        }();
+
+    const uint8_t * p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    for (std::size_t i = 0; i < size; i++)
+        crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+} /* namespace detail */
+
+class Journal
+{
+public:
+    /**
+     * Record sink of compact().
+     */
+    class Writer
+    {
+    public:
+        void append(uint32_t type, const void * data, std::size_t size)
+        {
+            const std::size_t offset = buffer_.size();
+            buffer_.resize(offset + record_size(size));
+            write_record(&buffer_[offset], type, data, size);
+        }
+
+    private:
+        friend class Journal;
+        std::string buffer_;
+    };
+
+    /**
+     * Open or create the journal at path. The records after the first
+     * incomplete or corrupted one (torn by a crash) are discarded.
+     *
+     * @param capacity initial size of the file, which grows by doubling
+     */
+    explicit Journal(std::string path, std::size_t capacity = 1 << 20):
+        path_(std::move(path)), initial_capacity_(std::max(capacity, header_size))
+    {
+        open();
+    }
+
+    ~Journal()
+    {
+        if (compactor_.joinable()) {
+            {
+                std::lock_guard<Mutex> lk(request_mutex_);
+                stop_ = true;
+            }
+            requested_.notify_all();
+            compactor_.join();
+        }
+        if (compact_error_) {
+            try {
+                std::rethrow_exception(compact_error_);
+            } catch (const std::exception& e) {
+                std::fprintf(stderr, "common::Journal %s: compaction failed: %s\n",
+                             path_.c_str(), e.what());
+            } catch (...) {}
+        }
+        // give the unused capacity back, the records end at end_
+        if (fd_ >= 0 && ::ftruncate(fd_, end_) < 0) {}
+        unmap();
+    }
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    /**
+     * Append a record, of an owner defined type. It is durable once sync()
+     * returns.
+     */
+    void append(uint32_t type, const void * data, std::size_t size)
+    {
+        std::lock_guard<Mutex> lk(mutex_);
+        check_open();
+        const std::size_t n = record_size(size);
+        reserve(end_ + n);
+        write_record(map_ + end_, type, data, size);
+        end_      += n;
+        appended_ += n;
+    }
+
+    /**
+     * Flush the records appended so far to the disk. The callers arriving
+     * while a flush is in progress are served by the next one.
+     */
+    void sync()
+    {
+        {
+            std::lock_guard<Mutex> lk(request_mutex_);
+            if (compact_error_)
+                std::rethrow_exception(std::exchange(compact_error_, nullptr));
+        }
+        uint64_t target;
+        {
+            std::lock_guard<Mutex> lk(mutex_);
+            check_open();
+            target = appended_;
+        }
+        std::lock_guard<Mutex> lk(sync_mutex_);
+        if (synced_ >= target)
+            return;
+        uint64_t appended;
+        {
+            std::lock_guard<Mutex> lk(mutex_);
+            appended = appended_;
+        }
+        if (::fdatasync(fd_) < 0)
+            throw std::system_error(errno, std::generic_category(), "fdatasync " + path_);
+        synced_ = appended;
+    }
+
+    /**
+     * Call f(type, data, size) for each record, in append order. f must not
+     * append to the journal.
+     */
+    template<typename F>
+    void replay(F f)
+    {
+        std::lock_guard<Mutex> lk(mutex_);
+        check_open();
+        for (std::size_t offset = header_size; offset < end_;) {
+            RecordHeader h;
+            std::memcpy(&h, map_ + offset, sizeof(h));
+            f(h.type, map_ + offset + sizeof(h), std::size_t(h.size));
+            offset += record_size(h.size);
+        }
+    }
+
+    /**
+     * Replace the records by the ones written by snapshot(Writer&), durably:
+     * the new journal is synced and renamed over the old one. The records
+     * appended concurrently are carried over to the new journal.
+     */
+    template<typename F>
+    void compact(F snapshot)
+    {
+        Writer w;
+        w.buffer_.assign(magic, header_size);
+        snapshot(w);
+        const uint64_t mark = appended();
+
+        std::lock_guard<Mutex> clk(compact_mutex_);
+        write_compacted(w.buffer_, mark);
+    }
+
+    /**
+     * Same as compact(), the snapshot being written to the disk by a
+     * background thread: only snapshot(Writer&), which serializes the state
+     * in memory, runs in the caller. It must be called with the lock of the
+     * owner held, so that no record is appended until it returns.
+     *
+     * Return false, without calling snapshot, if a compaction is already in
+     * progress. A failure of the background compaction is thrown by the next
+     * sync() or wait_compaction().
+     */
+    template<typename F>
+    bool compact_async(F snapshot)
+    {
+        if (compacting_.load(std::memory_order_acquire))
+            return false;
+
+        Writer w;
+        w.buffer_.assign(magic, header_size);
+        snapshot(w);
+        const uint64_t mark = appended();
+
+        {
+            std::lock_guard<Mutex> lk(request_mutex_);
+            if (compacting_.load(std::memory_order_relaxed))
+                return false;
+            compacting_.store(true, std::memory_order_relaxed);
+            request_      = std::move(w.buffer_);
+            request_mark_ = mark;
+            if (!compactor_.joinable())
+                compactor_ = std::thread([this] {run_compactor();});
+        }
+        requested_.notify_all();
+        return true;
+    }
+
+    /**
+     * Wait for the end of the background compaction in progress, if any, and
+     * throw its failure.
+     */
+    void wait_compaction()
+    {
+        std::unique_lock<Mutex> lk(request_mutex_);
+        requested_.wait(lk, [this] {return !compacting_.load(std::memory_order_relaxed);});
+        if (compact_error_)
+            std::rethrow_exception(std::exchange(compact_error_, nullptr));
+    }
+
+    /**
+     * Whether the journal grew past min_size and past twice its size after
+     * its last compaction (or when it was opened), i.e. whether compacting it
+     * reclaims at least half of it.
+     */
+    bool needs_compaction(std::size_t min_size) const
+    {
+        std::lock_guard<Mutex> lk(mutex_);
+        return end_ > std::max(min_size, 2 * compacted_size_);
+    }
+
+    /**
+     * Number of compactions completed since the journal was opened.
+     */
+    uint64_t compactions() const
+    {
+        std::lock_guard<Mutex> lk(mutex_);
+        return compactions_;
+    }
+
+    /**
+     * Bytes used by the records in the file.
+     */
+    std::size_t size() const
+    {
+        std::lock_guard<Mutex> lk(mutex_);
+        return end_;
+    }
+
+    const std::string& path() const {return path_;}
+
+private:
+    struct RecordHeader
+    {
+        uint32_t size;
+        uint32_t type;
+        uint32_t crc;   // of size, type and the payload
+    };
+
+    static constexpr const char * magic       = "CJOURNL1";
+    static constexpr std::size_t  header_size = 8;
+
+    static std::size_t record_size(std::size_t size) {return sizeof(RecordHeader) + size;}
+
+    static void write_record(char * dst, uint32_t type, const void * data, std::size_t size)
+    {
+        if (size > std::numeric_limits<uint32_t>::max())
+            throw std::length_error("journal record too large");
+        RecordHeader h;
+        h.size = static_cast<uint32_t>(size);
+        h.type = type;
+        h.crc  = detail::crc32(data, size, detail::crc32(&h, offsetof(RecordHeader, crc)));
+        std::memcpy(dst, &h, sizeof(h));
+        if (size)
+            std::memcpy(dst + sizeof(h), data, size);
+    }
+
+    // end of the valid records starting at header_size
+    std::size_t scan() const
+    {
+        std::size_t offset = header_size;
+        while (capacity_ - offset >= sizeof(RecordHeader)) {
+            RecordHeader h;
+            std::memcpy(&h, map_ + offset, sizeof(h));
+            if (h.size > capacity_ - offset - sizeof(RecordHeader))
+                break;
+            const char * payload = map_ + offset + sizeof(h);
+            if (h.crc != detail::crc32(payload, h.size, detail::crc32(&h, offsetof(RecordHeader, crc))))
+                break;
+            offset += record_size(h.size);
+        }
+        return offset;
+    }
+
+    void open()
+    {
+        fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd_ < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + path_);
+
+        struct stat st;
+        if (::fstat(fd_, &st) < 0)
+            fail("fstat");
+        const std::size_t file_size = static_cast<std::size_t>(st.st_size);
+        capacity_ = std::max(file_size, initial_capacity_);
+        if (capacity_ != file_size && ::ftruncate(fd_, capacity_) < 0)
+            fail("ftruncate");
+
+        void * addr = ::mmap(nullptr, capacity_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (addr == MAP_FAILED)
+            fail("mmap");
+        map_ = static_cast<char*>(addr);
+
+        if (file_size == 0) {
+            std::memcpy(map_, magic, header_size);
+            end_ = compacted_size_ = header_size;
+            return;
+        }
+        if (file_size < header_size || std::memcmp(map_, magic, header_size) != 0) {
+            unmap();
+            throw std::runtime_error(path_ + ": not a journal");
+        }
+        end_ = compacted_size_ = scan();
+        // clear a torn record, so that it can not be mistaken for a valid
+        // one once partially overwritten
+        if (capacity_ - end_ >= sizeof(RecordHeader)) {
+            static const char zero[sizeof(RecordHeader)] = {};
+            if (std::memcmp(map_ + end_, zero, sizeof(zero)) != 0)
+                std::memset(map_ + end_, 0, capacity_ - end_);
+        }
+    }
+
+    void write_all(int fd, const std::string& tmp, const char * data, std::size_t size)
+    {
+        std::size_t written = 0;
+        while (written < size) {
+            const ssize_t n = ::write(fd, data + written, size - written);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                throw std::system_error(errno, std::generic_category(), "write " + tmp);
+            written += n;
+        }
+    }
+
+    uint64_t appended() const
+    {
+        std::lock_guard<Mutex> lk(mutex_);
+        return appended_;
+    }
+
+    // records appended since mark (a value of appended_, which unlike the
+    // offsets survives compactions), mark being moved past them
+    std::string tail(uint64_t& mark) const
+    {
+        const std::size_t n = appended_ - mark;
+        mark = appended_;
+        return std::string(map_ + end_ - n, n);
+    }
+
+    std::string locked_tail(uint64_t& mark) const
+    {
+        std::lock_guard<Mutex> lk(mutex_);
+        return tail(mark);
+    }
+
+    /**
+     * Write records (a snapshot of the journal when appended_ was mark) and
+     * the records appended since to a new file, and rename it over the
+     * journal. The file is written and synced without the journal locks, only
+     * the records appended during the last sync are copied with them held.
+     */
+    void write_compacted(const std::string& records, uint64_t mark)
+    {
+        const std::string tmp = path_ + ".compact";
+        int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + tmp);
+        try {
+            write_all(fd, tmp, records.data(), records.size());
+            std::string t = locked_tail(mark);
+            write_all(fd, tmp, t.data(), t.size());
+            if (::fdatasync(fd) < 0)
+                throw std::system_error(errno, std::generic_category(), "fdatasync " + tmp);
+
+            // no sync() completes from here, so that the records appended
+            // meanwhile (copied after the last fdatasync) are not yet durable
+            std::lock_guard<Mutex> slk(sync_mutex_);
+            t = locked_tail(mark);
+            if (!t.empty()) {
+                write_all(fd, tmp, t.data(), t.size());
+                if (::fdatasync(fd) < 0)
+                    throw std::system_error(errno, std::generic_category(), "fdatasync " + tmp);
+            }
+            {
+                std::lock_guard<Mutex> lk(mutex_);
+                const uint64_t synced = mark;
+                t = tail(mark);
+                write_all(fd, tmp, t.data(), t.size());
+                if (::rename(tmp.c_str(), path_.c_str()) < 0)
+                    throw std::system_error(errno, std::generic_category(), "rename " + tmp);
+                ::close(fd);
+                fd = -1;
+                reopen();
+                synced_ = synced;
+                compactions_++;
+            }
+            sync_directory();
+        } catch (...) {
+            if (fd >= 0) {
+                ::close(fd);
+                ::unlink(tmp.c_str());
+            }
+            throw;
+        }
+    }
+
+    // map the renamed file, then release the old one. If the new one can
+    // not be opened the journal is closed: the old file was replaced, the
+    // records appended to it would be lost
+    void reopen()
+    {
+        const int         old_fd       = fd_;
+        char      * const old_map      = map_;
+        const std::size_t old_capacity = capacity_;
+        fd_  = -1;
+        map_ = nullptr;
+        try {
+            open();
+        } catch (...) {
+            ::munmap(old_map, old_capacity);
+            ::close(old_fd);
+            throw;
+        }
+        ::munmap(old_map, old_capacity);
+        ::close(old_fd);
+    }
+
+    void check_open() const
+    {
+        if (!map_)
+            throw std::runtime_error(path_ + ": journal closed after a failed compaction");
+    }
+
+    void run_compactor()
+    {
+        std::unique_lock<Mutex> lk(request_mutex_);
+        for (;;) {
+            requested_.wait(lk, [this] {return stop_ || compacting_.load(std::memory_order_relaxed);});
+            if (!compacting_.load(std::memory_order_relaxed))
+                return;
+            const std::string records = std::move(request_);
+            const uint64_t    mark    = request_mark_;
+            request_.clear();
+            lk.unlock();
+
+            std::exception_ptr error;
+            try {
+                std::lock_guard<Mutex> clk(compact_mutex_);
+                write_compacted(records, mark);
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            lk.lock();
+            if (error)
+                compact_error_ = error;
+            compacting_.store(false, std::memory_order_release);
+            requested_.notify_all();
+        }
+    }
+
+    void reserve(std::size_t size)
+    {
+        if (size <= capacity_)
+            return;
+        std::size_t capacity = capacity_;
+        while (capacity < size)
+            capacity *= 2;
+        if (::ftruncate(fd_, capacity) < 0)
+            throw std::system_error(errno, std::generic_category(), "ftruncate " + path_);
+        void * addr = ::mremap(map_, capacity_, capacity, MREMAP_MAYMOVE);
+        if (addr == MAP_FAILED)
+            throw std::system_error(errno, std::generic_category(), "mremap " + path_);
+        map_      = static_cast<char*>(addr);
+        capacity_ = capacity;
+    }
+
+    void sync_directory()
+    {
+        const auto slash = path_.rfind('/');
+        const std::string dir = slash == std::string::npos ? "." :
+                                slash == 0 ? "/" : path_.substr(0, slash);
+        int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+            return;
+        ::fsync(fd);
+        ::close(fd);
+    }
+
+    [[noreturn]] void fail(const char * what)
+    {
+        const int err = errno;
+        unmap();
+        throw std::system_error(err, std::generic_category(), what + (" " + path_));
+    }
+
+    void unmap()
+    {
+        if (map_)
+            ::munmap(map_, capacity_);
+        if (fd_ >= 0)
+            ::close(fd_);
+        map_ = nullptr;
+        fd_  = -1;
+    }
+
+    std::string       path_;
+    std::size_t       initial_capacity_;
+    int               fd_             = -1;
+    char            * map_            = nullptr;
+    std::size_t       capacity_       = 0;
+    std::size_t       end_            = 0;
+    std::size_t       compacted_size_ = 0;  // end_ when opened or compacted
+    uint64_t          appended_       = 0;  // bytes appended since opening
+    uint64_t          synced_         = 0;  // value of appended_ at the last sync
+    uint64_t          compactions_    = 0;
+    mutable Mutex     mutex_;
+    Mutex             sync_mutex_;
+
+    // background compaction
+    std::thread         compactor_;
+    Mutex               compact_mutex_;     // held while compacting
+    Mutex               request_mutex_;
+    EventCount          requested_;
+    std::string         request_;           // snapshot to write
+    uint64_t            request_mark_ = 0;  // appended_ when it was taken
+    bool                stop_         = false;
+    std::atomic_bool    compacting_ {false};
+    std::exception_ptr  compact_error_;
+};
+
+/**
+ * Serialization of the elements of a PersistentWaitQueue: encode(elt, out)
+ * appends the bytes of elt to out, decode(data, size) rebuilds it.
+ * Implemented for the trivially copyable types and std::string, to be
+ * specialized for the others (e.g. with to_binary() / decode() of
+ * json_binary.h).
+ */
+template<typename T, typename Enable = void>
+struct JournalCodec
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "specialize common::JournalCodec for this type");
+
+    static void encode(const T& elt, std::string& out)
+    {
+        out.append(reinterpret_cast<const char*>(&elt), sizeof(T));
+    }
+
+    static T decode(const char * data, std::size_t size)
+    {
+        if (size != sizeof(T))
+            throw std::runtime_error("journal record of unexpected size");
+        T elt;
+        std::memcpy(&elt, data, sizeof(T));
+        return elt;
+    }
+};
+
+template<>
+struct JournalCodec<std::string>
+{
+    static void encode(const std::string& elt, std::string& out) {out.append(elt);}
+    static std::string decode(const char * data, std::size_t size) {return std::string(data, size);}
+};
+
+/**
+ * FIFO order of a WaitQueue, journaling pushes and pops.
+ *
+ * A pop is journaled when the element leaves the queue, before the caller
+ * processes it: an element being processed when the process dies is not
+ * restored (at-most-once delivery). Elements that must survive their
+ * processing are to be pushed again, or their completion journaled, by the
+ * application.
+ */
+template<typename T, typename Codec = JournalCodec<T>, typename Allocator = std::allocator<T>>
+class JournalPolicy
+{
+public:
+    /**
+     * Refill the queue from journal.
+     */
+    explicit JournalPolicy(Journal& journal, std::size_t min_compact_size = 16 << 20,
+                           const Allocator& alloc = Allocator()):
+        journal_(journal), queue_(alloc), min_compact_size_(min_compact_size)
+    {
+        std::size_t records = 0;
+        journal_.replay([&](uint32_t type, const char * data, std::size_t size)
+            {
+                records++;
+                if (type == push_record)
+                    queue_.push_back(Codec::decode(data, size));
+                else if (type == pop_record && !queue_.empty())
+                    queue_.pop_front();
+            });
+        // only the pushes of the queued elements are left after a compaction
+        if (records > queue_.size())
+            journal_.compact([this](Journal::Writer& w) {snapshot(w);});
+    }
+
+    template<typename U>
+    void push(U&& elt)
+    {
+        buffer_.clear();
+        Codec::encode(elt, buffer_);
+        journal_.append(push_record, buffer_.data(), buffer_.size());
+        queue_.push_back(std::forward<U>(elt));
+    }
+
+    T pop()
+    {
+        journal_.append(pop_record, nullptr, 0);
+        T elt = std::move(queue_.front());
+        queue_.pop_front();
+        if (journal_.needs_compaction(min_compact_size_))
+            compact();
+        return elt;
+    }
+
+    bool   empty() const {return queue_.empty();}
+    size_t size()  const {return queue_.size();}
+
+private:
+    enum: uint32_t
+    {
+        push_record = 1,
+        pop_record  = 2,
+    };
+
+    void snapshot(Journal::Writer& w)
+    {
+        for (const auto& elt: queue_) {
+            buffer_.clear();
+            Codec::encode(elt, buffer_);
+            w.append(push_record, buffer_.data(), buffer_.size());
+        }
+    }
+
+    // called with the lock of the queue held: only the snapshot is taken
+    // here, the journal is rewritten in the background
+    void compact()
+    {
+        journal_.compact_async([this](Journal::Writer& w) {snapshot(w);});
+    }
+
+    Journal                & journal_;
+    std::deque<T, Allocator> queue_;
+    std::string              buffer_;
+    std::size_t              min_compact_size_;
+};
+
+/**
+ * FIFO WaitQueue persisted in a Journal, constructed from the journal (and
+ * optionally the minimum journal size before compaction).
+ */
+template<typename T, typename Codec = JournalCodec<T>, typename Allocator = std::allocator<T>>
+using PersistentWaitQueue = BasicWaitQueue<T, JournalPolicy<T, Codec, Allocator>>;
+
+/**
+ * Timeout queue persisted in a Journal. Timers carry a payload (any bytes)
+ * and are all dispatched to the handler given on construction, which gets
+ * the id, the current time and the payload. The time units must stay valid
+ * across restarts (e.g. milliseconds of the system clock).
+ *
+ * A one-shot timer is journaled as done once its handler returned: a timer
+ * running when the process dies fires again after the restart. Firings of
+ * repeating timers are not journaled, a restored repeating timer fires at
+ * the first run after the restart then every interval.
+ */
+class PersistentTimeoutQueue
+{
+public:
+    using Id      = TimeoutQueue::Id;
+    using Handler = std::function<void(Id, int64_t now, const std::string& payload)>;
+
+    PersistentTimeoutQueue(Journal& journal, Handler handler,
+                           std::size_t min_compact_size = 16 << 20):
+        journal_(journal), handler_(std::move(handler)), min_compact_size_(min_compact_size)
+    {
+        std::lock_guard<std::recursive_mutex> lk(mutex_);
+        std::size_t records = 0;
+        journal_.replay([&](uint32_t type, const char * data, std::size_t size)
+            {
+                records++;
+                Record r;
+                if (size < sizeof(r))
+                    return;
+                std::memcpy(&r, data, sizeof(r));
+                nextId_ = std::max(nextId_, r.id + 1);
+                if (type == add_record)
+                    timers_[r.id] = {0, r.expiration, r.interval,
+                                     std::string(data + sizeof(r), size - sizeof(r))};
+                else if (type == erase_record)
+                    timers_.erase(r.id);
+            });
+        for (auto& t: timers_)
+            schedule(t.first, t.second);
+        // a compaction leaves the last id and the adds of the live timers
+        if (records > timers_.size() + 1)
+            journal_.compact([this](Journal::Writer& w) {snapshot(w);});
+    }
+
+    Id add(int64_t now, int64_t delay, std::string payload)
+    {
+        return insert(now + delay, -1, std::move(payload));
+    }
+
+    Id add_repeating(int64_t now, int64_t interval, std::string payload)
+    {
+        return insert(now + interval, interval, std::move(payload));
+    }
+
+    bool erase(Id id)
+    {
+        std::lock_guard<std::recursive_mutex> lk(mutex_);
+        auto search = timers_.find(id);
+        if (search == timers_.end())
+            return false;
+        queue_.erase(search->second.queue_id);
+        timers_.erase(search);
+        record(erase_record, {id, 0, 0});
+        return true;
+    }
+
+    int64_t run_once(int64_t now)
+    {
+        std::lock_guard<std::recursive_mutex> lk(mutex_);
+        return queue_.run_once(now);
+    }
+
+    int64_t run_loop(int64_t now)
+    {
+        std::lock_guard<std::recursive_mutex> lk(mutex_);
+        return queue_.run_loop(now);
+    }
+
+    int64_t next_expiration() const {return queue_.next_expiration();}
+
+    std::size_t size() const
+    {
+        std::lock_guard<std::recursive_mutex> lk(mutex_);
+        return timers_.size();
+    }
+
+private:
+    enum: uint32_t
+    {
+        add_record     = 1,
+        erase_record   = 2,   // erased or done
+        last_id_record = 3,   // so that ids are not reused after a compaction
+    };
+
+    // fixed part of a record, followed by the payload for add_record
+    struct Record
+    {
+        Id      id;
+        int64_t expiration;
+        int64_t interval;
+    };
+
+    struct Timer
+    {
+        TimeoutQueue::Id queue_id;
+        int64_t          expiration;
+        int64_t          interval;
+        std::string      payload;
+    };
+
+    Id insert(int64_t expiration, int64_t interval, std::string payload)
+    {
+        std::lock_guard<std::recursive_mutex> lk(mutex_);
+        const Id id = nextId_++;
+        record(add_record, {id, expiration, interval}, payload);
+        auto& t = timers_[id];
+        t = {0, expiration, interval, std::move(payload)};
+        schedule(id, t);
+        return id;
+    }
+
+    void schedule(Id id, Timer& t)
+    {
+        auto callback = [this, id](TimeoutQueue::Id, int64_t now) {fire(id, now);};
+        t.queue_id = t.interval < 0 ?
+            queue_.add(0, t.expiration, callback) :
+            queue_.add_repeating(t.expiration - t.interval, t.interval, callback);
+    }
+
+    void fire(Id id, int64_t now)
+    {
+        auto search = timers_.find(id);
+        if (search == timers_.end())
+            return;
+
+        if (search->second.interval >= 0) {
+            search->second.expiration = now + search->second.interval;
+            const std::string payload = search->second.payload;
+            handler_(id, now, payload);
+            return;
+        }
+
+        // the handler may add and erase timers
+        const std::string payload = std::move(search->second.payload);
+        timers_.erase(search);
+        try {
+            handler_(id, now, payload);
+        } catch (...) {
+            record(erase_record, {id, 0, 0});
+            throw;
+        }
+        record(erase_record, {id, 0, 0});
+    }
+
+    void record(uint32_t type, const Record& r, const std::string& payload = std::string())
+    {
+        buffer_.assign(reinterpret_cast<const char*>(&r), sizeof(r));
+        buffer_.append(payload);
+        journal_.append(type, buffer_.data(), buffer_.size());
+        if (journal_.needs_compaction(min_compact_size_))
+            compact();
+    }
+
+    void snapshot(Journal::Writer& w)
+    {
+        const Record last {nextId_ - 1, 0, 0};
+        w.append(last_id_record, &last, sizeof(last));
+
+        std::string buffer;
+        for (const auto& t: timers_) {
+            const Record r {t.first, t.second.expiration, t.second.interval};
+            buffer.assign(reinterpret_cast<const char*>(&r), sizeof(r));
+            buffer.append(t.second.payload);
+            w.append(add_record, buffer.data(), buffer.size());
+        }
+    }
+
+    // called with mutex_ held: only the snapshot is taken here, the journal
+    // is rewritten in the background
+    void compact()
+    {
+        journal_.compact_async([this](Journal::Writer& w) {snapshot(w);});
+    }
+
+    Journal                   & journal_;
+    Handler                     handler_;
+    TimeoutQueue                queue_;
+    std::map<Id, Timer>         timers_;
+    Id                          nextId_ = 1;
+    std::string                 buffer_;
+    std::size_t                 min_compact_size_;
+    mutable std::recursive_mutex mutex_;
+};
+
+} /* namespace common */
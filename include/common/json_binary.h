@@ -0,0 +1,421 @@
+/**
+ * Binary encoding of json messages.
+ *
+ * Text serialization (dump() / parse()) is slow and verbose for messages
+ * exchanged between threads or written to disk. This header provides:
+ *
+ *  - BinaryEncoder: CBOR or MessagePack encoding of a json value into a
+ *    reusable buffer, optionally length-prefixed (framed) for streams.
+ *  - MsgpackWriter: MessagePack encoding of a struct declared with
+ *    COMMON_JSON_BIND straight from its fields, without building a json value.
+ *  - StreamDecoder: incremental decoding of framed messages from a byte
+ *    stream (file, socket) fed in arbitrary chunks.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "json.h"
+#include "json_bind.h"
+
+namespace common {
+
+enum class BinaryFormat {
+    cbor,
+    msgpack
+};
+
+using Bytes = std::vector<uint8_t>;
+
+namespace detail {
+
+// frames are prefixed by their payload length as a 32 bits little endian integer
+constexpr std::size_t frame_header_size = 4;
+
+inline void put_frame_header(uint8_t * p, uint32_t size)
+{
+    p[0] = static_cast<uint8_t>(size);
+    p[1] = static_cast<uint8_t>(size >> 8);
+    p[2] = static_cast<uint8_t>(size >> 16);
+    p[3] = static_cast<uint8_t>(size >> 24);
+}
+
+inline uint32_t get_frame_header(const uint8_t * p)
+{
+    return static_cast<uint32_t>(p[0])       | static_cast<uint32_t>(p[1]) << 8 |
+           static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+inline void append(Bytes& buffer, const json& j, BinaryFormat format)
+{
+    // the vector output adapter appends to the buffer
+    if (format == BinaryFormat::cbor)
+        json::to_cbor(j, buffer);
+    else
+        json::to_msgpack(j, buffer);
+}
+
+} /* namespace detail */
+
+/**
+ * Decode a single value. Throw json::parse_error on malformed input.
+ */
+inline json decode(const uint8_t * data, std::size_t size, BinaryFormat format)
+{
+    if (format == BinaryFormat::cbor)
+        return json::from_cbor(data, data + size);
+    return json::from_msgpack(data, data + size);
+}
+
+inline json decode(const Bytes& bytes, BinaryFormat format)
+{
+    return decode(bytes.data(), bytes.size(), format);
+}
+
+/**
+ * Decode a single MessagePack value and bind it onto T (see json_bind.h).
+ */
+template<typename T>
+T decode(const uint8_t * data, std::size_t size)
+{
+    return common::bind<T>(json::from_msgpack(data, data + size));
+}
+
+/**
+ * Encoder of json values. The buffer is reused between calls, so that steady
+ * state encoding does not allocate once it has grown to the largest message.
+ */
+class BinaryEncoder
+{
+public:
+    explicit BinaryEncoder(BinaryFormat format = BinaryFormat::msgpack): format_(format) {}
+
+    /**
+     * Encode j, replacing the content of the buffer.
+     */
+    const Bytes& encode(const json& j)
+    {
+        buffer_.clear();
+        detail::append(buffer_, j, format_);
+        return buffer_;
+    }
+
+    /**
+     * Encode j as a length-prefixed frame appended to the buffer. Several
+     * frames can be accumulated before writing the buffer out.
+     */
+    const Bytes& append_frame(const json& j)
+    {
+        const auto start = buffer_.size();
+        buffer_.resize(start + detail::frame_header_size);
+        detail::append(buffer_, j, format_);
+        const auto size = buffer_.size() - start - detail::frame_header_size;
+        if (size > std::numeric_limits<uint32_t>::max())
+            throw std::length_error("frame too large");
+        detail::put_frame_header(&buffer_[start], static_cast<uint32_t>(size));
+        return buffer_;
+    }
+
+    void         clear()        {buffer_.clear();}
+    const Bytes& buffer() const {return buffer_;}
+    BinaryFormat format() const {return format_;}
+
+private:
+    BinaryFormat format_;
+    Bytes        buffer_;
+};
+
+/**
+ * MessagePack encoder writing values straight into a reusable buffer.
+ *
+ * Handles the same field types as bind(): structs declared with
+ * COMMON_JSON_BIND (encoded as maps keyed by field name), std::optional (nil
+ * when empty), std::vector, string-keyed maps, arithmetic types, std::string
+ * and json values. The output decodes with json::from_msgpack() or
+ * decode<T>().
+ */
+class MsgpackWriter
+{
+public:
+    template<typename T>
+    const Bytes& encode(const T& value)
+    {
+        buffer_.clear();
+        write(value);
+        return buffer_;
+    }
+
+    template<typename T>
+    const Bytes& append_frame(const T& value)
+    {
+        const auto start = buffer_.size();
+        buffer_.resize(start + detail::frame_header_size);
+        write(value);
+        const auto size = buffer_.size() - start - detail::frame_header_size;
+        if (size > std::numeric_limits<uint32_t>::max())
+            throw std::length_error("frame too large");
+        detail::put_frame_header(&buffer_[start], static_cast<uint32_t>(size));
+        return buffer_;
+    }
+
+    void         clear()        {buffer_.clear();}
+    const Bytes& buffer() const {return buffer_;}
+
+    template<typename T>
+    void write(const T& value)
+    {
+        if constexpr (detail::is_bound_struct<T>::value) {
+            field_counter counter;
+            common_json_visit(counter, value);
+            write_map_header(counter.count);
+            field_writer writer{*this};
+            common_json_visit(writer, value);
+        } else if constexpr (detail::is_optional<T>::value) {
+            if (value)
+                write(*value);
+            else
+                put(0xc0);
+        } else if constexpr (std::is_same_v<T, bool>) {
+            put(value ? 0xc3 : 0xc2);
+        } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+            write_int(static_cast<int64_t>(value));
+        } else if constexpr (std::is_integral_v<T>) {
+            write_uint(static_cast<uint64_t>(value));
+        } else if constexpr (std::is_same_v<T, float>) {
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            put(0xca);
+            put_be(bits);
+        } else if constexpr (std::is_floating_point_v<T>) {
+            const double d = static_cast<double>(value);
+            uint64_t bits;
+            std::memcpy(&bits, &d, sizeof(bits));
+            put(0xcb);
+            put_be(bits);
+        } else if constexpr (std::is_same_v<T, std::string>) {
+            write_str(value.data(), value.size());
+        } else if constexpr (std::is_same_v<T, json>) {
+            json::to_msgpack(value, buffer_);
+        } else if constexpr (detail::is_vector<T>::value) {
+            write_array_header(value.size());
+            for (const auto& v: value)
+                write(v);
+        } else if constexpr (detail::is_string_map<T>::value) {
+            write_map_header(value.size());
+            for (const auto& kv: value) {
+                write_str(kv.first.data(), kv.first.size());
+                write(kv.second);
+            }
+        } else {
+            // fall back on the nlohmann serializer of the type
+            json::to_msgpack(json(value), buffer_);
+        }
+    }
+
+private:
+    struct field_counter
+    {
+        std::size_t count = 0;
+
+        template<typename U>
+        void operator()(const char *, const U&) {count++;}
+    };
+
+    struct field_writer
+    {
+        MsgpackWriter& w;
+
+        template<typename U>
+        void operator()(const char * key, const U& field)
+        {
+            w.write_str(key, std::strlen(key));
+            w.write(field);
+        }
+    };
+
+    void put(uint8_t b) {buffer_.push_back(b);}
+
+    template<typename U>
+    void put_be(U v)
+    {
+        for (int shift = (sizeof(U) - 1) * 8; shift >= 0; shift -= 8)
+            buffer_.push_back(static_cast<uint8_t>(v >> shift));
+    }
+
+    void write_uint(uint64_t v)
+    {
+        if (v < 128) {
+            put(static_cast<uint8_t>(v));
+        } else if (v <= std::numeric_limits<uint8_t>::max()) {
+            put(0xcc);
+            put(static_cast<uint8_t>(v));
+        } else if (v <= std::numeric_limits<uint16_t>::max()) {
+            put(0xcd);
+            put_be(static_cast<uint16_t>(v));
+        } else if (v <= std::numeric_limits<uint32_t>::max()) {
+            put(0xce);
+            put_be(static_cast<uint32_t>(v));
+        } else {
+            put(0xcf);
+            put_be(v);
+        }
+    }
+
+    void write_int(int64_t v)
+    {
+        if (v >= 0) {
+            write_uint(static_cast<uint64_t>(v));
+        } else if (v >= -32) {
+            put(static_cast<uint8_t>(v));
+        } else if (v >= std::numeric_limits<int8_t>::min()) {
+            put(0xd0);
+            put(static_cast<uint8_t>(v));
+        } else if (v >= std::numeric_limits<int16_t>::min()) {
+            put(0xd1);
+            put_be(static_cast<uint16_t>(v));
+        } else if (v >= std::numeric_limits<int32_t>::min()) {
+            put(0xd2);
+            put_be(static_cast<uint32_t>(v));
+        } else {
+            put(0xd3);
+            put_be(static_cast<uint64_t>(v));
+        }
+    }
+
+    void write_str(const char * s, std::size_t size)
+    {
+        if (size < 32) {
+            put(static_cast<uint8_t>(0xa0 | size));
+        } else if (size <= std::numeric_limits<uint8_t>::max()) {
+            put(0xd9);
+            put(static_cast<uint8_t>(size));
+        } else if (size <= std::numeric_limits<uint16_t>::max()) {
+            put(0xda);
+            put_be(static_cast<uint16_t>(size));
+        } else {
+            put(0xdb);
+            put_be(static_cast<uint32_t>(size));
+        }
+        buffer_.insert(buffer_.end(), s, s + size);
+    }
+
+    void write_array_header(std::size_t size)
+    {
+        if (size < 16) {
+            put(static_cast<uint8_t>(0x90 | size));
+        } else if (size <= std::numeric_limits<uint16_t>::max()) {
+            put(0xdc);
+            put_be(static_cast<uint16_t>(size));
+        } else {
+            put(0xdd);
+            put_be(static_cast<uint32_t>(size));
+        }
+    }
+
+    void write_map_header(std::size_t size)
+    {
+        if (size < 16) {
+            put(static_cast<uint8_t>(0x80 | size));
+        } else if (size <= std::numeric_limits<uint16_t>::max()) {
+            put(0xde);
+            put_be(static_cast<uint16_t>(size));
+        } else {
+            put(0xdf);
+            put_be(static_cast<uint32_t>(size));
+        }
+    }
+
+    Bytes buffer_;
+};
+
+/**
+ * Incremental decoder of length-prefixed frames (see append_frame()).
+ *
+ * Bytes are fed as they are read, in chunks of any size; next() returns the
+ * decoded messages as soon as they are complete. Only the incomplete tail is
+ * kept in memory.
+ */
+class StreamDecoder
+{
+public:
+    static constexpr std::size_t default_max_frame_size = 64 << 20;
+
+    /**
+     * @param max_frame_size largest payload accepted, so that a corrupted or
+     *        hostile length prefix does not make the decoder buffer gigabytes
+     */
+    explicit StreamDecoder(BinaryFormat format = BinaryFormat::msgpack,
+                           std::size_t max_frame_size = default_max_frame_size):
+        format_(format), max_frame_size_(max_frame_size) {}
+
+    void feed(const uint8_t * data, std::size_t size)
+    {
+        // drop the consumed frames before growing the buffer
+        if (pos_ > 0 && pos_ >= buffer_.size() / 2) {
+            buffer_.erase(buffer_.begin(), buffer_.begin() + pos_);
+            pos_ = 0;
+        }
+        buffer_.insert(buffer_.end(), data, data + size);
+    }
+
+    /**
+     * Return a pointer to the payload of the next complete frame and set size,
+     * or nullptr if more bytes are needed. The pointer is valid until the next
+     * call to feed(). Throw std::length_error, as soon as its header is
+     * received, if the frame is larger than max_frame_size: the stream can
+     * not be decoded further.
+     */
+    const uint8_t * next_frame(std::size_t& size)
+    {
+        const auto available = buffer_.size() - pos_;
+        if (available < detail::frame_header_size)
+            return nullptr;
+        size = detail::get_frame_header(buffer_.data() + pos_);
+        if (size > max_frame_size_)
+            throw std::length_error("frame too large");
+        if (available - detail::frame_header_size < size)
+            return nullptr;
+        // not &buffer_[...], out of range for an empty frame ending the buffer
+        const uint8_t * payload = buffer_.data() + pos_ + detail::frame_header_size;
+        pos_ += detail::frame_header_size + size;
+        return payload;
+    }
+
+    /**
+     * Decode the next complete frame into out. Return false if more bytes are
+     * needed. Throw json::parse_error if the frame is malformed.
+     */
+    bool next(json& out)
+    {
+        std::size_t size;
+        const uint8_t * payload = next_frame(size);
+        if (!payload)
+            return false;
+        out = decode(payload, size, format_);
+        return true;
+    }
+
+    /**
+     * Number of buffered bytes not yet returned as frames.
+     */
+    std::size_t pending() const {return buffer_.size() - pos_;}
+
+private:
+    BinaryFormat format_;
+    std::size_t  max_frame_size_;
+    Bytes        buffer_;
+    std::size_t  pos_ = 0;
+};
+
+} /* namespace common */
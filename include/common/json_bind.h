@@ -0,0 +1,341 @@
+/**
+ * Typed binding of json documents onto plain structs.
+ *
+ * A struct is made bindable by listing its fields next to its definition (in
+ * the same namespace):
+ *
+ *     struct Server { std::string host; uint16_t port; std::optional<int> backlog; };
+ *     COMMON_JSON_BIND(Server, host, port, backlog)
+ *
+ * common::bind<Server>(j) then fills a Server in one pass over the document.
+ * Fields can be bindable structs, std::vector, std::map<std::string, ...>,
+ * std::optional (may be missing or null), arithmetic types, std::string or any
+ * type with a nlohmann from_json(). Errors are reported as common::bind_error
+ * carrying the json path of the offending value (e.g. "$.servers[2].port").
+ *
+ * ConfigHandle<T> keeps the current bound config and lets a writer re-bind a
+ * new document and swap it in while readers keep going without locking.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "json.h"
+
+#define COMMON_JSON_BIND_FIELD(field) common_json_visitor(#field, common_json_obj.field);
+
+/**
+ * Declare the bound fields of Type. Defines common_json_visit(visitor, obj),
+ * which calls visitor("field", obj.field) for each field, in order.
+ */
+#define COMMON_JSON_BIND(Type, ...)                                                         \
+    template<typename Visitor>                                                              \
+    inline void common_json_visit(Visitor& common_json_visitor, Type& common_json_obj)      \
+    {                                                                                       \
+        NLOHMANN_JSON_EXPAND(NLOHMANN_JSON_PASTE(COMMON_JSON_BIND_FIELD, __VA_ARGS__))      \
+    }                                                                                       \
+    template<typename Visitor>                                                              \
+    inline void common_json_visit(Visitor& common_json_visitor, const Type& common_json_obj)\
+    {                                                                                       \
+        NLOHMANN_JSON_EXPAND(NLOHMANN_JSON_PASTE(COMMON_JSON_BIND_FIELD, __VA_ARGS__))      \
+    }
+
+namespace common {
+
+struct bind_error: std::runtime_error
+{
+    bind_error(const std::string& path, const std::string& what_arg):
+        std::runtime_error(path + ": " + what_arg), path(path) {}
+
+    std::string path;
+};
+
+namespace detail {
+
+struct field_probe
+{
+    template<typename U>
+    void operator()(const char *, U&) {}
+};
+
+template<typename T, typename = void>
+struct is_bound_struct: std::false_type {};
+
+template<typename T>
+struct is_bound_struct<T, std::void_t<decltype(
+    common_json_visit(std::declval<field_probe&>(), std::declval<T&>()))>>: std::true_type {};
+
+template<typename T> struct is_optional: std::false_type {};
+template<typename T> struct is_optional<std::optional<T>>: std::true_type {};
+
+template<typename T> struct is_vector: std::false_type {};
+template<typename T, typename A> struct is_vector<std::vector<T, A>>: std::true_type {};
+
+template<typename T> struct is_string_map: std::false_type {};
+template<typename T, typename C, typename A>
+struct is_string_map<std::map<std::string, T, C, A>>: std::true_type {};
+template<typename T, typename H, typename E, typename A>
+struct is_string_map<std::unordered_map<std::string, T, H, E, A>>: std::true_type {};
+
+inline const char * type_name(const json& j)
+{
+    return j.type_name();
+}
+
+template<typename T>
+void bind_value(const json& j, T& out, std::string& path);
+
+/**
+ * Visitor binding the fields of a struct from a json object. The path is
+ * shared along the recursion and restored after each field.
+ */
+struct field_binder
+{
+    const json  & object;
+    std::string & path;
+
+    template<typename U>
+    void operator()(const char * key, U& field)
+    {
+        const auto size = path.size();
+        path += '.';
+        path += key;
+
+        const auto it = object.find(key);
+        if (it == object.end()) {
+            if constexpr (is_optional<U>::value)
+                field.reset();
+            else
+                throw bind_error(path, "missing field");
+        } else {
+            bind_value(*it, field, path);
+        }
+        path.resize(size);
+    }
+};
+
+template<typename T>
+void bind_value(const json& j, T& out, std::string& path)
+{
+    if constexpr (is_bound_struct<T>::value) {
+        if (!j.is_object())
+            throw bind_error(path, std::string("expected object, got ") + type_name(j));
+        field_binder binder{j, path};
+        common_json_visit(binder, out);
+    } else if constexpr (is_optional<T>::value) {
+        if (j.is_null()) {
+            out.reset();
+        } else {
+            bind_value(j, out.emplace(), path);
+        }
+    } else if constexpr (std::is_same_v<T, bool>) {
+        if (!j.is_boolean())
+            throw bind_error(path, std::string("expected boolean, got ") + type_name(j));
+        out = j.get<bool>();
+    } else if constexpr (std::is_integral_v<T>) {
+        if (!j.is_number_integer())
+            throw bind_error(path, std::string("expected integer, got ") + type_name(j));
+        bool in_range;
+        if (j.is_number_unsigned()) {
+            in_range = j.get<uint64_t>() <= static_cast<uint64_t>(std::numeric_limits<T>::max());
+        } else {
+            const auto v = j.get<int64_t>();
+            if constexpr (std::is_signed_v<T>)
+                in_range = v >= std::numeric_limits<T>::min() && v <= std::numeric_limits<T>::max();
+            else
+                in_range = v >= 0 && static_cast<uint64_t>(v) <= std::numeric_limits<T>::max();
+        }
+        if (!in_range)
+            throw bind_error(path, "integer out of range: " + j.dump());
+        out = j.get<T>();
+    } else if constexpr (std::is_floating_point_v<T>) {
+        if (!j.is_number())
+            throw bind_error(path, std::string("expected number, got ") + type_name(j));
+        out = j.get<T>();
+    } else if constexpr (std::is_same_v<T, std::string>) {
+        if (!j.is_string())
+            throw bind_error(path, std::string("expected string, got ") + type_name(j));
+        out = j.get_ref<const std::string&>();
+    } else if constexpr (is_vector<T>::value) {
+        if (!j.is_array())
+            throw bind_error(path, std::string("expected array, got ") + type_name(j));
+        const auto size = path.size();
+        out.clear();
+        out.resize(j.size());
+        for (std::size_t i = 0; i < j.size(); i++) {
+            path += '[';
+            path += std::to_string(i);
+            path += ']';
+            bind_value(j[i], out[i], path);
+            path.resize(size);
+        }
+    } else if constexpr (is_string_map<T>::value) {
+        if (!j.is_object())
+            throw bind_error(path, std::string("expected object, got ") + type_name(j));
+        const auto size = path.size();
+        out.clear();
+        for (auto it = j.begin(); it != j.end(); ++it) {
+            path += '.';
+            path += it.key();
+            bind_value(it.value(), out[it.key()], path);
+            path.resize(size);
+        }
+    } else {
+        // fall back on the nlohmann serializer of the type
+        try {
+            j.get_to(out);
+        } catch (const json::exception& e) {
+            throw bind_error(path, e.what());
+        }
+    }
+}
+
+} /* namespace detail */
+
+/**
+ * Bind j onto out. Throw bind_error on the first mismatch, in which case out
+ * may be partially filled.
+ */
+template<typename T>
+void bind(const json& j, T& out)
+{
+    std::string path = "$";
+    detail::bind_value(j, out, path);
+}
+
+template<typename T>
+T bind(const json& j)
+{
+    T out{};
+    common::bind(j, out);
+    return out;
+}
+
+/**
+ * Holder of a bound config that can be reloaded while being read.
+ *
+ * Readers take a ReadGuard, which only costs a couple of atomic operations and
+ * never blocks. reload() binds the new document into a fresh T (the current
+ * config is left untouched if binding fails), publishes it, then waits for the
+ * readers still using the previous version before freeing it, RCU-style.
+ * Readers must therefore not keep a guard across a call to reload() on the
+ * same thread.
+ */
+template<typename T>
+class ConfigHandle
+{
+public:
+    class ReadGuard
+    {
+    public:
+        ReadGuard(ReadGuard&& other): counter_(other.counter_), value_(other.value_)
+        {
+            other.counter_ = nullptr;
+        }
+
+        ~ReadGuard()
+        {
+            if (counter_)
+                counter_->fetch_sub(1);
+        }
+
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+
+        const T& operator*()  const {return *value_;}
+        const T* operator->() const {return value_;}
+        const T* get()        const {return value_;}
+
+    private:
+        friend class ConfigHandle;
+        ReadGuard(std::atomic<int64_t> * counter, const T * value):
+            counter_(counter), value_(value) {}
+
+        std::atomic<int64_t> * counter_;
+        const T              * value_;
+    };
+
+    explicit ConfigHandle(const json& j): current_(new T(common::bind<T>(j))) {}
+
+    ~ConfigHandle() {delete current_.load();}
+
+    ConfigHandle(const ConfigHandle&) = delete;
+    ConfigHandle& operator=(const ConfigHandle&) = delete;
+
+    ReadGuard read() const
+    {
+        for (;;) {
+            const uint64_t e = epoch_.load();
+            auto& counter = readers_[e & 1].count;
+            counter.fetch_add(1);
+            // the epoch may have been flipped before we registered, in which
+            // case the writer is not waiting for us
+            if (epoch_.load() == e)
+                return ReadGuard(&counter, current_.load());
+            counter.fetch_sub(1);
+        }
+    }
+
+    /**
+     * Bind j into a new config and make it current. Throw bind_error if j does
+     * not match T.
+     */
+    void reload(const json& j)
+    {
+        T * next = new T(common::bind<T>(j));
+        std::lock_guard<std::mutex> lk(mutex_);
+        T * prev = current_.exchange(next);
+        synchronize();
+        delete prev;
+        version_++;
+    }
+
+    /**
+     * Parse the json file at path and reload it.
+     */
+    void reload(const std::string& path)
+    {
+        std::ifstream f(path);
+        if (!f)
+            throw bind_error("$", "can not open " + path);
+        reload(json::parse(f));
+    }
+
+    uint64_t version() const {return version_.load();}
+
+private:
+    struct alignas(64) Counter
+    {
+        std::atomic<int64_t> count {0};
+    };
+
+    // wait until every reader that may have seen the previous pointer is done
+    void synchronize()
+    {
+        const uint64_t e = epoch_.fetch_add(1);
+        while (readers_[e & 1].count.load() != 0)
+            std::this_thread::yield();
+    }
+
+    std::atomic<T*>         current_;
+    mutable Counter         readers_[2];
+    alignas(64) std::atomic<uint64_t> epoch_ {0};
+    std::atomic<uint64_t>   version_ {0};
+    std::mutex              mutex_;
+};
+
+} /* namespace common */
@@ -0,0 +1,235 @@
+/**
+ * Streaming json parsing.
+ *
+ * json::parse() builds the whole document in memory, which does not scale to
+ * large config or replay files. The helpers below parse straight from a
+ * memory-mapped file or a file descriptor and either forward SAX events to a
+ * user handler or hand over the elements of a top-level array one at a time,
+ * so memory usage is bounded by the size of the largest element rather than by
+ * the size of the file.
+ */
+
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <istream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "json.h"
+
+namespace common {
+
+/**
+ * Read-only memory mapping of a whole file.
+ */
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+
+        struct stat st;
+        if (::fstat(fd, &st) < 0) {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "fstat " + path);
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+
+        if (size_ > 0) {
+            void * addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED) {
+                int err = errno;
+                ::close(fd);
+                throw std::system_error(err, std::generic_category(), "mmap " + path);
+            }
+            // the file is read once from start to end
+            ::madvise(addr, size_, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(addr);
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile()
+    {
+        if (data_)
+            ::munmap(const_cast<char*>(data_), size_);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char * data()  const {return data_;}
+    const char * begin() const {return data_;}
+    const char * end()   const {return data_ + size_;}
+    std::size_t  size()  const {return size_;}
+
+private:
+    const char * data_ = nullptr;
+    std::size_t  size_ = 0;
+};
+
+/**
+ * Input stream buffer reading from a file descriptor through a fixed size
+ * buffer. Works with pipes and sockets, which can not be mapped.
+ *
+ * The file descriptor is not owned.
+ */
+class FdStreambuf: public std::streambuf
+{
+public:
+    explicit FdStreambuf(int fd, std::size_t buffer_size = 64 * 1024):
+        fd_(fd), buffer_(buffer_size)
+    {
+        setg(buffer_.data(), buffer_.data(), buffer_.data());
+    }
+
+protected:
+    int_type underflow() override
+    {
+        if (gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+
+        ssize_t n;
+        do {
+            n = ::read(fd_, buffer_.data(), buffer_.size());
+        } while (n < 0 && errno == EINTR);
+
+        if (n < 0)
+            throw std::system_error(errno, std::generic_category(), "read");
+        if (n == 0)
+            return traits_type::eof();
+
+        setg(buffer_.data(), buffer_.data(), buffer_.data() + n);
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    int               fd_;
+    std::vector<char> buffer_;
+};
+
+namespace detail {
+
+struct stop_parsing {};
+
+/**
+ * Build a parser callback that forwards each element of the top-level array to
+ * fn and discards it from the dom, so that only one element is alive at a time.
+ */
+template<typename F>
+json::parser_callback_t element_callback(F& fn, std::size_t& count)
+{
+    return [&fn, &count, first = true](int depth, json::parse_event_t event, json& parsed) mutable
+    {
+        if (first) {
+            first = false;
+            if (event != json::parse_event_t::array_start)
+                throw std::invalid_argument("top-level json value is not an array");
+        }
+
+        if (depth != 1)
+            // drop the (empty) top-level array once parsing is done
+            return depth != 0 || event != json::parse_event_t::array_end;
+
+        if (event == json::parse_event_t::value ||
+            event == json::parse_event_t::object_end ||
+            event == json::parse_event_t::array_end) {
+            count++;
+            if constexpr (std::is_same_v<std::invoke_result_t<F&, json&&>, bool>) {
+                if (!fn(std::move(parsed)))
+                    throw stop_parsing();
+            } else {
+                fn(std::move(parsed));
+            }
+            return false;
+        }
+        return true;
+    };
+}
+
+template<typename Parse, typename F>
+std::size_t for_each_element(Parse&& parse, F& fn)
+{
+    std::size_t count = 0;
+    try {
+        static_cast<void>(parse(element_callback(fn, count)));
+    } catch (const stop_parsing&) {
+    }
+    return count;
+}
+
+} /* namespace detail */
+
+/**
+ * Parse a memory-mapped file and forward the events to a SAX handler
+ * implementing the nlohmann::json_sax interface.
+ *
+ * Return the result of the handler (false if it aborted the parsing).
+ */
+template<typename SAX>
+bool sax_parse(const MappedFile& file, SAX * sax)
+{
+    return json::sax_parse(file.begin(), file.end(), sax);
+}
+
+/**
+ * Parse the content of a file descriptor until EOF and forward the events to a
+ * SAX handler implementing the nlohmann::json_sax interface.
+ */
+template<typename SAX>
+bool sax_parse(int fd, SAX * sax)
+{
+    FdStreambuf buf(fd);
+    std::istream is(&buf);
+    return json::sax_parse(is, sax);
+}
+
+/**
+ * Call fn(json&&) on each element of the top-level array of a memory-mapped
+ * file, in order. Only the element being processed is kept in memory.
+ *
+ * If fn returns a bool, returning false stops the parsing.
+ *
+ * Return the number of elements passed to fn. Throw json::parse_error on
+ * malformed input and std::invalid_argument if the document is not an array.
+ */
+template<typename F>
+std::size_t for_each_element(const MappedFile& file, F&& fn)
+{
+    return detail::for_each_element([&](json::parser_callback_t cb)
+        {
+            return json::parse(file.begin(), file.end(), cb);
+        }, fn);
+}
+
+/**
+ * Same as above, reading from a file descriptor until EOF.
+ */
+template<typename F>
+std::size_t for_each_element(int fd, F&& fn)
+{
+    FdStreambuf buf(fd);
+    std::istream is(&buf);
+    return detail::for_each_element([&](json::parser_callback_t cb)
+        {
+            return json::parse(is, cb);
+        }, fn);
+}
+
+} /* namespace common */
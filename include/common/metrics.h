@@ -0,0 +1,291 @@
+/**
+ * Lightweight metrics: counters, gauges and latency histograms.
+ *
+ * Updates are lock-free and cheap enough for hot paths: counters and
+ * histograms are split in per-thread shards (threads are spread over a fixed
+ * number of cache-line aligned slots) which are only merged when read.
+ *
+ * Histograms are log-linear, HDR-style: values below 2^sub_bucket_bits are
+ * exact, above that each power of two is split in 2^sub_bucket_bits linear
+ * buckets, which bounds the relative error of the reported percentiles to
+ * 1 / 2^sub_bucket_bits (6.25%) over the whole uint64_t range.
+ *
+ * See metrics_registry.h to name metrics and export them as json.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace common {
+namespace metrics {
+
+constexpr std::size_t nb_shards = 16;
+
+/**
+ * Index of the shard used by the calling thread.
+ */
+inline std::size_t thread_shard()
+{
+    static std::atomic<std::size_t> next {0};
+    thread_local const std::size_t shard = next.fetch_add(1, std::memory_order_relaxed) % nb_shards;
+    return shard;
+}
+
+/**
+ * Monotonic counter.
+ */
+class Counter
+{
+public:
+    void add(uint64_t n = 1)
+    {
+        shards_[thread_shard()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const
+    {
+        uint64_t sum = 0;
+        for (const auto& s: shards_)
+            sum += s.value.load(std::memory_order_relaxed);
+        return sum;
+    }
+
+    void reset()
+    {
+        for (auto& s: shards_)
+            s.value.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    struct alignas(64) Shard
+    {
+        std::atomic<uint64_t> value {0};
+    };
+
+    std::array<Shard, nb_shards> shards_;
+};
+
+/**
+ * Instantaneous value (queue depth, number of connections...).
+ */
+class Gauge
+{
+public:
+    void    set(int64_t v)       {value_.store(v, std::memory_order_relaxed);}
+    void    add(int64_t n = 1)   {value_.fetch_add(n, std::memory_order_relaxed);}
+    void    sub(int64_t n = 1)   {value_.fetch_sub(n, std::memory_order_relaxed);}
+    int64_t value() const        {return value_.load(std::memory_order_relaxed);}
+
+private:
+    std::atomic<int64_t> value_ {0};
+};
+
+/**
+ * Merged content of a histogram at a given time.
+ */
+class HistogramSnapshot
+{
+public:
+    static constexpr unsigned    sub_bucket_bits  = 4;
+    static constexpr uint64_t    sub_bucket_count = 1ull << sub_bucket_bits;
+    static constexpr std::size_t nb_buckets       = sub_bucket_count * (65 - sub_bucket_bits);
+
+    static std::size_t bucket_index(uint64_t v)
+    {
+        if (v < sub_bucket_count)
+            return v;
+        const unsigned msb   = 63 - __builtin_clzll(v);
+        const unsigned shift = msb - sub_bucket_bits;
+        return sub_bucket_count * (shift + 1) + ((v >> shift) - sub_bucket_count);
+    }
+
+    // lowest value falling in the bucket
+    static uint64_t bucket_low(std::size_t idx)
+    {
+        if (idx < sub_bucket_count)
+            return idx;
+        const unsigned shift = idx / sub_bucket_count - 1;
+        return (sub_bucket_count + idx % sub_bucket_count) << shift;
+    }
+
+    static uint64_t bucket_width(std::size_t idx)
+    {
+        return idx < sub_bucket_count ? 1 : 1ull << (idx / sub_bucket_count - 1);
+    }
+
+    HistogramSnapshot(): counts(nb_buckets, 0) {}
+
+    /**
+     * Value below which a fraction q (in [0, 1]) of the recorded values fall,
+     * within the precision of the buckets.
+     */
+    uint64_t percentile(double q) const
+    {
+        if (count == 0)
+            return 0;
+        const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * count + 0.5));
+        uint64_t seen = 0;
+        for (std::size_t i = 0; i < counts.size(); i++) {
+            seen += counts[i];
+            if (seen >= rank) {
+                const uint64_t high = bucket_low(i) + (bucket_width(i) - 1);
+                return std::clamp(high, min, max);
+            }
+        }
+        return max;
+    }
+
+    double mean() const {return count ? static_cast<double>(sum) / count : 0.;}
+
+    void merge(const HistogramSnapshot& other)
+    {
+        for (std::size_t i = 0; i < counts.size(); i++)
+            counts[i] += other.counts[i];
+        if (other.count) {
+            min = count ? std::min(min, other.min) : other.min;
+            max = count ? std::max(max, other.max) : other.max;
+        }
+        count += other.count;
+        sum   += other.sum;
+    }
+
+    std::vector<uint64_t> counts;
+    uint64_t count = 0;
+    uint64_t sum   = 0;
+    uint64_t min   = 0;
+    uint64_t max   = 0;
+};
+
+/**
+ * Log-linear histogram of uint64_t values (typically latencies in ns).
+ *
+ * Shards are allocated on first use by a thread, so a histogram only touched
+ * by one thread costs a single shard.
+ */
+class Histogram
+{
+public:
+    Histogram() = default;
+    ~Histogram()
+    {
+        for (auto& s: shards_)
+            delete s.load();
+    }
+
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+    void record(uint64_t v)
+    {
+        Shard& s = shard();
+        s.counts[HistogramSnapshot::bucket_index(v)].fetch_add(1, std::memory_order_relaxed);
+        s.sum.fetch_add(v, std::memory_order_relaxed);
+        if (v < s.min.load(std::memory_order_relaxed))
+            s.min.store(v, std::memory_order_relaxed);
+        if (v > s.max.load(std::memory_order_relaxed))
+            s.max.store(v, std::memory_order_relaxed);
+    }
+
+    template<typename Rep, typename Period>
+    void record(std::chrono::duration<Rep, Period> d)
+    {
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+        record(static_cast<uint64_t>(std::max<decltype(ns)>(ns, 0)));
+    }
+
+    /**
+     * Merge the shards. Concurrent updates may or may not be included.
+     */
+    HistogramSnapshot snapshot() const
+    {
+        HistogramSnapshot snap;
+        for (const auto& p: shards_) {
+            const Shard * s = p.load(std::memory_order_acquire);
+            if (!s)
+                continue;
+            uint64_t count = 0;
+            for (std::size_t i = 0; i < snap.counts.size(); i++) {
+                const auto c = s->counts[i].load(std::memory_order_relaxed);
+                snap.counts[i] += c;
+                count += c;
+            }
+            if (count == 0)
+                continue;
+            const uint64_t min = s->min.load(std::memory_order_relaxed);
+            const uint64_t max = s->max.load(std::memory_order_relaxed);
+            snap.min    = snap.count ? std::min(snap.min, min) : min;
+            snap.max    = snap.count ? std::max(snap.max, max) : max;
+            snap.count += count;
+            snap.sum   += s->sum.load(std::memory_order_relaxed);
+        }
+        return snap;
+    }
+
+    void reset()
+    {
+        for (auto& p: shards_) {
+            Shard * s = p.load(std::memory_order_acquire);
+            if (!s)
+                continue;
+            for (auto& c: s->counts)
+                c.store(0, std::memory_order_relaxed);
+            s->sum.store(0, std::memory_order_relaxed);
+            s->min.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+            s->max.store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    struct alignas(64) Shard
+    {
+        std::atomic<uint64_t> counts[HistogramSnapshot::nb_buckets] {};
+        std::atomic<uint64_t> sum {0};
+        // only updated by the threads of the shard, races between them may
+        // lose an extremum but never corrupt it
+        std::atomic<uint64_t> min {std::numeric_limits<uint64_t>::max()};
+        std::atomic<uint64_t> max {0};
+    };
+
+    Shard& shard()
+    {
+        auto& p = shards_[thread_shard()];
+        Shard * s = p.load(std::memory_order_acquire);
+        if (s)
+            return *s;
+        auto fresh = std::make_unique<Shard>();
+        if (p.compare_exchange_strong(s, fresh.get(), std::memory_order_acq_rel))
+            return *fresh.release();
+        return *s;
+    }
+
+    std::array<std::atomic<Shard*>, nb_shards> shards_ {};
+};
+
+/**
+ * Record the lifetime of the scope in a histogram, in ns.
+ */
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(Histogram& h): histogram_(h), start_(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() {histogram_.record(std::chrono::steady_clock::now() - start_);}
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    Histogram&                            histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+} /* namespace metrics */
+} /* namespace common */
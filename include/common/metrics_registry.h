@@ -0,0 +1,142 @@
+/**
+ * Named metrics and json export.
+ *
+ * Metrics are created (or looked up) by name once, typically at construction
+ * of the component using them, then updated through the returned reference
+ * without touching the registry again. The registry only locks when metrics
+ * are created or snapshotted.
+ *
+ * The registry owns its metrics: a reference is valid until the metric is
+ * removed. A component whose metric may be removed while in use gets it from
+ * counter_ptr(), gauge_ptr() or histogram_ptr(), which share its ownership.
+ */
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "json.h"
+#include "metrics.h"
+
+namespace common {
+namespace metrics {
+
+class Registry
+{
+public:
+    using GaugeFunction = std::function<int64_t()>;
+
+    /**
+     * Process wide registry.
+     */
+    static Registry& instance()
+    {
+        static Registry registry;
+        return registry;
+    }
+
+    Counter&   counter(const std::string& name)   {return *counter_ptr(name);}
+    Gauge&     gauge(const std::string& name)     {return *gauge_ptr(name);}
+    Histogram& histogram(const std::string& name) {return *histogram_ptr(name);}
+
+    std::shared_ptr<Counter> counter_ptr(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        return get(counters_, name);
+    }
+
+    std::shared_ptr<Gauge> gauge_ptr(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        return get(gauges_, name);
+    }
+
+    std::shared_ptr<Histogram> histogram_ptr(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        return get(histograms_, name);
+    }
+
+    /**
+     * Register a gauge whose value is pulled at snapshot time, e.g. the size
+     * of a queue. fn is called with the registry lock held.
+     */
+    void gauge(const std::string& name, GaugeFunction fn)
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        gauge_functions_[name] = std::move(fn);
+    }
+
+    /**
+     * Stop exporting the metrics named name. They are destroyed once the
+     * pointers shared with counter_ptr() ... are released: the references
+     * returned by counter() ... must not be used afterwards.
+     */
+    void remove(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        counters_.erase(name);
+        gauges_.erase(name);
+        histograms_.erase(name);
+        gauge_functions_.erase(name);
+    }
+
+    /**
+     * Current value of every metric:
+     *
+     *     {
+     *       "counters":   {"name": 12, ...},
+     *       "gauges":     {"name": 3, ...},
+     *       "histograms": {"name": {"count": 10, "sum": 1234, "min": 2, "max": 980,
+     *                               "mean": 123.4, "p50": 90, "p90": 400,
+     *                               "p99": 970, "p999": 980}, ...}
+     *     }
+     */
+    json snapshot() const
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        json j = {{"counters", json::object()}, {"gauges", json::object()},
+                  {"histograms", json::object()}};
+
+        for (const auto& [name, c]: counters_)
+            j["counters"][name] = c->value();
+        for (const auto& [name, g]: gauges_)
+            j["gauges"][name] = g->value();
+        for (const auto& [name, fn]: gauge_functions_)
+            j["gauges"][name] = fn();
+        for (const auto& [name, h]: histograms_)
+            j["histograms"][name] = to_json(h->snapshot());
+        return j;
+    }
+
+    static json to_json(const HistogramSnapshot& s)
+    {
+        return {{"count", s.count}, {"sum", s.sum}, {"min", s.min}, {"max", s.max},
+                {"mean", s.mean()}, {"p50", s.percentile(0.5)}, {"p90", s.percentile(0.9)},
+                {"p99", s.percentile(0.99)}, {"p999", s.percentile(0.999)}};
+    }
+
+private:
+    template<typename M>
+    static std::shared_ptr<M> get(std::map<std::string, std::shared_ptr<M>>& map,
+                                  const std::string& name)
+    {
+        auto& p = map[name];
+        if (!p)
+            p = std::make_shared<M>();
+        return p;
+    }
+
+    std::map<std::string, std::shared_ptr<Counter>>   counters_;
+    std::map<std::string, std::shared_ptr<Gauge>>     gauges_;
+    std::map<std::string, std::shared_ptr<Histogram>> histograms_;
+    std::map<std::string, GaugeFunction>              gauge_functions_;
+    mutable std::mutex                                mutex_;
+};
+
+} /* namespace metrics */
+} /* namespace common */
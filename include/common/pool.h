@@ -0,0 +1,411 @@
+/**
+ * Allocators for the steady state message path.
+ *
+ *  - FixedSizePool: process wide pools of fixed size blocks (power of two
+ *    size classes from 16 to 4096 bytes) with a per-thread cache, so that most
+ *    allocations and deallocations touch neither malloc nor a shared lock.
+ *  - PoolAllocator<T>: standard allocator on top of FixedSizePool, stateless,
+ *    usable as the Allocator parameter of WaitQueue, EventMngr and
+ *    BasicTimeoutQueue (or of any standard container).
+ *  - ObjectPool<T>: typed create / destroy of objects in pooled blocks.
+ *  - MonotonicArena / ArenaAllocator<T>: bump allocation from large chunks,
+ *    released all at once by reset() or on destruction.
+ *
+ * Pooled memory is never returned to the system, the pools only grow to the
+ * peak usage.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace common {
+
+class FixedSizePool
+{
+public:
+    static constexpr std::size_t min_block_size = 16;
+    static constexpr std::size_t max_block_size = 4096;
+    static constexpr std::size_t nb_classes     = 9;   // 16, 32, ..., 4096
+
+    /**
+     * Size class index of an allocation of size bytes, size <= max_block_size.
+     */
+    static std::size_t size_class(std::size_t size)
+    {
+        if (size <= min_block_size)
+            return 0;
+        return 64 - __builtin_clzll(size - 1) - 4;
+    }
+
+    /**
+     * Pool serving the blocks of the given size class.
+     */
+    static FixedSizePool& for_class(std::size_t cls)
+    {
+        // never destroyed: blocks may be released by thread caches or static
+        // objects after the end of main()
+        static std::array<FixedSizePool*, nb_classes> pools = []
+            {
+                std::array<FixedSizePool*, nb_classes> p;
+                for (std::size_t i = 0; i < nb_classes; i++)
+                    p[i] = new FixedSizePool(min_block_size << i, i);
+                return p;
+            }();
+        return *pools[cls];
+    }
+
+    static FixedSizePool& for_size(std::size_t size) {return for_class(size_class(size));}
+
+    void * allocate()
+    {
+        ThreadCaches * caches = thread_caches();
+        if (!caches)
+            return allocate_shared();
+        ThreadCache& cache = caches->caches[index_];
+        if (!cache.head)
+            refill(cache);
+        Node * n = cache.head;
+        cache.head = n->next;
+        cache.count--;
+        return n;
+    }
+
+    void deallocate(void * p)
+    {
+        ThreadCaches * caches = thread_caches();
+        if (!caches) {
+            deallocate_shared(p);
+            return;
+        }
+        ThreadCache& cache = caches->caches[index_];
+        Node * n = static_cast<Node*>(p);
+        n->next = cache.head;
+        cache.head = n;
+        if (++cache.count >= 2 * batch_size)
+            release(cache, batch_size);
+    }
+
+    std::size_t block_size() const {return block_size_;}
+
+private:
+    struct Node
+    {
+        Node * next;
+    };
+
+    struct ThreadCache
+    {
+        Node      * head  = nullptr;
+        std::size_t count = 0;
+    };
+
+    struct ThreadCaches
+    {
+        std::array<ThreadCache, nb_classes> caches;
+
+        ~ThreadCaches()
+        {
+            caches_destroyed() = true;
+            for (std::size_t i = 0; i < nb_classes; i++)
+                if (caches[i].count)
+                    for_class(i).release(caches[i], caches[i].count);
+        }
+    };
+
+    static constexpr std::size_t batch_size = 64;
+    static constexpr std::size_t chunk_size = 64 * 1024;
+
+    FixedSizePool(std::size_t block_size, std::size_t index):
+        block_size_(block_size), index_(index) {}
+
+    /**
+     * Cache of the calling thread, null once it is destroyed: blocks freed by
+     * the thread_local objects destroyed after it, or by the static objects
+     * on the main thread, go directly to the shared lists.
+     */
+    static ThreadCaches * thread_caches()
+    {
+        if (caches_destroyed())
+            return nullptr;
+        thread_local ThreadCaches caches;
+        return &caches;
+    }
+
+    // trivially destructible, so valid until the thread is gone
+    static bool& caches_destroyed()
+    {
+        thread_local bool destroyed = false;
+        return destroyed;
+    }
+
+    void * allocate_shared()
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        if (!free_)
+            grow();
+        Node * n = free_;
+        free_ = n->next;
+        return n;
+    }
+
+    void deallocate_shared(void * p)
+    {
+        Node * n = static_cast<Node*>(p);
+        std::lock_guard<std::mutex> lk(mutex_);
+        n->next = free_;
+        free_ = n;
+    }
+
+    // move up to batch_size blocks from the shared list to the cache
+    void refill(ThreadCache& cache)
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        if (!free_)
+            grow();
+        while (free_ && cache.count < batch_size) {
+            Node * n = free_;
+            free_ = n->next;
+            n->next = cache.head;
+            cache.head = n;
+            cache.count++;
+        }
+    }
+
+    // move count blocks from the cache to the shared list
+    void release(ThreadCache& cache, std::size_t count)
+    {
+        Node * first = cache.head;
+        Node * last  = first;
+        for (std::size_t i = 1; i < count; i++)
+            last = last->next;
+        cache.head   = last->next;
+        cache.count -= count;
+
+        std::lock_guard<std::mutex> lk(mutex_);
+        last->next = free_;
+        free_ = first;
+    }
+
+    void grow()
+    {
+        const std::size_t size = std::max(chunk_size, block_size_ * batch_size);
+        char * chunk = static_cast<char*>(::operator new(size));
+        for (std::size_t off = 0; off + block_size_ <= size; off += block_size_) {
+            Node * n = reinterpret_cast<Node*>(chunk + off);
+            n->next = free_;
+            free_ = n;
+        }
+    }
+
+    const std::size_t block_size_;
+    const std::size_t index_;
+    Node            * free_ = nullptr;
+    std::mutex        mutex_;
+};
+
+/**
+ * Stateless allocator taking blocks from the FixedSizePool matching the size
+ * of each allocation. Allocations larger than FixedSizePool::max_block_size
+ * or over-aligned types fall back on operator new.
+ */
+template<typename T>
+class PoolAllocator
+{
+public:
+    using value_type = T;
+
+    PoolAllocator() noexcept = default;
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+    T * allocate(std::size_t n)
+    {
+        const std::size_t size = n * sizeof(T);
+        if (!pooled(size))
+            return static_cast<T*>(::operator new(size));
+        return static_cast<T*>(FixedSizePool::for_size(size).allocate());
+    }
+
+    void deallocate(T * p, std::size_t n) noexcept
+    {
+        const std::size_t size = n * sizeof(T);
+        if (!pooled(size))
+            ::operator delete(p);
+        else
+            FixedSizePool::for_size(size).deallocate(p);
+    }
+
+    template<typename U>
+    bool operator==(const PoolAllocator<U>&) const noexcept {return true;}
+    template<typename U>
+    bool operator!=(const PoolAllocator<U>&) const noexcept {return false;}
+
+private:
+    static constexpr bool pooled(std::size_t size)
+    {
+        return size <= FixedSizePool::max_block_size &&
+               alignof(T) <= alignof(std::max_align_t);
+    }
+};
+
+/**
+ * Typed pool of objects of type T.
+ */
+template<typename T>
+class ObjectPool
+{
+    static_assert(sizeof(T) <= FixedSizePool::max_block_size, "type too large for the pool");
+    static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned type");
+
+public:
+    struct Deleter
+    {
+        void operator()(T * p) const {ObjectPool::destroy(p);}
+    };
+    using Ptr = std::unique_ptr<T, Deleter>;
+
+    template<typename... Args>
+    static T * create(Args&&... args)
+    {
+        void * p = pool().allocate();
+        try {
+            return new (p) T(std::forward<Args>(args)...);
+        } catch (...) {
+            pool().deallocate(p);
+            throw;
+        }
+    }
+
+    static void destroy(T * p)
+    {
+        if (!p)
+            return;
+        p->~T();
+        pool().deallocate(p);
+    }
+
+    template<typename... Args>
+    static Ptr make(Args&&... args)
+    {
+        return Ptr(create(std::forward<Args>(args)...));
+    }
+
+private:
+    static FixedSizePool& pool() {return FixedSizePool::for_size(sizeof(T));}
+};
+
+/**
+ * Bump allocator. Memory is only reclaimed by reset() (which keeps the chunks
+ * for reuse) or when the arena is destroyed. Not thread safe.
+ */
+class MonotonicArena
+{
+public:
+    explicit MonotonicArena(std::size_t chunk_size = 64 * 1024): chunk_size_(chunk_size) {}
+
+    ~MonotonicArena()
+    {
+        for (auto& c: chunks_)
+            ::operator delete(c.data);
+    }
+
+    MonotonicArena(const MonotonicArena&) = delete;
+    MonotonicArena& operator=(const MonotonicArena&) = delete;
+
+    void * allocate(std::size_t size, std::size_t align = alignof(std::max_align_t))
+    {
+        for (;;) {
+            if (current_ < chunks_.size()) {
+                const Chunk& c = chunks_[current_];
+                const auto base    = reinterpret_cast<uintptr_t>(c.data);
+                const auto aligned = (base + offset_ + align - 1) & ~(uintptr_t(align) - 1);
+                const std::size_t off = aligned - base;
+                if (off + size <= c.size) {
+                    offset_ = off + size;
+                    return c.data + off;
+                }
+                // chunks kept by reset() are reused before allocating new ones
+                if (current_ + 1 < chunks_.size()) {
+                    current_++;
+                    offset_ = 0;
+                    continue;
+                }
+            }
+            const std::size_t chunk_size = std::max(chunk_size_, size + align);
+            chunks_.push_back({static_cast<char*>(::operator new(chunk_size)), chunk_size});
+            current_ = chunks_.size() - 1;
+            offset_  = 0;
+        }
+    }
+
+    /**
+     * Release every allocation at once. The chunks are kept.
+     */
+    void reset()
+    {
+        current_ = 0;
+        offset_  = 0;
+    }
+
+    std::size_t capacity() const
+    {
+        std::size_t total = 0;
+        for (const auto& c: chunks_)
+            total += c.size;
+        return total;
+    }
+
+private:
+    struct Chunk
+    {
+        char      * data;
+        std::size_t size;
+    };
+
+    std::size_t        chunk_size_;
+    std::vector<Chunk> chunks_;
+    std::size_t        current_ = 0;
+    std::size_t        offset_  = 0;
+};
+
+/**
+ * Allocator drawing from a MonotonicArena. deallocate() is a no-op.
+ */
+template<typename T>
+class ArenaAllocator
+{
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(MonotonicArena& arena) noexcept: arena_(&arena) {}
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) noexcept: arena_(other.arena()) {}
+
+    T * allocate(std::size_t n)
+    {
+        return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *, std::size_t) noexcept {}
+
+    MonotonicArena * arena() const noexcept {return arena_;}
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U>& other) const noexcept {return arena_ == other.arena();}
+    template<typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const noexcept {return arena_ != other.arena();}
+
+private:
+    MonotonicArena * arena_;
+};
+
+} /* namespace common */
@@ -0,0 +1,202 @@
+/**
+ * Blocking queues serving latency sensitive elements first, with the push /
+ * pop semantics of WaitQueue.
+ *
+ *  - PriorityWaitQueue<T, NbLanes>: elements are pushed to one of NbLanes
+ *    FIFO lanes (0 is the most urgent), pop() takes from the most urgent
+ *    non-empty lane. Enqueue is O(1), dequeue O(NbLanes).
+ *  - DeadlineWaitQueue<T>: earliest deadline first, ties in FIFO order.
+ *    Enqueue and dequeue are O(log n).
+ *
+ *     PriorityWaitQueue<Msg, 2> queue(std::chrono::milliseconds(50));
+ *     queue.push(control, 0);
+ *     queue.push(bulk);          // least urgent lane
+ *
+ * Starvation protection: in PriorityWaitQueue an element that waited more
+ * than max_wait is served before the more urgent lanes (the oldest one
+ * first); in DeadlineWaitQueue elements pushed without deadline get one
+ * default_deadline after their push, so they end up first.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "wait_queue.h"
+
+namespace common {
+
+/**
+ * Fixed number of FIFO lanes, 0 being the most urgent.
+ */
+template<typename T, std::size_t NbLanes, typename Allocator = std::allocator<T>>
+class PriorityLanesPolicy
+{
+    static_assert(NbLanes >= 1 && NbLanes <= 32, "1 to 32 lanes");
+
+public:
+    /**
+     * @param max_wait time after which an element is served whatever its
+     *        lane, 0 for strict priorities
+     */
+    explicit PriorityLanesPolicy(std::chrono::nanoseconds max_wait = std::chrono::nanoseconds(0),
+                                 const Allocator& alloc = Allocator()):
+        max_wait_(max_wait.count())
+    {
+        for (auto& lane: lanes_)
+            lane = Lane(EntryAllocator(alloc));
+    }
+
+    /**
+     * Push to the least urgent lane.
+     */
+    template<typename U>
+    void push(U&& elt) {push(std::forward<U>(elt), NbLanes - 1);}
+
+    template<typename U>
+    void push(U&& elt, std::size_t lane)
+    {
+        if (lane >= NbLanes)
+            throw std::out_of_range("priority lane out of range");
+        lanes_[lane].push_back({max_wait_ ? now_ns() : 0, std::forward<U>(elt)});
+        non_empty_ |= 1u << lane;
+        size_++;
+    }
+
+    T pop()
+    {
+        std::size_t lane = __builtin_ctz(non_empty_);
+        // serve the oldest overdue element of a less urgent lane, if any
+        uint32_t others = non_empty_ & ~((uint32_t(2) << lane) - 1);
+        if (max_wait_ && others) {
+            const int64_t now = now_ns();
+            int64_t oldest = now - max_wait_;
+            while (others) {
+                const std::size_t l = __builtin_ctz(others);
+                others &= others - 1;
+                const int64_t ts = lanes_[l].front().timestamp;
+                if (ts < oldest && ts < lanes_[lane].front().timestamp) {
+                    oldest = ts;
+                    lane   = l;
+                }
+            }
+        }
+
+        Lane& q = lanes_[lane];
+        T elt = std::move(q.front().value);
+        q.pop_front();
+        if (q.empty())
+            non_empty_ &= ~(1u << lane);
+        size_--;
+        return elt;
+    }
+
+    bool        empty() const {return size_ == 0;}
+    std::size_t size()  const {return size_;}
+
+private:
+    struct Entry
+    {
+        int64_t timestamp;
+        T       value;
+    };
+
+    using EntryAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Entry>;
+    using Lane           = std::deque<Entry, EntryAllocator>;
+
+    static int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    std::array<Lane, NbLanes> lanes_;
+    uint32_t                  non_empty_ = 0;
+    std::size_t               size_      = 0;
+    int64_t                   max_wait_;
+};
+
+/**
+ * Earliest deadline first.
+ */
+template<typename T, typename Allocator = std::allocator<T>>
+class DeadlinePolicy
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @param default_deadline deadline of the elements pushed without one,
+     *        relative to their push
+     */
+    explicit DeadlinePolicy(Clock::duration default_deadline = std::chrono::seconds(1),
+                            const Allocator& alloc = Allocator()):
+        heap_(EntryAllocator(alloc)), default_deadline_(default_deadline) {}
+
+    template<typename U>
+    void push(U&& elt) {push(std::forward<U>(elt), Clock::now() + default_deadline_);}
+
+    template<typename U>
+    void push(U&& elt, Clock::time_point deadline)
+    {
+        heap_.push_back({deadline, seq_++, std::forward<U>(elt)});
+        std::push_heap(heap_.begin(), heap_.end(), later);
+    }
+
+    /**
+     * Deadline relative to now.
+     */
+    template<typename U, typename Rep, typename Period>
+    void push(U&& elt, std::chrono::duration<Rep, Period> deadline)
+    {
+        push(std::forward<U>(elt),
+             Clock::now() + std::chrono::duration_cast<Clock::duration>(deadline));
+    }
+
+    T pop()
+    {
+        std::pop_heap(heap_.begin(), heap_.end(), later);
+        T elt = std::move(heap_.back().value);
+        heap_.pop_back();
+        return elt;
+    }
+
+    bool        empty() const {return heap_.empty();}
+    std::size_t size()  const {return heap_.size();}
+
+private:
+    struct Entry
+    {
+        Clock::time_point deadline;
+        uint64_t          seq;
+        T                 value;
+    };
+
+    using EntryAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Entry>;
+
+    // heap comparison: the top is the earliest deadline, then the first pushed
+    static bool later(const Entry& a, const Entry& b)
+    {
+        return a.deadline != b.deadline ? a.deadline > b.deadline : a.seq > b.seq;
+    }
+
+    std::vector<Entry, EntryAllocator> heap_;
+    uint64_t                           seq_ = 0;
+    Clock::duration                    default_deadline_;
+};
+
+template<typename T, std::size_t NbLanes = 4, typename Allocator = std::allocator<T>>
+using PriorityWaitQueue = BasicWaitQueue<T, PriorityLanesPolicy<T, NbLanes, Allocator>>;
+
+template<typename T, typename Allocator = std::allocator<T>>
+using DeadlineWaitQueue = BasicWaitQueue<T, DeadlinePolicy<T, Allocator>>;
+
+} /* namespace common */
@@ -0,0 +1,205 @@
+/**
+ * Wait on several WaitQueues and EventMngr events from a single thread.
+ *
+ *     common::Selector sel;                       // round-robin
+ *     sel.add(requests);                          // 0
+ *     sel.add(replies);                           // 1
+ *     sel.add(events, Event::shutdown);           // 2
+ *     for (;;) {
+ *         switch (sel.wait()) {
+ *         case 0: if (requests.try_pop(req)) ...; break;
+ *         case 1: if (replies.try_pop(rep)) ...; break;
+ *         case 2: events.erase(Event::shutdown); return;
+ *         }
+ *     }
+ *
+ * or, for a one-shot wait taking the first ready source in argument order:
+ *
+ *     std::size_t i = common::select(requests, replies);
+ *
+ * The selector is subscribed to its sources and sleeps on an EventCount while
+ * none of them is ready, so it never polls. A ready source is only a hint when
+ * other threads consume from it: use try_pop(), which may fail.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "event_mngr.h"
+#include "sync.h"
+#include "wait_queue.h"
+#include "waiter.h"
+
+namespace common {
+
+class Selector: public Waiter
+{
+public:
+    enum class Order
+    {
+        round_robin, ///< scan from the source after the last ready one
+        priority,    ///< scan from the first source added
+    };
+
+    explicit Selector(Order order = Order::round_robin): order_(order) {}
+
+    /**
+     * Sources must outlive the selector.
+     */
+    ~Selector()
+    {
+        for (auto& s: sources_)
+            s->unsubscribe(this);
+    }
+
+    Selector(const Selector&) = delete;
+    Selector& operator=(const Selector&) = delete;
+
+    /**
+     * Add a queue, ready when not empty. Return its index.
+     */
+    template<typename T, typename Policy>
+    std::size_t add(BasicWaitQueue<T, Policy>& queue)
+    {
+        return add_source(std::make_unique<QueueSource<T, Policy>>(queue));
+    }
+
+    /**
+     * Add an event of events, ready while e is pending. Return its index.
+     */
+    template<typename EventType, typename Allocator>
+    std::size_t add(EventMngr<EventType, Allocator>& events, EventType e)
+    {
+        return add_source(std::make_unique<EventSource<EventType, Allocator>>(events, e));
+    }
+
+    std::size_t size() const {return sources_.size();}
+
+    /**
+     * Block until a source is ready and return its index.
+     */
+    std::size_t wait()
+    {
+        for (;;) {
+            if (auto i = poll())
+                return *i;
+            const auto key = ec_.prepare_wait();
+            if (auto i = poll()) {
+                ec_.cancel_wait();
+                return *i;
+            }
+            ec_.wait(key);
+        }
+    }
+
+    /**
+     * Same as wait(), returning nullopt if no source was ready before timeout.
+     */
+    template<typename Rep, typename Period>
+    std::optional<std::size_t> wait_for(std::chrono::duration<Rep, Period> timeout)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        for (;;) {
+            if (auto i = poll())
+                return i;
+            const auto key = ec_.prepare_wait();
+            if (auto i = poll()) {
+                ec_.cancel_wait();
+                return i;
+            }
+            if (!ec_.wait_until(key, deadline))
+                return poll();
+        }
+    }
+
+    /**
+     * Index of a ready source, without blocking.
+     */
+    std::optional<std::size_t> poll()
+    {
+        const std::size_t n     = sources_.size();
+        const std::size_t first = order_ == Order::round_robin ? next_ : 0;
+        for (std::size_t k = 0; k < n; k++) {
+            const std::size_t i = (first + k) % n;
+            if (sources_[i]->ready()) {
+                next_ = (i + 1) % n;
+                return i;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // called by the sources, with their lock held
+    bool notify() override
+    {
+        ec_.notify();
+        return true;
+    }
+
+private:
+    struct Source
+    {
+        virtual ~Source() = default;
+        virtual bool ready() = 0;
+        virtual void subscribe(Waiter * w) = 0;
+        virtual void unsubscribe(Waiter * w) = 0;
+    };
+
+    template<typename T, typename Policy>
+    struct QueueSource: Source
+    {
+        explicit QueueSource(BasicWaitQueue<T, Policy>& queue): queue(queue) {}
+
+        bool ready() override                 {return !queue.empty();}
+        void subscribe(Waiter * w) override   {queue.subscribe(w);}
+        void unsubscribe(Waiter * w) override {queue.unsubscribe(w);}
+
+        BasicWaitQueue<T, Policy>& queue;
+    };
+
+    template<typename EventType, typename Allocator>
+    struct EventSource: Source
+    {
+        EventSource(EventMngr<EventType, Allocator>& events, EventType e): events(events), e(e) {}
+
+        bool ready() override                 {return events.contains(e);}
+        void subscribe(Waiter * w) override   {events.subscribe(w);}
+        void unsubscribe(Waiter * w) override {events.unsubscribe(w);}
+
+        EventMngr<EventType, Allocator>& events;
+        EventType                        e;
+    };
+
+    std::size_t add_source(std::unique_ptr<Source> s)
+    {
+        s->subscribe(this);
+        sources_.push_back(std::move(s));
+        return sources_.size() - 1;
+    }
+
+    Order                                order_;
+    std::vector<std::unique_ptr<Source>> sources_;
+    std::size_t                          next_ = 0;
+    EventCount                           ec_;
+};
+
+/**
+ * Block until one of queues is not empty and return its index, the first
+ * one in argument order if several are.
+ */
+template<typename... Queues>
+std::size_t select(Queues&... queues)
+{
+    static_assert(sizeof...(Queues) > 0, "nothing to select");
+    Selector sel(Selector::Order::priority);
+    (sel.add(queues), ...);
+    return sel.wait();
+}
+
+} /* namespace common */
@@ -0,0 +1,423 @@
+/**
+ * Blocking queue between the processes of a host, in a POSIX shared memory
+ * segment.
+ *
+ *     // in each process, the first one creating the segment
+ *     common::ShmWaitQueue<Message> queue("/app.requests", 1024);
+ *     queue.push(msg);            // or, in another process
+ *     Message m = queue.pop();
+ *
+ * Elements are trivially copyable and stored in a fixed number of slots: a
+ * push copies the element into the segment and a pop copies it out, without
+ * going through the kernel. A full queue blocks push() as an empty one blocks
+ * pop(). Sleeping processes are woken with process-shared futexes, only
+ * when some are sleeping.
+ *
+ * Large elements can be written and read in place in their slot, without the
+ * copies:
+ *
+ *     queue.push_in_place([&](Message& m) {m.size = read(fd, m.data, sizeof(m.data));});
+ *     queue.pop_in_place([&](const Message& m) {process(m.data, m.size);});
+ *
+ * The queue stays locked while the function runs, keep it short.
+ *
+ * The queue is protected by a robust mutex. If a process dies while holding
+ * it, the next one locking it recovers the queue: an element whose push was
+ * interrupted is dropped, an element whose pop was interrupted stays queued
+ * (it is delivered at least once). recoveries() counts these events.
+ *
+ * A process dying while creating the segment does not block the others: the
+ * next one opening it initializes it.
+ *
+ * The segment outlives the processes, remove it with ShmWaitQueue::unlink().
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sync.h"
+
+namespace common {
+
+template<typename T>
+class ShmWaitQueue
+{
+    static_assert(std::is_trivially_copyable<T>::value, "elements are copied in shared memory");
+
+public:
+    /**
+     * Open the queue name ("/name"), creating it with nb_slots slots if it
+     * does not exist, or if its creator died before initializing it.
+     * nb_slots is ignored otherwise.
+     */
+    ShmWaitQueue(const std::string& name, std::size_t nb_slots): name_(name)
+    {
+        if (nb_slots == 0)
+            throw std::invalid_argument("ShmWaitQueue: no slot");
+
+        bool created = true;
+        int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd < 0 && errno == EEXIST) {
+            created = false;
+            fd = ::shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0600);
+        }
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "shm_open " + name);
+
+        try {
+            // the segment is initialized with its file locked, the lock being
+            // released by the kernel if its owner dies: a segment found not
+            // initialized once locked is initialized in place of its dead
+            // creator (which may also be a process that locked it first)
+            while (::flock(fd, LOCK_EX) < 0) {
+                if (errno != EINTR)
+                    throw std::system_error(errno, std::generic_category(), "flock " + name);
+            }
+            if (!map_initialized(fd)) {
+                size_ = sizeof(Header) + nb_slots * sizeof(T);
+                if (::ftruncate(fd, size_) < 0)
+                    throw std::system_error(errno, std::generic_category(), "ftruncate " + name);
+                map(fd);
+                init(nb_slots);
+            }
+        } catch (...) {
+            ::close(fd);
+            if (created)
+                ::shm_unlink(name.c_str());
+            throw;
+        }
+        ::close(fd);
+
+        if (header_->magic != magic || header_->slot_size != sizeof(T) ||
+            size_ != sizeof(Header) + header_->nb_slots * sizeof(T)) {
+            ::munmap(header_, size_);
+            throw std::runtime_error(name + ": incompatible shared queue");
+        }
+    }
+
+    ~ShmWaitQueue()
+    {
+        ::munmap(header_, size_);
+    }
+
+    ShmWaitQueue(const ShmWaitQueue&) = delete;
+    ShmWaitQueue& operator=(const ShmWaitQueue&) = delete;
+
+    /**
+     * Remove the segment name, the processes having it opened keep using it.
+     */
+    static void unlink(const std::string& name)
+    {
+        ::shm_unlink(name.c_str());
+    }
+
+    T pop()
+    {
+        T elt;
+        pop(elt);
+        return elt;
+    }
+
+    void pop(T& elt)
+    {
+        Lock lk(this);
+        header_->not_empty.wait(lk, [&] {return header_->tail != header_->head;});
+        take(elt);
+    }
+
+    /**
+     * Pop an element if one is available, without blocking.
+     */
+    bool try_pop(T& elt)
+    {
+        Lock lk(this);
+        if (header_->tail == header_->head)
+            return false;
+        take(elt);
+        return true;
+    }
+
+    /**
+     * Return false if no element was available before timeout.
+     */
+    template<typename Rep, typename Period>
+    bool pop_for(T& elt, std::chrono::duration<Rep, Period> timeout)
+    {
+        Lock lk(this);
+        if (!header_->not_empty.wait_for(lk, timeout,
+                                         [&] {return header_->tail != header_->head;}))
+            return false;
+        take(elt);
+        return true;
+    }
+
+    /**
+     * Push elt, blocking while the queue is full.
+     */
+    void push(const T& elt)
+    {
+        Lock lk(this);
+        header_->not_full.wait(lk, [&] {return !full();});
+        put(elt);
+    }
+
+    /**
+     * Push elt if a slot is free, without blocking.
+     */
+    bool try_push(const T& elt)
+    {
+        Lock lk(this);
+        if (full())
+            return false;
+        put(elt);
+        return true;
+    }
+
+    /**
+     * Push an element written in place by write(T& slot), blocking while the
+     * queue is full. The slot holds the previous element it contained. If
+     * write throws, or the process dies during the call, nothing is pushed.
+     */
+    template<typename F>
+    void push_in_place(F&& write)
+    {
+        Lock lk(this);
+        header_->not_full.wait(lk, [&] {return !full();});
+        put_with(write);
+    }
+
+    /**
+     * Same as push_in_place(), returning false without blocking if the queue
+     * is full.
+     */
+    template<typename F>
+    bool try_push_in_place(F&& write)
+    {
+        Lock lk(this);
+        if (full())
+            return false;
+        put_with(write);
+        return true;
+    }
+
+    /**
+     * Pop an element read in place by read(const T& slot), blocking while the
+     * queue is empty. If read throws, or the process dies during the call,
+     * the element stays queued.
+     */
+    template<typename F>
+    void pop_in_place(F&& read)
+    {
+        Lock lk(this);
+        header_->not_empty.wait(lk, [&] {return header_->tail != header_->head;});
+        take_with(read);
+    }
+
+    /**
+     * Same as pop_in_place(), returning false without blocking if the queue
+     * is empty.
+     */
+    template<typename F>
+    bool try_pop_in_place(F&& read)
+    {
+        Lock lk(this);
+        if (header_->tail == header_->head)
+            return false;
+        take_with(read);
+        return true;
+    }
+
+    size_t size()
+    {
+        Lock lk(this);
+        return header_->tail - header_->head;
+    }
+
+    bool empty() {return size() == 0;}
+
+    size_t capacity() const {return header_->nb_slots;}
+
+    /**
+     * Number of times the queue was recovered after the death of a process
+     * holding its lock.
+     */
+    uint64_t recoveries()
+    {
+        Lock lk(this);
+        return header_->recoveries;
+    }
+
+private:
+    static constexpr uint64_t magic = 0x434d4e53484d5131;   // "CMNSHMQ1"
+
+    struct Header
+    {
+        uint64_t              magic;
+        uint64_t              slot_size;
+        uint64_t              nb_slots;
+        std::atomic<uint32_t> ready;
+        pthread_mutex_t       mutex;
+        EventCount            not_empty;
+        EventCount            not_full;
+        // indices of the next pop / push modulo nb_slots, protected by mutex
+        // and only increased once the slot is copied, so that an interrupted
+        // push / pop leaves the queue consistent
+        uint64_t              head;
+        uint64_t              tail;
+        uint64_t              recoveries;
+    };
+
+    static_assert(alignof(T) <= alignof(Header), "slots follow the header");
+    static_assert(std::atomic<uint32_t>::is_always_lock_free &&
+                  std::atomic<uint64_t>::is_always_lock_free,
+                  "atomics in shared memory must be lock-free");
+
+    // lock of the header mutex, recovering the queue from a dead owner
+    class Lock
+    {
+    public:
+        explicit Lock(ShmWaitQueue * q): q_(q) {lock();}
+        ~Lock() {if (owns_) unlock();}
+
+        void lock()
+        {
+            const int ret = ::pthread_mutex_lock(&q_->header_->mutex);
+            if (ret == EOWNERDEAD) {
+                q_->recover();
+                ::pthread_mutex_consistent(&q_->header_->mutex);
+            } else if (ret != 0) {
+                throw std::system_error(ret, std::generic_category(),
+                                        "pthread_mutex_lock " + q_->name_);
+            }
+            owns_ = true;
+        }
+
+        void unlock()
+        {
+            owns_ = false;
+            ::pthread_mutex_unlock(&q_->header_->mutex);
+        }
+
+    private:
+        ShmWaitQueue * q_;
+        bool           owns_ = false;
+    };
+
+    void init(std::size_t nb_slots)
+    {
+        header_->magic      = magic;
+        header_->slot_size  = sizeof(T);
+        header_->nb_slots   = nb_slots;
+        header_->head       = 0;
+        header_->tail       = 0;
+        header_->recoveries = 0;
+        new (&header_->not_empty) EventCount(true);
+        new (&header_->not_full) EventCount(true);
+
+        pthread_mutexattr_t attr;
+        ::pthread_mutexattr_init(&attr);
+        ::pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        ::pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        const int ret = ::pthread_mutex_init(&header_->mutex, &attr);
+        ::pthread_mutexattr_destroy(&attr);
+        if (ret != 0) {
+            ::munmap(header_, size_);
+            ::shm_unlink(name_.c_str());
+            throw std::system_error(ret, std::generic_category(), "pthread_mutex_init " + name_);
+        }
+
+        header_->ready.store(1, std::memory_order_release);
+    }
+
+    void map(int fd)
+    {
+        void * addr = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED)
+            throw std::system_error(errno, std::generic_category(), "mmap " + name_);
+        header_ = static_cast<Header*>(addr);
+        slots_  = reinterpret_cast<T*>(header_ + 1);
+    }
+
+    // map the segment, locked, if it was initialized
+    bool map_initialized(int fd)
+    {
+        struct stat st;
+        if (::fstat(fd, &st) < 0)
+            throw std::system_error(errno, std::generic_category(), "fstat " + name_);
+        if (st.st_size < static_cast<off_t>(sizeof(Header)))
+            return false;
+        size_ = static_cast<std::size_t>(st.st_size);
+        map(fd);
+        if (header_->ready.load(std::memory_order_acquire))
+            return true;
+        ::munmap(header_, size_);
+        header_ = nullptr;
+        slots_  = nullptr;
+        return false;
+    }
+
+    // called with the lock held, after the death of its previous owner: head
+    // and tail are consistent, only wake the processes that may have missed
+    // a notification
+    void recover()
+    {
+        header_->recoveries++;
+        header_->not_empty.notify_all();
+        header_->not_full.notify_all();
+    }
+
+    bool full() const {return header_->tail - header_->head == header_->nb_slots;}
+
+    // the notifications are sent with the lock held: a process dying before
+    // sending one is detected by the next owner of the lock, which sends them
+    void put(const T& elt)
+    {
+        put_with([&](T& slot) {std::memcpy(&slot, &elt, sizeof(T));});
+    }
+
+    void take(T& elt)
+    {
+        take_with([&](const T& slot) {std::memcpy(&elt, &slot, sizeof(T));});
+    }
+
+    template<typename F>
+    void put_with(F&& write)
+    {
+        write(slots_[header_->tail % header_->nb_slots]);
+        header_->tail++;
+        header_->not_empty.notify();
+    }
+
+    template<typename F>
+    void take_with(F&& read)
+    {
+        read(static_cast<const T&>(slots_[header_->head % header_->nb_slots]));
+        header_->head++;
+        header_->not_full.notify();
+    }
+
+    std::string  name_;
+    std::size_t  size_   = 0;
+    Header     * header_ = nullptr;
+    T          * slots_  = nullptr;
+};
+
+} /* namespace common */
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <functional>
 #include <vector>
@@ -8,6 +9,12 @@
 #include <chrono>
 #include <limits>
 #include <map>
+#include <utility>
+
+#include "clock.h"
+#include "sync.h"
+#include "trace.h"
+#include "waiter.h"
 
 namespace common {
 
@@ -16,7 +23,11 @@ enum class transition_status {
     goto_next_state
 };
 
-template<typename T>
+/**
+ * @param Function wrapper of the handlers, std::function or a move-only one
+ *        with inline storage such as common::InplaceFunction
+ */
+template<typename T, template<typename> class Function = std::function>
 class Statemachine
 {
 public:
@@ -27,7 +38,7 @@ public:
 
     struct Transition
     {
-        using Handler = std::function<transition_status()>;
+        using Handler = Function<transition_status()>;
         T       next_state_id;
         Handler handler;
     };
@@ -39,14 +50,19 @@ public:
         std::vector<Transition>  transitions;
     };
 
-    using TransitionHandler = std::function<void(const State*, const State*)>;
+    using TransitionHandler = Function<void(const State*, const State*)>;
     using StateList         = std::vector<State>;
 
-    Statemachine(std::string name, const StateList& states, T initial_state_id):
-        name_(name)
+    /**
+     * @param clock clock measuring the timeouts of wait_for()
+     */
+    Statemachine(std::string name, StateList states, T initial_state_id,
+                 Clock& clock = Clock::steady()):
+        name_(name),
+        clock_(clock)
     {
-        for (auto const& st: states) {
-            map_[st.id] = st;
+        for (auto& st: states) {
+            map_.insert_or_assign(st.id, std::move(st));
         }
 
         const auto search = map_.find(initial_state_id);
@@ -60,7 +76,7 @@ public:
 
     void reinit()
     {
-        std::unique_lock<std::mutex> lk(mutex_, std::defer_lock);
+        std::unique_lock<Mutex> lk(mutex_, std::defer_lock);
         if (!lk.try_lock()) {
             reinit_requested_  = true;
             return;
@@ -69,6 +85,7 @@ public:
         prev_state_ = curr_state_;
         curr_state_ = initial_state_;
         nb_loop_in_current_state_ = 0;
+        waiters_.notify();
         if (transition_handler_) {
             try {
                 transition_handler_(prev_state_, curr_state_);
@@ -83,17 +100,18 @@ public:
     T curr_state() const { return curr_state_->id; }
     T prev_state() const { return prev_state_->id; }
     uint64_t nb_loop_in_current_state() { return nb_loop_in_current_state_; }
-    void set_transition_handler(TransitionHandler&& h) { transition_handler_ = h; }
+    void set_transition_handler(TransitionHandler&& h) { transition_handler_ = std::move(h); }
 
     std::cv_status wait_for(T st, const std::chrono::milliseconds timeout)
     {
-        std::unique_lock<std::mutex> lk(mutex_);
-        return  cv_.wait_for(lk, timeout, [&] {return curr_state() == st;});
+        std::unique_lock<Mutex> lk(mutex_);
+        return clock_.wait_for(cv_, lk, timeout, [&] {return curr_state() == st;}) ?
+            std::cv_status::no_timeout : std::cv_status::timeout;
     }
 
     void wait(T st)
     {
-        std::unique_lock<std::mutex> lk(mutex_);
+        std::unique_lock<Mutex> lk(mutex_);
         cv_.wait(lk, [&] {return curr_state() == st;});
     }
 
@@ -108,17 +126,19 @@ public:
             nb_loop_in_current_state_ = 100;
 
         {
-            std::unique_lock<std::mutex> lk(mutex_);
+            std::unique_lock<Mutex> lk(mutex_);
             // execute each transition handler to check is a state change is required
             for (auto const& t: curr_state_->transitions) {
                 if (t.handler() == transition_status::goto_next_state) {
                     if (t.next_state_id != curr_state_->id) {
+                        COMMON_TRACE_SCOPE(trace_name());
                         nb_loop_in_current_state_ = 0;
                         auto search = map_.find(t.next_state_id);
                         if (search == map_.end())
                             throw error("next state not found");
                         prev_state_ = curr_state_;
                         curr_state_ = &(search->second);
+                        waiters_.notify();
                         if (transition_handler_) {
                             try {
                                 transition_handler_(prev_state_, curr_state_);
@@ -137,21 +157,60 @@ public:
             reinit();
     }
 
+    /**
+     * Notify w after each state change, until it is unsubscribed.
+     */
+    void subscribe(Waiter * w)
+    {
+        std::unique_lock<Mutex> lk(mutex_);
+        waiters_.add(w);
+    }
+
+    /**
+     * Subscribe w if the current state is not st, atomically. Return false,
+     * without subscribing, if it is.
+     */
+    bool subscribe_if_not_in(Waiter * w, T st)
+    {
+        std::unique_lock<Mutex> lk(mutex_);
+        if (curr_state() == st)
+            return false;
+        waiters_.add(w);
+        return true;
+    }
+
+    void unsubscribe(Waiter * w)
+    {
+        std::unique_lock<Mutex> lk(mutex_);
+        waiters_.remove(w);
+    }
+
 private:
+    // interned on the first transition traced, called with mutex_ held
+    const char * trace_name()
+    {
+        if (!trace_name_ && trace::Tracer::instance().enabled())
+            trace_name_ = trace::Tracer::instance().intern(name_ + " transition");
+        return trace_name_;
+    }
+
     std::string        name_;
+    const char       * trace_name_ = nullptr;
     std::map<T, State> map_;
     const State      * initial_state_;
     const State      * curr_state_;
     const State      * prev_state_;
 
     TransitionHandler  transition_handler_;
+    Clock            & clock_;
 
     uint64_t    nb_loop_in_current_state_ = 0;
     bool        reinit_requested_ = false;
-    bool        enabled_          = true;
+    std::atomic_bool enabled_     = true;
 
-    std::mutex              mutex_;
-    std::condition_variable cv_;
+    Mutex                   mutex_;
+    EventCount              cv_;
+    WaiterList              waiters_;
 };
 
 } /* namespace common */
@@ -0,0 +1,322 @@
+/**
+ * Synchronization primitives built directly on Linux futexes:
+ *
+ *  - Mutex: spins briefly then sleeps on a futex; usable with std::lock_guard
+ *    and std::unique_lock.
+ *  - Semaphore: counting semaphore, post() only enters the kernel when a
+ *    thread is sleeping.
+ *  - EventCount: condition variable for arbitrary conditions (lock-free or
+ *    protected by a lock), notify() is a single load when nobody waits. It
+ *    can be shared between processes (see ShmWaitQueue).
+ *
+ * They replace std::mutex / std::condition_variable in the blocking
+ * primitives of the library, where the uncontended paths stay in user space
+ * and a wakeup is a single FUTEX_WAKE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace common {
+
+namespace futex {
+
+/**
+ * Sleep while *addr == expected, or until timeout (relative, null for no
+ * limit) elapses. Returns false on timeout. Spurious wakeups are possible.
+ *
+ * @param shared true if addr is in memory shared between processes
+ */
+inline bool wait(std::atomic<uint32_t> * addr, uint32_t expected,
+                 const struct timespec * timeout = nullptr, bool shared = false)
+{
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word");
+    const long ret = ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr),
+                               shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, expected, timeout,
+                               nullptr, 0);
+    return !(ret < 0 && errno == ETIMEDOUT);
+}
+
+/**
+ * Wake up to n threads sleeping on addr.
+ */
+inline void wake(std::atomic<uint32_t> * addr, int n, bool shared = false)
+{
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr),
+              shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+}
+
+inline struct timespec to_timespec(std::chrono::nanoseconds d)
+{
+    if (d.count() < 0)
+        d = std::chrono::nanoseconds(0);
+    struct timespec ts;
+    ts.tv_sec  = d.count() / 1000000000;
+    ts.tv_nsec = d.count() % 1000000000;
+    return ts;
+}
+
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+} /* namespace futex */
+
+/**
+ * Mutex spinning for a short time before sleeping on a futex (0: unlocked, 1:
+ * locked, 2: locked with possible sleepers).
+ */
+class Mutex
+{
+public:
+    Mutex() = default;
+    Mutex(const Mutex&) = delete;
+    Mutex& operator=(const Mutex&) = delete;
+
+    void lock()
+    {
+        uint32_t c = 0;
+        if (state_.compare_exchange_strong(c, 1, std::memory_order_acquire))
+            return;
+
+        for (int i = 0; i < spin_count; i++) {
+            futex::cpu_relax();
+            c = state_.load(std::memory_order_relaxed);
+            if (c == 0 && state_.compare_exchange_weak(c, 1, std::memory_order_acquire))
+                return;
+            if (c == 2)
+                break;
+        }
+
+        // from here the lock is taken in state 2, as there may be other
+        // sleepers to wake on unlock
+        while (state_.exchange(2, std::memory_order_acquire) != 0)
+            futex::wait(&state_, 2);
+    }
+
+    bool try_lock()
+    {
+        uint32_t c = 0;
+        return state_.compare_exchange_strong(c, 1, std::memory_order_acquire);
+    }
+
+    void unlock()
+    {
+        if (state_.exchange(0, std::memory_order_release) == 2)
+            futex::wake(&state_, 1);
+    }
+
+private:
+    static constexpr int spin_count = 100;
+
+    std::atomic<uint32_t> state_ {0};
+};
+
+/**
+ * Counting semaphore.
+ */
+class Semaphore
+{
+public:
+    explicit Semaphore(uint32_t count = 0): count_(count) {}
+    Semaphore(const Semaphore&) = delete;
+    Semaphore& operator=(const Semaphore&) = delete;
+
+    void post(uint32_t n = 1)
+    {
+        count_.fetch_add(n, std::memory_order_seq_cst);
+        if (waiters_.load(std::memory_order_seq_cst) > 0)
+            futex::wake(&count_, n >= INT_MAX ? INT_MAX : static_cast<int>(n));
+    }
+
+    bool try_wait()
+    {
+        uint32_t c = count_.load(std::memory_order_relaxed);
+        while (c > 0) {
+            if (count_.compare_exchange_weak(c, c - 1, std::memory_order_acquire))
+                return true;
+        }
+        return false;
+    }
+
+    void wait()
+    {
+        while (!try_wait()) {
+            waiters_.fetch_add(1, std::memory_order_seq_cst);
+            futex::wait(&count_, 0);
+            waiters_.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Return false if the semaphore could not be decremented before timeout.
+     */
+    template<typename Rep, typename Period>
+    bool wait_for(std::chrono::duration<Rep, Period> timeout)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (!try_wait()) {
+            const auto ts = futex::to_timespec(deadline - std::chrono::steady_clock::now());
+            if (ts.tv_sec == 0 && ts.tv_nsec == 0)
+                return false;
+            waiters_.fetch_add(1, std::memory_order_seq_cst);
+            futex::wait(&count_, 0, &ts);
+            waiters_.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+private:
+    std::atomic<uint32_t> count_;
+    std::atomic<uint32_t> waiters_ {0};
+};
+
+/**
+ * Event count: lets threads wait for a condition without a dedicated lock.
+ *
+ *     // waiter                              // notifier
+ *     for (;;) {                             make condition true;
+ *         if (condition) break;              ec.notify();
+ *         auto key = ec.prepare_wait();
+ *         if (condition) {ec.cancel_wait(); break;}
+ *         ec.wait(key);
+ *     }
+ *
+ * The condition must be published with seq_cst atomics, or under a lock held
+ * by the waiter around prepare_wait(), so that either the waiter sees it or
+ * the notifier sees the waiter. wait(lock, predicate) implements the loop for
+ * conditions protected by a lock.
+ */
+class EventCount
+{
+public:
+    using Key = uint32_t;
+
+    EventCount() = default;
+
+    /**
+     * @param shared true if the event count is placed in memory shared
+     *        between processes
+     */
+    explicit EventCount(bool shared): shared_(shared) {}
+
+    EventCount(const EventCount&) = delete;
+    EventCount& operator=(const EventCount&) = delete;
+
+    Key prepare_wait()
+    {
+        const uint64_t prev = value_.fetch_add(1, std::memory_order_seq_cst);
+        return static_cast<Key>(prev >> epoch_shift);
+    }
+
+    void cancel_wait() {value_.fetch_sub(1, std::memory_order_seq_cst);}
+
+    void wait(Key key)
+    {
+        while (epoch() == key)
+            futex::wait(epoch_word(), key, nullptr, shared_);
+        value_.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    /**
+     * Return false if the timeout elapsed before a notification.
+     */
+    bool wait_until(Key key, std::chrono::steady_clock::time_point deadline)
+    {
+        bool notified = true;
+        while (epoch() == key) {
+            const auto ts = futex::to_timespec(deadline - std::chrono::steady_clock::now());
+            if ((ts.tv_sec == 0 && ts.tv_nsec == 0) ||
+                !futex::wait(epoch_word(), key, &ts, shared_)) {
+                notified = epoch() != key;
+                break;
+            }
+        }
+        value_.fetch_sub(1, std::memory_order_seq_cst);
+        return notified;
+    }
+
+    void notify()     {notify(1);}
+    void notify_all() {notify(INT_MAX);}
+
+    /**
+     * Wait until pred() is true, pred being protected by the lock lk.
+     */
+    template<typename Lock, typename Predicate>
+    void wait(Lock& lk, Predicate pred)
+    {
+        while (!pred()) {
+            const Key key = prepare_wait();
+            lk.unlock();
+            wait(key);
+            lk.lock();
+        }
+    }
+
+    /**
+     * Wait until pred() is true or timeout elapses, pred being protected by
+     * the lock lk. Return the last value of pred().
+     */
+    template<typename Lock, typename Rep, typename Period, typename Predicate>
+    bool wait_for(Lock& lk, std::chrono::duration<Rep, Period> timeout, Predicate pred)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (!pred()) {
+            const Key key = prepare_wait();
+            lk.unlock();
+            const bool notified = wait_until(key, deadline);
+            lk.lock();
+            if (!notified)
+                return pred();
+        }
+        return true;
+    }
+
+private:
+    static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "epoch in the upper half");
+
+    static constexpr int      epoch_shift = 32;
+    static constexpr uint64_t epoch_inc   = uint64_t(1) << epoch_shift;
+    static constexpr uint64_t waiter_mask = epoch_inc - 1;
+
+    void notify(int n)
+    {
+        if ((value_.load(std::memory_order_seq_cst) & waiter_mask) == 0)
+            return;
+        value_.fetch_add(epoch_inc, std::memory_order_seq_cst);
+        futex::wake(epoch_word(), n, shared_);
+    }
+
+    Key epoch() const
+    {
+        return static_cast<Key>(value_.load(std::memory_order_seq_cst) >> epoch_shift);
+    }
+
+    // upper 32 bits of value_, on which the waiters sleep
+    std::atomic<uint32_t> * epoch_word()
+    {
+        return reinterpret_cast<std::atomic<uint32_t>*>(&value_) + 1;
+    }
+
+    // epoch in the upper 32 bits, number of waiters in the lower 32 bits
+    std::atomic<uint64_t> value_ {0};
+    bool                  shared_ = false;
+};
+
+} /* namespace common */
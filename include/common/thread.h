@@ -2,8 +2,10 @@
 
 #include <thread>
 #include <atomic>
-#include <mutex>
-#include <condition_variable>
+#include <chrono>
+
+#include "clock.h"
+#include "sync.h"
 
 namespace common {
 
@@ -30,12 +32,9 @@ public:
     virtual void start(bool wait_start)
     {
         run_ = true;
-        std::unique_lock<std::mutex> lk(mutex_);
         thread_ = std::thread([this] {run();});
-        if (wait_start) {
-            started_ = false;
-            cond_.wait(lk, [this]{return started_;});
-        }
+        if (wait_start)
+            started_.wait();
     }
 
     /**
@@ -48,6 +47,13 @@ public:
      */
     virtual void run() = 0;
 
+    /**
+     * Clock of sleep_for(), the steady clock by default. To be set before
+     * start().
+     */
+    void   set_clock(Clock& clock) {clock_ = &clock;}
+    Clock& clock() const           {return *clock_;}
+
     virtual void stop()       {run_ = false;}
     virtual void join()       {thread_.join();}
     virtual void detach()     {thread_.detach();}
@@ -57,17 +63,23 @@ public:
 protected:
     void notify_running()
     {
-        std::lock_guard<std::mutex> lk(mutex_);
-        started_ = true;
-        cond_.notify_all();
+        started_.post();
+    }
+
+    /**
+     * Sleep for d, measured by the clock of the thread.
+     */
+    template<typename Rep, typename Period>
+    void sleep_for(std::chrono::duration<Rep, Period> d)
+    {
+        clock_->sleep_for(d);
     }
 
 private:
     std::thread             thread_;
     std::atomic_bool        run_ = false;
-    std::mutex              mutex_;
-    std::condition_variable cond_;
-    bool                    started_;
+    Semaphore               started_;
+    Clock                 * clock_ = &Clock::steady();
 };
 
 /**
@@ -16,22 +16,40 @@
 #include <functional>
 #include <algorithm>
 #include <vector>
+#include <memory>
 #include <mutex>
+#include <stdexcept>
 
 #include <boost/multi_index/indexed_by.hpp>
 #include <boost/multi_index/member.hpp>
 #include <boost/multi_index/ordered_index.hpp>
 #include <boost/multi_index_container.hpp>
 
+#include "metrics.h"
+#include "trace.h"
+
 namespace common
 {
 
-class TimeoutQueue {
+/**
+ * @param Allocator allocator of the events, rebound to the internal event
+ *        type (e.g. PoolAllocator<void>)
+ * @param Function wrapper of the callbacks, std::function or a move-only one
+ *        with inline storage such as common::InplaceFunction
+ */
+template<typename Allocator = std::allocator<void>,
+         template<typename> class Function = std::function>
+class BasicTimeoutQueue {
 public:
     typedef int64_t Id;
-    typedef std::function<void(Id, int64_t)> Callback;
+    /**
+     * Callbacks given to add*() must not be empty (std::invalid_argument).
+     */
+    typedef Function<void(Id, int64_t)> Callback;
 
-    TimeoutQueue() : nextId_(1) {}
+    BasicTimeoutQueue() : nextId_(1) {}
+    explicit BasicTimeoutQueue(const Allocator& alloc) :
+        timeouts_(typename Set::ctor_args_list(), EventAllocator(alloc)), nextId_(1) {}
 
     /**
      * Add a one-time timeout event that will fire "delay" time units from "now"
@@ -40,9 +58,28 @@ public:
      */
     Id add(int64_t now, int64_t delay, Callback callback)
     {
+        check_callback(callback);
         std::unique_lock<std::recursive_mutex> lk(mutex_run_);
         Id id = nextId_++;
-        timeouts_.insert({id, now + delay, -1, std::move(callback)});
+        timeouts_.insert({id, now + delay, -1, 0, std::move(callback)});
+        return id;
+    }
+
+    /**
+     * Add a one-time timeout event that can fire up to "slack" time units
+     * late, so that it is coalesced with other events: it expires with the
+     * first pending event due in [now + delay, now + delay + slack] or, if
+     * there is none, at the last multiple in this window of the largest power
+     * of two <= slack + 1, which events with close expirations and slacks
+     * share. Coalesced events are run by the same run*() call, e.g. a single
+     * wakeup of an EventLoop.
+     */
+    Id add(int64_t now, int64_t delay, int64_t slack, Callback callback)
+    {
+        check_callback(callback);
+        std::unique_lock<std::recursive_mutex> lk(mutex_run_);
+        Id id = nextId_++;
+        timeouts_.insert({id, coalesce(now + delay, slack), -1, slack, std::move(callback)});
         return id;
     }
 
@@ -56,9 +93,24 @@ public:
      */
     Id add_repeating(int64_t now, int64_t interval, Callback callback)
     {
+        check_callback(callback);
         std::unique_lock<std::recursive_mutex> lk(mutex_run_);
         Id id = nextId_++;
-        timeouts_.insert({id, now + interval, interval, std::move(callback)});
+        timeouts_.insert({id, now + interval, interval, 0, std::move(callback)});
+        return id;
+    }
+
+    /**
+     * Add a repeating timeout event, each of its expirations being coalesced
+     * as for add() with a slack.
+     */
+    Id add_repeating(int64_t now, int64_t interval, int64_t slack, Callback callback)
+    {
+        check_callback(callback);
+        std::unique_lock<std::recursive_mutex> lk(mutex_run_);
+        Id id = nextId_++;
+        timeouts_.insert({id, coalesce(now + interval, slack), interval, slack,
+                          std::move(callback)});
         return id;
     }
 
@@ -69,7 +121,7 @@ public:
     bool erase(Id id)
     {
         std::unique_lock<std::recursive_mutex> lk(mutex_run_);
-        return timeouts_.get<BY_ID>().erase(id);
+        return timeouts_.template get<BY_ID>().erase(id);
     }
 
     /**
@@ -95,6 +147,10 @@ public:
      * callbacks re-add themselves to the queue (or if you have repeating
      * callbacks with an interval of 0).
      *
+     * If a callback throws, the exception is propagated once the events of
+     * the batch that did not run yet are put back in the queue with their
+     * expiration, so that they run on the next call (repeating ones included).
+     *
      * Return the time that the next event will be due (same as
      * nextExpiration(), below)
      */
@@ -105,34 +161,56 @@ public:
         return run_internal(now, false);
     }
 
+    /**
+     * Record, for each event run, the difference between the time passed to
+     * run*() and its expiration (in the time units of the queue) to lag. Set
+     * to null to disable.
+     */
+    void set_lag_histogram(metrics::Histogram * lag)
+    {
+        std::unique_lock<std::recursive_mutex> lk(mutex_run_);
+        lag_ = lag;
+    }
+
     /**
      * Return the time that the next event will be due.
      */
     int64_t next_expiration() const
     {
+        std::unique_lock<std::recursive_mutex> lk(mutex_run_);
         return (timeouts_.empty() ?
                 std::numeric_limits<int64_t>::max() :
-                timeouts_.get<BY_EXPIRATION>().begin()->expiration);
+                timeouts_.template get<BY_EXPIRATION>().begin()->expiration);
     }
 
 private:
-    TimeoutQueue(const TimeoutQueue&) = delete;
-    TimeoutQueue& operator=(const TimeoutQueue&) = delete;
+    BasicTimeoutQueue(const BasicTimeoutQueue&) = delete;
+    BasicTimeoutQueue& operator=(const BasicTimeoutQueue&) = delete;
 
     struct Event {
         Id id;
         int64_t expiration;
         int64_t repeatInterval;
-        Callback callback;
+        int64_t slack;
+        // not a key: can be moved in and out of the (const) elements of
+        // the container
+        mutable Callback callback;
+        // rescheduled copy of a repeating event whose callback is being run,
+        // by this run*() or an outer one, and is given back once it returns
+        mutable bool running = false;
     };
 
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<Event>
+            EventAllocator;
+
     typedef boost::multi_index_container<
         Event,
         boost::multi_index::indexed_by<
             boost::multi_index::ordered_unique<
             boost::multi_index::member<Event, Id, &Event::id>>,
         boost::multi_index::ordered_non_unique<
-            boost::multi_index::member<Event, int64_t, &Event::expiration>>>>
+            boost::multi_index::member<Event, int64_t, &Event::expiration>>>,
+        EventAllocator>
             Set;
 
     enum {
@@ -141,38 +219,127 @@ private:
     };
 
     Set                  timeouts_;
+    std::vector<Event>   expired_;
     Id                   nextId_;
-    std::recursive_mutex mutex_run_;
+    mutable std::recursive_mutex mutex_run_;
+    metrics::Histogram * lag_ = nullptr;
 
     int64_t run_internal(int64_t now, bool onceOnly)
     {
         std::unique_lock<std::recursive_mutex> lk(mutex_run_);
-        auto& byExpiration = timeouts_.get<BY_EXPIRATION>();
+        auto& byExpiration = timeouts_.template get<BY_EXPIRATION>();
         int64_t nextExp;
         do {
             const auto end = byExpiration.upper_bound(now);
+            // reuse the storage of the previous run (a nested run from a
+            // callback gets an empty vector)
             std::vector<Event> expired;
-            std::move(byExpiration.begin(), end, std::back_inserter(expired));
+            expired.swap(expired_);
+            for (auto it = byExpiration.begin(); it != end; ++it)
+                expired.push_back({it->id, it->expiration, it->repeatInterval,
+                                   it->slack, std::move(it->callback), it->running});
             byExpiration.erase(byExpiration.begin(), end);
             for (const auto& event : expired) {
+                if (lag_)
+                    lag_->record(static_cast<uint64_t>(now - event.expiration));
                 // Reinsert if repeating, do this before executing callbacks
-                // so the callbacks have a chance to call erase
+                // so the callbacks have a chance to call erase. The callback
+                // is given back once it has run.
                 if (event.repeatInterval >= 0) {
                     timeouts_.insert({event.id,
-                                     now + event.repeatInterval,
+                                     coalesce(now + event.repeatInterval, event.slack),
                                      event.repeatInterval,
-                                     event.callback});
+                                     event.slack,
+                                     Callback(),
+                                     true});
                 }
             }
 
             // Call callbacks
-            for (const auto& event : expired) {
-                event.callback(event.id, now);
+            for (std::size_t i = 0; i < expired.size(); i++) {
+                auto& event = expired[i];
+                // its callback is run by an outer run*() (this is a nested
+                // one, called from a callback)
+                if (event.running)
+                    continue;
+                try {
+                    COMMON_TRACE_SCOPE("TimeoutQueue callback");
+                    event.callback(event.id, now);
+                } catch (...) {
+                    // the events after this one did not run: keep them for
+                    // the next run
+                    give_back(event);
+                    for (std::size_t j = i + 1; j < expired.size(); j++)
+                        restore(expired[j]);
+                    throw;
+                }
+                give_back(event);
             }
             nextExp = next_expiration();
+            expired.clear();
+            expired_.swap(expired);
         } while (!onceOnly && nextExp <= now);
         return nextExp;
     }
+
+    // expiration in [expiration, expiration + slack] shared with other events
+    int64_t coalesce(int64_t expiration, int64_t slack) const
+    {
+        if (slack <= 0)
+            return expiration;
+        auto& byExpiration = timeouts_.template get<BY_EXPIRATION>();
+        auto it = byExpiration.lower_bound(expiration);
+        if (it != byExpiration.end() && it->expiration - expiration <= slack)
+            return it->expiration;
+        const int64_t granularity = int64_t(1) << (63 - __builtin_clzll(uint64_t(slack) + 1));
+        const int64_t last = expiration + slack;
+        return last - ((last % granularity) + granularity) % granularity;
+    }
+
+    static void check_callback(const Callback& callback)
+    {
+        if (!callback)
+            throw std::invalid_argument("TimeoutQueue: empty callback");
+    }
+
+    // give the callback of a repeating event back to its rescheduled copy,
+    // unless the callback erased it
+    void give_back(Event& event)
+    {
+        if (event.repeatInterval < 0 || event.running)
+            return;
+        auto& byId = timeouts_.template get<BY_ID>();
+        auto it = byId.find(event.id);
+        if (it != byId.end() && it->running) {
+            it->callback = std::move(event.callback);
+            it->running  = false;
+        }
+    }
+
+    // put back an expired event whose callback did not run, with its
+    // expiration so that it runs on the next call
+    void restore(Event& event)
+    {
+        if (event.running)
+            return;
+        if (event.repeatInterval < 0) {
+            timeouts_.insert({event.id, event.expiration, -1, event.slack,
+                              std::move(event.callback)});
+            return;
+        }
+        auto& byId = timeouts_.template get<BY_ID>();
+        auto it = byId.find(event.id);
+        if (it != byId.end() && it->running) {
+            byId.modify(it, [&](Event& e)
+                {
+                    e.expiration = event.expiration;
+                    e.callback   = std::move(event.callback);
+                    e.running    = false;
+                });
+        }
+    }
 };
 
+using TimeoutQueue = BasicTimeoutQueue<>;
+
 } /* namespace common */
@@ -0,0 +1,387 @@
+/**
+ * Lightweight tracing of scoped spans, exported in the Chrome trace event
+ * format (chrome://tracing, https://ui.perfetto.dev).
+ *
+ *     void Stage::process()
+ *     {
+ *         COMMON_TRACE_SCOPE("Stage::process");
+ *         ...
+ *     }
+ *
+ *     common::trace::Tracer::instance().enable();
+ *     ...
+ *     std::ofstream f("trace.json");
+ *     common::trace::Tracer::instance().write_chrome_trace(f);
+ *
+ * Each thread records its spans in its own ring buffer (the oldest spans are
+ * overwritten when it is full), so recording takes no lock. A buffer takes 32
+ * bytes per span, 2 MB with the default capacity (see set_buffer_capacity()),
+ * and is released after its thread exits (see set_max_exited_buffers()). When
+ * tracing is
+ * disabled a span costs a relaxed atomic load; defining COMMON_TRACE_DISABLED
+ * compiles the spans out.
+ *
+ * Span names must outlive the tracer: use string literals, or intern().
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace common {
+namespace trace {
+
+inline int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Ring buffer of the spans of one thread. Written by its thread only, read
+ * concurrently by the exporter.
+ */
+class ThreadBuffer
+{
+public:
+    struct Span
+    {
+        const char * name;
+        int64_t      start_ns;
+        int64_t      duration_ns;
+    };
+
+    ThreadBuffer(std::size_t capacity, int64_t tid):
+        slots_(round_up_pow2(capacity)), mask_(slots_.size() - 1), tid_(tid) {}
+
+    void record(const char * name, int64_t start_ns, int64_t duration_ns)
+    {
+        const uint64_t head = head_.load(std::memory_order_relaxed);
+        Slot& s = slots_[head & mask_];
+        // seqlock: the slot is tagged with the position of its span once
+        // complete, and with 0 while being written. The fields are released
+        // (rather than fenced, which ThreadSanitizer does not support) so that
+        // a reader seeing one of them also sees the 0 tag.
+        s.seq.store(0, std::memory_order_relaxed);
+        s.name.store(name, std::memory_order_release);
+        s.start_ns.store(start_ns, std::memory_order_release);
+        s.duration_ns.store(duration_ns, std::memory_order_release);
+        s.seq.store(head + 1, std::memory_order_release);
+        head_.store(head + 1, std::memory_order_release);
+    }
+
+    /**
+     * Copy the spans currently in the buffer, oldest first. Spans being
+     * written or overwritten by the writer during the copy are dropped.
+     */
+    std::vector<Span> spans() const
+    {
+        const uint64_t head  = head_.load(std::memory_order_acquire);
+        const uint64_t first = std::max(first_.load(std::memory_order_relaxed),
+                                        head > slots_.size() ? head - slots_.size() : 0);
+        std::vector<Span> out;
+        out.reserve(head - std::min(first, head));
+        for (uint64_t i = first; i < head; i++) {
+            const Slot& s = slots_[i & mask_];
+            if (s.seq.load(std::memory_order_acquire) != i + 1)
+                continue;
+            // acquire so that the fields are read before the tag is checked
+            // again, which fails if any of them was rewritten
+            const Span span {s.name.load(std::memory_order_acquire),
+                             s.start_ns.load(std::memory_order_acquire),
+                             s.duration_ns.load(std::memory_order_acquire)};
+            if (s.seq.load(std::memory_order_relaxed) == i + 1)
+                out.push_back(span);
+        }
+        return out;
+    }
+
+    /**
+     * Drop the spans recorded so far. May be called from any thread.
+     */
+    void clear() {first_.store(head_.load(std::memory_order_acquire), std::memory_order_relaxed);}
+
+    bool empty() const
+    {
+        return first_.load(std::memory_order_relaxed) == head_.load(std::memory_order_acquire);
+    }
+
+    int64_t     tid()  const {return tid_;}
+    std::string name() const
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        return name_;
+    }
+    void set_name(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        name_ = name;
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<uint64_t>    seq {0};
+        std::atomic<const char*> name {nullptr};
+        std::atomic<int64_t>     start_ns {0};
+        std::atomic<int64_t>     duration_ns {0};
+    };
+
+    static std::size_t round_up_pow2(std::size_t n)
+    {
+        std::size_t p = 1;
+        while (p < n)
+            p <<= 1;
+        return p;
+    }
+
+    std::vector<Slot>     slots_;
+    const uint64_t        mask_;
+    std::atomic<uint64_t> head_ {0};
+    std::atomic<uint64_t> first_ {0};
+    const int64_t         tid_;
+    std::string           name_;
+    mutable std::mutex    mutex_;
+};
+
+/**
+ * Process wide collection of the thread buffers.
+ */
+class Tracer
+{
+public:
+    static Tracer& instance()
+    {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    void enable()        {enabled_.store(true, std::memory_order_relaxed);}
+    void disable()       {enabled_.store(false, std::memory_order_relaxed);}
+    bool enabled() const {return enabled_.load(std::memory_order_relaxed);}
+
+    /**
+     * Number of spans kept per thread, for the buffers created afterwards.
+     */
+    void set_buffer_capacity(std::size_t capacity) {capacity_ = capacity;}
+
+    /**
+     * Number of buffers of exited threads kept for the export, the oldest
+     * being released first.
+     */
+    void set_max_exited_buffers(std::size_t n)
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        max_exited_ = n;
+        release_exited();
+    }
+
+    /**
+     * Buffer of the calling thread, created on first use. When its thread
+     * exits, the buffer is kept so that its spans can still be exported, until
+     * it is cleared or more than max_exited_buffers threads exited after it.
+     */
+    ThreadBuffer& thread_buffer()
+    {
+        thread_local ThreadHandle handle;
+        if (!handle.buffer) {
+            auto b = std::make_shared<ThreadBuffer>(capacity_.load(), ::syscall(SYS_gettid));
+            std::lock_guard<std::mutex> lk(mutex_);
+            buffers_.push_back(b);
+            handle.buffer = b.get();
+        }
+        return *handle.buffer;
+    }
+
+    /**
+     * Name of the calling thread in the exported trace.
+     */
+    void set_thread_name(const std::string& name) {thread_buffer().set_name(name);}
+
+    /**
+     * Return a pointer to a copy of s that lives as long as the process, to be
+     * used as a span name.
+     */
+    const char * intern(const std::string& s)
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        return strings_.insert(s).first->c_str();
+    }
+
+    /**
+     * Drop the recorded spans, and release the buffers of the exited threads.
+     */
+    void clear()
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        for (auto& b: buffers_)
+            b->clear();
+        for (auto b: exited_)
+            remove(b);
+        exited_.clear();
+    }
+
+    /**
+     * Write every recorded span as a Chrome trace event json document.
+     */
+    void write_chrome_trace(std::ostream& os) const
+    {
+        std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            buffers = buffers_;
+        }
+
+        const auto pid = ::getpid();
+        bool first = true;
+        auto separator = [&] {os << (first ? "\n" : ",\n"); first = false;};
+
+        os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        for (const auto& b: buffers) {
+            const auto name = b->name();
+            if (!name.empty()) {
+                separator();
+                os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+                   << ",\"tid\":" << b->tid() << ",\"args\":{\"name\":";
+                write_string(os, name.c_str());
+                os << "}}";
+            }
+            for (const auto& s: b->spans()) {
+                separator();
+                os << "{\"name\":";
+                write_string(os, s.name);
+                os << ",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << b->tid()
+                   << ",\"ts\":" << s.start_ns / 1000 << '.' << pad3(s.start_ns % 1000)
+                   << ",\"dur\":" << s.duration_ns / 1000 << '.' << pad3(s.duration_ns % 1000)
+                   << '}';
+            }
+        }
+        os << "\n]}\n";
+    }
+
+private:
+    Tracer() = default;
+
+    // releases the buffer of a thread when it exits
+    struct ThreadHandle
+    {
+        ~ThreadHandle()
+        {
+            if (buffer)
+                Tracer::instance().thread_exited(buffer);
+        }
+
+        ThreadBuffer * buffer = nullptr;
+    };
+
+    void thread_exited(ThreadBuffer * buffer)
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        if (buffer->empty()) {
+            remove(buffer);
+            return;
+        }
+        exited_.push_back(buffer);
+        release_exited();
+    }
+
+    void release_exited()
+    {
+        while (exited_.size() > max_exited_) {
+            remove(exited_.front());
+            exited_.pop_front();
+        }
+    }
+
+    // the buffer is freed once the exports using it are done
+    void remove(const ThreadBuffer * buffer)
+    {
+        buffers_.erase(std::find_if(buffers_.begin(), buffers_.end(),
+                                    [&](const auto& b) {return b.get() == buffer;}));
+    }
+
+    static std::string pad3(int64_t v)
+    {
+        char buf[8];
+        std::snprintf(buf, sizeof(buf), "%03d", static_cast<int>(v));
+        return buf;
+    }
+
+    static void write_string(std::ostream& os, const char * s)
+    {
+        os << '"';
+        for (; s && *s; s++) {
+            const unsigned char c = *s;
+            if (c == '"' || c == '\\') {
+                os << '\\' << c;
+            } else if (c < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                os << buf;
+            } else {
+                os << c;
+            }
+        }
+        os << '"';
+    }
+
+    std::atomic_bool                           enabled_ {false};
+    std::atomic<std::size_t>                   capacity_ {1 << 16};
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers_;
+    std::deque<ThreadBuffer*>                  exited_;     // oldest first
+    std::size_t                                max_exited_ = 16;
+    std::set<std::string>                      strings_;
+    mutable std::mutex                         mutex_;
+};
+
+/**
+ * Record a span covering the lifetime of the object, if tracing was enabled
+ * when it was created and name is not null.
+ */
+class Scope
+{
+public:
+    explicit Scope(const char * name):
+        name_(Tracer::instance().enabled() ? name : nullptr),
+        start_ns_(name_ ? now_ns() : 0) {}
+
+    ~Scope()
+    {
+        if (name_)
+            Tracer::instance().thread_buffer().record(name_, start_ns_, now_ns() - start_ns_);
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+private:
+    const char * name_;
+    int64_t      start_ns_;
+};
+
+} /* namespace trace */
+} /* namespace common */
+
+#define COMMON_TRACE_CONCAT_(a, b) a##b
+#define COMMON_TRACE_CONCAT(a, b) COMMON_TRACE_CONCAT_(a, b)
+
+#ifndef COMMON_TRACE_DISABLED
+#define COMMON_TRACE_SCOPE(name) \
+    common::trace::Scope COMMON_TRACE_CONCAT(common_trace_scope_, __LINE__)(name)
+#else
+#define COMMON_TRACE_SCOPE(name) do {} while (0)
+#endif
@@ -1,67 +1,234 @@
 #ifndef WAIT_QUEUE_H
 #define WAIT_QUEUE_H
 
-#include <queue>
+#include <deque>
+#include <memory>
 #include <thread>
 #include <mutex>
-#include <condition_variable>
+#include <chrono>
+#include <optional>
+#include <utility>
+
+#include "metrics.h"
+#include "sync.h"
+#include "waiter.h"
 
 namespace common
 {
 
-template <typename T>
-class WaitQueue
+/**
+ * FIFO order of a WaitQueue.
+ */
+template<typename T, typename Allocator = std::allocator<T>>
+class FifoPolicy
+{
+public:
+    FifoPolicy() = default;
+    explicit FifoPolicy(const Allocator& alloc): queue_(alloc) {}
+
+    template<typename U>
+    void push(U&& elt) {queue_.push_back(std::forward<U>(elt));}
+
+    T pop()
+    {
+        T elt = std::move(queue_.front());
+        queue_.pop_front();
+        return elt;
+    }
+
+    bool   empty() const {return queue_.empty();}
+    size_t size()  const {return queue_.size();}
+
+private:
+    std::deque<T, Allocator> queue_;
+};
+
+/**
+ * Blocking queue, the order of the elements being given by Policy.
+ *
+ * A policy stores the elements: push(elt, args...) (args being the extra
+ * arguments of BasicWaitQueue::push), pop() removing and returning the next
+ * element, empty() and size(). The arguments of the constructor are
+ * forwarded to the policy.
+ */
+template <typename T, typename Policy>
+class BasicWaitQueue
 {
 public:
+    BasicWaitQueue() = default;
+    template<typename... Args>
+    explicit BasicWaitQueue(Args&&... args): queue_(std::forward<Args>(args)...) {}
 
     T pop()
     {
-        std::unique_lock<std::mutex> lk(mutex_);
+        std::unique_lock<Mutex> lk(mutex_);
 
-        cond_.wait(lk, [&] {return !queue_.empty();});
+        wait_not_empty(lk);
 
-        auto elt = queue_.front();
-        queue_.pop();
+        auto elt = queue_.pop();
+        update_depth();
         return elt;
     }
 
     void pop(T& elt)
     {
-        std::unique_lock<std::mutex> lk(mutex_);
+        std::unique_lock<Mutex> lk(mutex_);
+
+        wait_not_empty(lk);
 
-        cond_.wait(lk, [&] {return !queue_.empty();});
+        elt = queue_.pop();
+        update_depth();
+    }
+
+    /**
+     * Pop an element if one is available, without blocking.
+     */
+    bool try_pop(T& elt)
+    {
+        std::unique_lock<Mutex> lk(mutex_);
+        if (queue_.empty())
+            return false;
+        elt = queue_.pop();
+        update_depth();
+        return true;
+    }
 
-        elt = queue_.front();
-        queue_.pop();
+    /**
+     * Same as try_pop(T&), for element types that are not default
+     * constructible. Return nullopt if the queue is empty.
+     */
+    std::optional<T> try_pop()
+    {
+        std::unique_lock<Mutex> lk(mutex_);
+        if (queue_.empty())
+            return std::nullopt;
+        std::optional<T> elt(queue_.pop());
+        update_depth();
+        return elt;
     }
 
-    void push(const T& elt)
+    /**
+     * @param args extra arguments of the policy (priority, deadline, ...)
+     */
+    template<typename... Args>
+    void push(const T& elt, Args&&... args)
     {
         {
-            std::unique_lock<std::mutex> lk(mutex_);
-            queue_.push(elt);
+            std::unique_lock<Mutex> lk(mutex_);
+            queue_.push(elt, std::forward<Args>(args)...);
+            update_depth();
+            waiters_.notify_one();
         }
-        cond_.notify_all();
+        not_empty_.notify();
     }
 
-    void push(T&& elt)
+    template<typename... Args>
+    void push(T&& elt, Args&&... args)
     {
         {
-            std::unique_lock<std::mutex> lk(mutex_);
-            queue_.push(std::move(elt));
+            std::unique_lock<Mutex> lk(mutex_);
+            queue_.push(std::move(elt), std::forward<Args>(args)...);
+            update_depth();
+            waiters_.notify_one();
         }
-        cond_.notify_all();
+        not_empty_.notify();
+    }
+
+    size_t size() const
+    {
+        std::unique_lock<Mutex> lk(mutex_);
+        return queue_.size();
     }
 
-    size_t size()  {return queue_.size();}
-    bool   empty() {return queue_.empty();}
+    bool empty() const
+    {
+        std::unique_lock<Mutex> lk(mutex_);
+        return queue_.empty();
+    }
+
+    /**
+     * Report the number of queued elements to depth after each push / pop, and
+     * the time spent blocked in pop() (in ns, 0 when an element was available)
+     * to wait_time. Either can be null to disable it.
+     */
+    void set_metrics(metrics::Gauge * depth, metrics::Histogram * wait_time)
+    {
+        std::unique_lock<Mutex> lk(mutex_);
+        depth_     = depth;
+        wait_time_ = wait_time;
+        update_depth();
+    }
+
+    /**
+     * Notify w after each push, until it is unsubscribed.
+     */
+    void subscribe(Waiter * w)
+    {
+        std::unique_lock<Mutex> lk(mutex_);
+        waiters_.add(w);
+    }
+
+    /**
+     * Subscribe w if the queue is empty, atomically. Return false, without
+     * subscribing, if an element is available.
+     *
+     * w is a one-shot consumer: it is notified by one push only, and each push
+     * notifies only one of the waiters subscribed this way.
+     */
+    bool subscribe_if_empty(Waiter * w)
+    {
+        std::unique_lock<Mutex> lk(mutex_);
+        if (!queue_.empty())
+            return false;
+        waiters_.add_exclusive(w);
+        return true;
+    }
+
+    void unsubscribe(Waiter * w)
+    {
+        std::unique_lock<Mutex> lk(mutex_);
+        waiters_.remove(w);
+    }
 
 private:
-    std::queue<T>           queue_;
-    std::mutex              mutex_;
-    std::condition_variable cond_;
+    void wait_not_empty(std::unique_lock<Mutex>& lk)
+    {
+        if (!wait_time_) {
+            not_empty_.wait(lk, [&] {return !queue_.empty();});
+            return;
+        }
+        if (!queue_.empty()) {
+            wait_time_->record(0);
+            return;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        not_empty_.wait(lk, [&] {return !queue_.empty();});
+        wait_time_->record(std::chrono::steady_clock::now() - start);
+    }
+
+    void update_depth()
+    {
+        if (depth_)
+            depth_->set(queue_.size());
+    }
+
+    Policy                  queue_;
+    mutable Mutex           mutex_;
+    EventCount              not_empty_;
+    WaiterList              waiters_;
+
+    metrics::Gauge        * depth_     = nullptr;
+    metrics::Histogram    * wait_time_ = nullptr;
 };
 
+/**
+ * Blocking FIFO queue.
+ *
+ * @param Allocator allocator of the underlying deque (e.g. PoolAllocator<T>)
+ */
+template <typename T, typename Allocator = std::allocator<T>>
+using WaitQueue = BasicWaitQueue<T, FifoPolicy<T, Allocator>>;
+
 } /* namespace common */
 
 #endif /* WAIT_QUEUE_H */
@@ -0,0 +1,91 @@
+/**
+ * Subscription of an object to the changes of a WaitQueue or an EventMngr, for
+ * the components waiting on several sources at once (EventLoop, ...).
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+namespace common {
+
+/**
+ * notify() is called each time the source changes (push, event notified),
+ * with the lock of the source held: it must not block nor call back into the
+ * source. Returning false unsubscribes the waiter.
+ */
+class Waiter
+{
+public:
+    virtual ~Waiter() = default;
+    virtual bool notify() = 0;
+};
+
+/**
+ * Waiters subscribed to a source, protected by the lock of the source.
+ *
+ * Exclusive waiters are one-shot (their notify() returns false) and wait for
+ * a change that only one of them can consume, such as an element pushed to a
+ * queue: notify_one() wakes only the oldest one, so that a push does not wake
+ * every waiting consumer.
+ */
+class WaiterList
+{
+public:
+    void add(Waiter * w)           {waiters_.push_back(w);}
+    void add_exclusive(Waiter * w) {exclusive_.push_back(w);}
+
+    void remove(Waiter * w)
+    {
+        waiters_.erase(std::remove(waiters_.begin(), waiters_.end(), w), waiters_.end());
+        exclusive_.erase(std::remove(exclusive_.begin(), exclusive_.end(), w), exclusive_.end());
+    }
+
+    /**
+     * Notify every waiter.
+     */
+    void notify()
+    {
+        notify_shared();
+        while (!exclusive_.empty()) {
+            Waiter * w = exclusive_.front();
+            exclusive_.pop_front();
+            w->notify();
+        }
+    }
+
+    /**
+     * Notify the non exclusive waiters and the oldest exclusive one.
+     */
+    void notify_one()
+    {
+        notify_shared();
+        if (!exclusive_.empty()) {
+            Waiter * w = exclusive_.front();
+            exclusive_.pop_front();
+            w->notify();
+        }
+    }
+
+    bool empty() const {return waiters_.empty() && exclusive_.empty();}
+
+private:
+    void notify_shared()
+    {
+        for (std::size_t i = 0; i < waiters_.size();) {
+            if (waiters_[i]->notify()) {
+                i++;
+            } else {
+                waiters_[i] = waiters_.back();
+                waiters_.pop_back();
+            }
+        }
+    }
+
+    std::vector<Waiter*> waiters_;
+    std::deque<Waiter*>  exclusive_;
+};
+
+} /* namespace common */
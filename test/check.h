@@ -0,0 +1,52 @@
+/**
+ * Minimal helpers of the unit tests: CHECK aborts the test with the failed
+ * condition, run_tests runs a table of test functions and reports them.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+
+#define CHECK(cond)                                                             \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            std::exit(1);                                                       \
+        }                                                                       \
+    } while (0)
+
+#define CHECK_THROWS(expr, exception)                                           \
+    do {                                                                        \
+        bool thrown_ = false;                                                   \
+        try {                                                                   \
+            static_cast<void>(expr);                                            \
+        } catch (const exception&) {                                            \
+            thrown_ = true;                                                     \
+        }                                                                       \
+        if (!thrown_) {                                                         \
+            std::fprintf(stderr, "%s:%d: %s did not throw %s\n", __FILE__, __LINE__, \
+                         #expr, #exception);                                    \
+            std::exit(1);                                                       \
+        }                                                                       \
+    } while (0)
+
+struct TestCase
+{
+    const char * name;
+    void (*run)();
+};
+
+template<std::size_t N>
+int run_tests(const TestCase (&tests)[N])
+{
+    for (const auto& t: tests) {
+        const auto start = std::chrono::steady_clock::now();
+        t.run();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::printf("%-24s ok (%.3fs)\n", t.name, elapsed.count());
+    }
+    return 0;
+}
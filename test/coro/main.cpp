@@ -0,0 +1,218 @@
+/**
+ * Unit test of the coroutine awaitables, run on a ThreadPool: many
+ * coroutines suspended and resumed concurrently on events, queues, state
+ * changes and timers. Build with -DCOMMON_STRESS_TSAN=ON to run it under
+ * ThreadSanitizer.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "common/coro.h"
+
+using namespace common;
+
+namespace {
+
+const int nb_coroutines = 64;
+const int nb_threads    = 4;
+
+coro::Task<int> add(int a, int b)
+{
+    co_return a + b;
+}
+
+coro::Task<int> sum_to(int n)
+{
+    int sum = 0;
+    for (int i = 1; i <= n; i++)
+        sum = co_await add(sum, i);
+    co_return sum;
+}
+
+coro::Task<> fail()
+{
+    throw std::runtime_error("fail");
+    co_return;
+}
+
+// coroutines are free functions taking their state as parameters: the
+// captures of a lambda coroutine would not outlive its first suspension
+coro::Task<> run_tasks(WaitQueue<int>& results)
+{
+    results.push(co_await sum_to(100));
+    try {
+        co_await fail();
+    } catch (const std::runtime_error&) {
+        results.push(-1);
+    }
+}
+
+void test_task()
+{
+    WaitQueue<int> results;
+    coro::ThreadPool pool(nb_threads);
+    coro::spawn(pool, run_tasks(results));
+    CHECK(results.pop() == 5050);
+    CHECK(results.pop() == -1);
+}
+
+const int rounds = 2000;
+
+coro::Task<> wait_events(EventMngr<int>& events, WaitQueue<int>& acks, int e)
+{
+    for (int r = 0; r < rounds; r++) {
+        co_await coro::wait(events, e);
+        events.erase(e);
+        acks.push(e);
+    }
+}
+
+// each coroutine waits for its own event, the driver notifies all of them at
+// once then waits for their acknowledgements, for many rounds
+void test_event_wait()
+{
+    EventMngr<int> events;
+    WaitQueue<int> acks;
+    coro::ThreadPool pool(nb_threads);
+    for (int i = 0; i < nb_coroutines; i++)
+        coro::spawn(pool, wait_events(events, acks, i));
+
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < nb_coroutines; i++)
+            events.notify(i);
+        std::vector<int> acked(nb_coroutines, 0);
+        for (int i = 0; i < nb_coroutines; i++)
+            acked[acks.pop()]++;
+        for (int i = 0; i < nb_coroutines; i++)
+            CHECK(acked[i] == 1);
+    }
+    CHECK(acks.empty());
+}
+
+// not default constructible, move only
+struct Message
+{
+    explicit Message(int64_t v): v(std::make_unique<int64_t>(v)) {}
+    std::unique_ptr<int64_t> v;
+};
+
+coro::Task<> consume(WaitQueue<Message>& queue, WaitQueue<int64_t>& sums)
+{
+    int64_t sum = 0;
+    for (;;) {
+        Message m = co_await coro::pop(queue);
+        if (*m.v < 0)
+            break;
+        sum += *m.v;
+    }
+    sums.push(sum);
+}
+
+// coroutines consuming from a queue fed by threads
+void test_queue_pop()
+{
+    const int64_t per_producer = 20000;
+
+    WaitQueue<Message> queue;
+    WaitQueue<int64_t> sums;
+    coro::ThreadPool   pool(nb_threads);
+    for (int i = 0; i < nb_coroutines; i++)
+        coro::spawn(pool, consume(queue, sums));
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < nb_threads; p++)
+        producers.emplace_back([&]
+            {
+                for (int64_t k = 1; k <= per_producer; k++)
+                    queue.push(Message(k));
+            });
+    for (auto& t: producers)
+        t.join();
+    for (int i = 0; i < nb_coroutines; i++)
+        queue.push(Message(-1));
+
+    int64_t total = 0;
+    for (int i = 0; i < nb_coroutines; i++)
+        total += sums.pop();
+    CHECK(total == nb_threads * per_producer * (per_producer + 1) / 2);
+    CHECK(queue.empty());
+}
+
+enum class St {a, b};
+
+coro::Task<> wait_state(Statemachine<St>& sm, WaitQueue<int>& done)
+{
+    co_await coro::wait(sm, St::b);
+    done.push(1);
+}
+
+void test_statemachine_wait()
+{
+    std::atomic<bool> go {false};
+    Statemachine<St> sm("coro", {
+            {"a", St::a, {{St::b, [&]
+                {
+                    return go ? transition_status::goto_next_state :
+                                transition_status::stay_curr_state;
+                }}}},
+            {"b", St::b, {}},
+        }, St::a);
+
+    WaitQueue<int> done;
+    coro::ThreadPool pool(nb_threads);
+    for (int i = 0; i < nb_coroutines; i++)
+        coro::spawn(pool, wait_state(sm, done));
+    sm.wakeup();
+    CHECK(done.empty());
+    go = true;
+    sm.wakeup();
+    for (int i = 0; i < nb_coroutines; i++)
+        done.pop();
+}
+
+coro::Task<> sleep(TimeoutQueue& timer, std::atomic<int64_t>& now,
+                   WaitQueue<int64_t>& woken, int64_t delay)
+{
+    co_await coro::sleep_for(timer, 0, delay);
+    woken.push(now);
+}
+
+// coroutines sleeping on a TimeoutQueue run by another thread
+void test_sleep()
+{
+    TimeoutQueue         timer;
+    WaitQueue<int64_t>   woken;
+    std::atomic<int64_t> now {0};
+    coro::ThreadPool     pool(nb_threads);
+    for (int i = 0; i < nb_coroutines; i++)
+        coro::spawn(pool, sleep(timer, now, woken, 10 + i));
+
+    // every coroutine is resumed once its delay has passed
+    for (int i = 0; i < nb_coroutines; i++) {
+        while (timer.next_expiration() != 10 + i)
+            std::this_thread::yield();
+        now = 10 + i;
+        timer.run_once(now);
+        CHECK(woken.pop() == 10 + i);
+    }
+}
+
+} /* namespace */
+
+int main()
+{
+    const TestCase tests[] = {
+        {"task",              test_task},
+        {"event_wait",        test_event_wait},
+        {"queue_pop",         test_queue_pop},
+        {"statemachine_wait", test_statemachine_wait},
+        {"sleep",             test_sleep},
+    };
+    return run_tests(tests);
+}
@@ -0,0 +1,292 @@
+/**
+ * Unit test of EventLoop: timers, fd watches, queue and event watches, and
+ * unwatch() racing with the handlers.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "check.h"
+#include "common/event_loop.h"
+
+using namespace common;
+using namespace std::chrono_literals;
+
+namespace {
+
+// run f(loop) on a running loop, stopped and joined on return
+template<typename F>
+void with_loop(F f)
+{
+    EventLoopThread t;
+    t.start(true);
+    f(t.loop());
+    t.stop();
+    t.join();
+}
+
+// wait until cond() holds, for at most 10s
+template<typename F>
+bool wait_until(F cond)
+{
+    const auto deadline = std::chrono::steady_clock::now() + 10s;
+    while (!cond()) {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(1ms);
+    }
+    return true;
+}
+
+void test_timers()
+{
+    with_loop([](EventLoop& loop)
+        {
+            std::atomic<int> once {0}, repeating {0}, cancelled {0};
+            std::vector<int> order;
+            std::mutex mutex;
+            auto record = [&](int i) {return [&, i](auto, auto)
+                {
+                    std::lock_guard<std::mutex> lk(mutex);
+                    order.push_back(i);
+                };};
+
+            loop.add_timer(30ms, record(3));
+            loop.add_timer(10ms, record(1));
+            loop.add_timer(20ms, 5ms, record(2));
+            loop.add_timer(5ms, [&](auto, auto) {once++;});
+            const auto r = loop.add_repeating_timer(5ms, [&](auto, auto) {repeating++;});
+            const auto c = loop.add_timer(20ms, [&](auto, auto) {cancelled++;});
+            CHECK(loop.cancel_timer(c));
+            CHECK(!loop.cancel_timer(c));
+
+            CHECK(wait_until([&] {return repeating >= 5;}));
+            CHECK(loop.cancel_timer(r));
+            CHECK(wait_until([&]
+                {
+                    std::lock_guard<std::mutex> lk(mutex);
+                    return order.size() == 3;
+                }));
+            const int n = repeating;
+            std::this_thread::sleep_for(30ms);
+            CHECK(repeating == n);
+            CHECK(once == 1);
+            CHECK(cancelled == 0);
+            CHECK((order == std::vector<int>{1, 2, 3}));
+        });
+}
+
+// a timer kept after another one of its batch threw, with the expiration on
+// which the timerfd already fired, runs at the next iteration
+void test_timer_after_throw()
+{
+    EventLoop loop;
+    bool fired = false;
+    // the second timer is coalesced with the first one
+    loop.add_timer(20ms, 0ms, [](auto, auto) {throw std::runtime_error("timer");});
+    loop.add_timer(20ms, 1000ms, [&](auto, auto) {fired = true;});
+
+    bool thrown = false;
+    const auto deadline = std::chrono::steady_clock::now() + 10s;
+    while (!thrown && std::chrono::steady_clock::now() < deadline) {
+        try {
+            loop.run_once(100);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+    }
+    CHECK(thrown && !fired);
+    const auto start = std::chrono::steady_clock::now();
+    loop.run_once(5000);
+    CHECK(fired);
+    CHECK(std::chrono::steady_clock::now() - start < 1s);
+}
+
+void test_fd()
+{
+    int fds[2];
+    CHECK(::pipe(fds) == 0);
+    with_loop([&](EventLoop& loop)
+        {
+            std::string received;
+            std::atomic<std::size_t> size {0};
+            loop.add_fd(fds[0], EPOLLIN, [&](uint32_t events)
+                {
+                    CHECK(events & EPOLLIN);
+                    char buf[64];
+                    const auto n = ::read(fds[0], buf, sizeof(buf));
+                    CHECK(n > 0);
+                    received.append(buf, n);
+                    size = received.size();
+                });
+            for (const char * s: {"hello", " ", "world"})
+                CHECK(::write(fds[1], s, std::strlen(s)) > 0);
+            CHECK(wait_until([&] {return size == 11;}));
+
+            // runs in the loop thread, after the handler
+            std::atomic<bool> checked {false};
+            loop.post([&] {CHECK(received == "hello world"); checked = true;});
+            CHECK(wait_until([&] {return checked.load();}));
+
+            loop.remove_fd(fds[0]);
+            CHECK(::write(fds[1], "x", 1) == 1);
+            std::this_thread::sleep_for(20ms);
+            CHECK(size == 11);
+        });
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+// not default constructible
+struct Message
+{
+    explicit Message(int v): v(v) {}
+    int v;
+};
+
+void test_queue_watch()
+{
+    const int nb_producers = 4;
+    const int per_producer = 10000;
+
+    WaitQueue<Message> queue;
+    // queued before the watch
+    queue.push(Message(-1));
+    with_loop([&](EventLoop& loop)
+        {
+            std::atomic<int64_t> sum {0};
+            std::atomic<int> count {0};
+            std::vector<int> last(nb_producers, -1);
+            loop.watch(queue, [&](Message m)
+                {
+                    if (m.v >= 0) {
+                        // in order per producer
+                        const int p = m.v / per_producer;
+                        CHECK(m.v > last[p]);
+                        last[p] = m.v;
+                        sum += m.v;
+                    }
+                    count++;
+                });
+
+            std::vector<std::thread> producers;
+            for (int p = 0; p < nb_producers; p++)
+                producers.emplace_back([&, p]
+                    {
+                        for (int i = 0; i < per_producer; i++)
+                            queue.push(Message(p * per_producer + i));
+                    });
+            for (auto& t: producers)
+                t.join();
+
+            const int total = nb_producers * per_producer;
+            CHECK(wait_until([&] {return count == total + 1;}));
+            CHECK(sum == int64_t(total) * (total - 1) / 2);
+            CHECK(queue.empty());
+        });
+}
+
+void test_event_watch()
+{
+    EventMngr<int> events;
+    with_loop([&](EventLoop& loop)
+        {
+            std::atomic<int> fired {0};
+            loop.watch(events, 1, [&](int e) {CHECK(e == 1); fired++;});
+            events.notify(2);
+            events.notify(1);
+            CHECK(wait_until([&] {return fired == 1;}));
+            // erased before the handler, the other event is left
+            CHECK(!events.contains(1));
+            CHECK(events.contains(2));
+            events.notify(1);
+            CHECK(wait_until([&] {return fired == 2;}));
+        });
+}
+
+// a queue destroyed right after unwatch() from another thread, while its
+// handler runs: the handler is not running anymore and is never called again
+void test_unwatch()
+{
+    with_loop([](EventLoop& loop)
+        {
+            for (int round = 0; round < 200; round++) {
+                auto queue = std::make_unique<WaitQueue<int>>();
+                std::atomic<bool> in_handler {false};
+                std::atomic<bool> unwatched {false};
+                std::atomic<int>  calls {0};
+                const auto id = loop.watch(*queue, [&, q = queue.get()](int)
+                    {
+                        CHECK(!unwatched);
+                        in_handler = true;
+                        calls++;
+                        if (round % 2)
+                            std::this_thread::sleep_for(std::chrono::microseconds(50));
+                        CHECK(q->size() < 1000000);
+                        in_handler = false;
+                    });
+                for (int i = 0; i < 100; i++)
+                    queue->push(i);
+                if (round % 4 == 0)
+                    wait_until([&] {return calls > 0;});
+                CHECK(loop.unwatch(id));
+                CHECK(!in_handler);
+                unwatched = true;
+                CHECK(!loop.unwatch(id));
+                queue.reset();
+            }
+        });
+}
+
+// a handler unwatching its own watch is not called with the next elements
+void test_unwatch_from_handler()
+{
+    WaitQueue<int> queue;
+    with_loop([&](EventLoop& loop)
+        {
+            std::atomic<int> calls {0};
+            EventLoop::WatchId id = 0;
+            std::atomic<bool> ready {false};
+            loop.post([&]
+                {
+                    id = loop.watch(queue, [&](int)
+                        {
+                            calls++;
+                            CHECK(loop.unwatch(id));
+                        });
+                    ready = true;
+                });
+            CHECK(wait_until([&] {return ready.load();}));
+            for (int i = 0; i < 10; i++)
+                queue.push(i);
+            CHECK(wait_until([&] {return calls == 1;}));
+            std::this_thread::sleep_for(20ms);
+            CHECK(calls == 1);
+            CHECK(queue.size() == 9);
+        });
+}
+
+} /* namespace */
+
+int main()
+{
+    const TestCase tests[] = {
+        {"timers",               test_timers},
+        {"timer_after_throw",    test_timer_after_throw},
+        {"fd",                   test_fd},
+        {"queue_watch",          test_queue_watch},
+        {"event_watch",          test_event_watch},
+        {"unwatch",              test_unwatch},
+        {"unwatch_from_handler", test_unwatch_from_handler},
+    };
+    return run_tests(tests);
+}
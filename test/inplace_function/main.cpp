@@ -0,0 +1,156 @@
+/**
+ * Unit test of InplaceFunction: void and non-void signatures, move-only
+ * callables, and the lifetime of the stored callable.
+ */
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "check.h"
+#include "common/inplace_function.h"
+#include "common/timeout_queue.h"
+
+using namespace common;
+
+namespace {
+
+int twice(int x) {return 2 * x;}
+
+struct Adder
+{
+    int base;
+    int add(int x) const {return base + x;}
+};
+
+// counts its live instances
+struct Tracked
+{
+    static inline int alive = 0;
+
+    Tracked() {alive++;}
+    Tracked(Tracked&& other) noexcept: calls(other.calls) {alive++;}
+    ~Tracked() {alive--;}
+
+    int operator()(int x) {return x + ++calls;}
+
+    int calls = 0;
+};
+
+void test_non_void()
+{
+    InplaceFunction<int(int)> f = [](int x) {return x + 1;};
+    CHECK(f(1) == 2);
+
+    f = twice;
+    CHECK(f(4) == 8);
+
+    // the result converts to R
+    InplaceFunction<long(int)> g = [](int x) {return static_cast<short>(x);};
+    CHECK(g(7) == 7L);
+
+    InplaceFunction<int(const Adder&, int)> m = &Adder::add;
+    CHECK(m(Adder{10}, 5) == 15);
+
+    InplaceFunction<std::string(std::string, std::string&&)> cat =
+        [](std::string a, std::string&& b) {return a + b;};
+    CHECK(cat("a", std::string("b")) == "ab");
+}
+
+void test_void()
+{
+    int v = 0;
+    InplaceFunction<void(int)> f = [&v](int x) {v += x;};
+    f(3);
+    CHECK(v == 3);
+
+    // a callable returning a value is accepted, its result discarded
+    InplaceFunction<void(int)> g = [](int x) {return x + 1;};
+    g(1);
+    InplaceFunction<void(int)> h = twice;
+    h(1);
+
+    int by_ref = 0;
+    InplaceFunction<void(int&)> r = [](int& x) {x = 42;};
+    r(by_ref);
+    CHECK(by_ref == 42);
+}
+
+void test_move_only()
+{
+    auto p = std::make_unique<int>(5);
+    InplaceFunction<int()> f = [p = std::move(p)] {return *p;};
+    CHECK(f() == 5);
+
+    InplaceFunction<int()> g = std::move(f);
+    CHECK(!f);
+    CHECK(g() == 5);
+
+    InplaceFunction<void(std::unique_ptr<int>)> sink = [](std::unique_ptr<int> q) {*q = 0;};
+    sink(std::make_unique<int>(1));
+
+    // move-only callbacks of a TimeoutQueue, run once then destroyed
+    BasicTimeoutQueue<std::allocator<void>, InplaceFunctionOf> queue;
+    int fired = 0;
+    queue.add(0, 1, [&fired, q = std::make_unique<int>(7)](int64_t, int64_t) {fired += *q;});
+    queue.run_once(1);
+    CHECK(fired == 7);
+}
+
+void test_empty()
+{
+    InplaceFunction<int(int)> f;
+    CHECK(!f);
+    CHECK(f == nullptr);
+    CHECK_THROWS(f(1), std::bad_function_call);
+
+    int (*null_fn)(int) = nullptr;
+    InplaceFunction<int(int)> g = null_fn;
+    CHECK(!g);
+
+    InplaceFunction<void()> h = nullptr;
+    CHECK_THROWS(h(), std::bad_function_call);
+    h = [] {};
+    CHECK(h != nullptr);
+    h = nullptr;
+    CHECK(!h);
+}
+
+void test_lifetime()
+{
+    {
+        InplaceFunction<int(int)> f = Tracked();
+        CHECK(Tracked::alive == 1);
+        // the state of the callable is kept between calls
+        CHECK(f(0) == 1);
+        CHECK(f(0) == 2);
+
+        InplaceFunction<int(int)> g = std::move(f);
+        CHECK(Tracked::alive == 1);
+        CHECK(g(0) == 3);
+
+        f = std::move(g);
+        CHECK(Tracked::alive == 1);
+        f = [](int x) {return x;};
+        CHECK(Tracked::alive == 0);
+
+        g = Tracked();
+        CHECK(Tracked::alive == 1);
+    }
+    CHECK(Tracked::alive == 0);
+}
+
+} /* namespace */
+
+int main()
+{
+    const TestCase tests[] = {
+        {"non_void",  test_non_void},
+        {"void",      test_void},
+        {"move_only", test_move_only},
+        {"empty",     test_empty},
+        {"lifetime",  test_lifetime},
+    };
+    return run_tests(tests);
+}
@@ -0,0 +1,315 @@
+/**
+ * Unit test of Journal, PersistentWaitQueue and PersistentTimeoutQueue:
+ * replay after a restart, recovery of a torn or corrupted tail, and
+ * compactions running while the queue is used.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "common/journal.h"
+
+using namespace common;
+
+namespace {
+
+using Records = std::vector<std::pair<uint32_t, std::string>>;
+
+struct TmpPath
+{
+    explicit TmpPath(const char * name):
+        path("/tmp/common_test_journal_" + std::string(name) + "." + std::to_string(::getpid()))
+    {
+        std::remove(path.c_str());
+    }
+    ~TmpPath()
+    {
+        std::remove(path.c_str());
+        std::remove((path + ".compact").c_str());
+    }
+
+    std::string path;
+};
+
+Records records(Journal& journal)
+{
+    Records out;
+    journal.replay([&](uint32_t type, const char * data, std::size_t size)
+        {
+            out.emplace_back(type, std::string(data, size));
+        });
+    return out;
+}
+
+void append(Journal& journal, uint32_t type, const std::string& payload)
+{
+    journal.append(type, payload.data(), payload.size());
+}
+
+void overwrite(const std::string& path, std::size_t offset, char c)
+{
+    int fd = ::open(path.c_str(), O_WRONLY);
+    CHECK(fd >= 0);
+    CHECK(::pwrite(fd, &c, 1, offset) == 1);
+    ::close(fd);
+}
+
+void test_replay()
+{
+    TmpPath tmp("replay");
+    {
+        Journal journal(tmp.path, 64);     // grows while appending
+        append(journal, 1, "a");
+        append(journal, 2, "");
+        append(journal, 3, std::string(1000, 'c'));
+        journal.sync();
+    }
+    Journal journal(tmp.path);
+    CHECK((records(journal) == Records{{1, "a"}, {2, ""}, {3, std::string(1000, 'c')}}));
+}
+
+void test_corrupted_tail()
+{
+    TmpPath tmp("corrupted");
+    std::size_t end_a, end_b;
+    {
+        Journal journal(tmp.path);
+        append(journal, 1, "a");
+        end_a = journal.size();
+        append(journal, 1, "b");
+        end_b = journal.size();
+        append(journal, 1, "c");
+    }
+    // flip the payload of b: b and the records after it are discarded
+    overwrite(tmp.path, end_b - 1, 'x');
+    {
+        Journal journal(tmp.path);
+        CHECK((records(journal) == Records{{1, "a"}}));
+        CHECK(journal.size() == end_a);
+        append(journal, 1, "d");
+    }
+    // the records appended after the recovery are valid
+    Journal journal(tmp.path);
+    CHECK((records(journal) == Records{{1, "a"}, {1, "d"}}));
+}
+
+void test_torn_tail()
+{
+    TmpPath tmp("torn");
+    std::size_t end_a;
+    {
+        Journal journal(tmp.path);
+        append(journal, 1, "a");
+        end_a = journal.size();
+        append(journal, 1, std::string(100, 'b'));
+    }
+    // crash in the middle of the write of b
+    CHECK(::truncate(tmp.path.c_str(), end_a + 20) == 0);
+    {
+        Journal journal(tmp.path);
+        CHECK((records(journal) == Records{{1, "a"}}));
+        append(journal, 1, "c");
+    }
+    Journal journal(tmp.path);
+    CHECK((records(journal) == Records{{1, "a"}, {1, "c"}}));
+}
+
+void test_not_a_journal()
+{
+    TmpPath tmp("invalid");
+    {
+        Journal journal(tmp.path);
+    }
+    overwrite(tmp.path, 0, 'x');
+    CHECK_THROWS(Journal(tmp.path), std::runtime_error);
+}
+
+void test_wait_queue_replay()
+{
+    TmpPath tmp("wait_queue");
+    {
+        Journal journal(tmp.path);
+        PersistentWaitQueue<std::string> queue(journal);
+        for (int i = 0; i < 10; i++)
+            queue.push(std::to_string(i));
+        for (int i = 0; i < 4; i++)
+            CHECK(queue.pop() == std::to_string(i));
+        journal.sync();
+    }
+    {
+        Journal journal(tmp.path);
+        PersistentWaitQueue<std::string> queue(journal);
+        CHECK(queue.size() == 6);
+        CHECK(queue.pop() == "4");
+    }
+    Journal journal(tmp.path);
+    PersistentWaitQueue<std::string> queue(journal);
+    CHECK(queue.size() == 5);
+    for (int i = 5; i < 10; i++)
+        CHECK(queue.pop() == std::to_string(i));
+}
+
+// a journal holding only the live records is not rewritten on startup
+void test_no_compaction_on_startup()
+{
+    TmpPath tmp("startup");
+    {
+        Journal journal(tmp.path);
+        PersistentWaitQueue<int64_t> queue(journal);
+        queue.push(1);
+        queue.push(2);
+    }
+    {
+        Journal journal(tmp.path);
+        PersistentWaitQueue<int64_t> queue(journal);
+        CHECK(journal.compactions() == 0);
+        CHECK(queue.size() == 2);
+        CHECK(queue.pop() == 1);
+    }
+
+    // the pop record and the push it cancels are reclaimed
+    Journal journal(tmp.path);
+    PersistentWaitQueue<int64_t> queue(journal);
+    CHECK(journal.compactions() == 1);
+    CHECK(queue.size() == 1);
+    CHECK(records(journal).size() == 1);
+}
+
+// producers and consumers going through background compactions
+void test_concurrent_compaction()
+{
+    const int64_t nb_threads   = 2;
+    const int64_t per_producer = 20000;
+    const int64_t left         = 10;     // per consumer
+
+    TmpPath tmp("compaction");
+    int64_t sum = 0;
+    {
+        Journal journal(tmp.path, 4096);
+        PersistentWaitQueue<int64_t> queue(journal, 4096);
+        std::atomic<int64_t> consumed_sum {0};
+        std::vector<std::thread> threads;
+        for (int64_t t = 0; t < nb_threads; t++) {
+            threads.emplace_back([&]
+                {
+                    for (int64_t i = 1; i <= per_producer; i++)
+                        queue.push(i);
+                });
+            threads.emplace_back([&]
+                {
+                    for (int64_t i = 0; i < per_producer - left; i++)
+                        consumed_sum += queue.pop();
+                    journal.sync();
+                });
+        }
+        for (auto& t: threads)
+            t.join();
+        journal.wait_compaction();
+        CHECK(queue.size() == size_t(nb_threads * left));
+        sum = nb_threads * per_producer * (per_producer + 1) / 2 - consumed_sum;
+        CHECK(journal.compactions() >= 1);
+    }
+
+    // whatever the compactions left, the restart reclaims everything but the
+    // pushes of the queued elements (12 bytes of header per record)
+    Journal journal(tmp.path);
+    PersistentWaitQueue<int64_t> queue(journal);
+    CHECK(journal.size() == 8 + size_t(nb_threads * left) * (12 + 8));
+    CHECK(queue.size() == size_t(nb_threads * left));
+    int64_t restored = 0;
+    while (!queue.empty())
+        restored += queue.pop();
+    CHECK(restored == sum);
+}
+
+// the journal is compacted again only once it doubled since the last
+// compaction
+void test_compaction_threshold()
+{
+    TmpPath tmp("threshold");
+    Journal journal(tmp.path);
+    PersistentWaitQueue<std::string> queue(journal, 0);
+    const std::string elt(100, 'x');        // 112 bytes records
+    for (int i = 0; i < 100; i++)
+        queue.push(elt);
+    // the journal (8 bytes when opened) is compacted by the first pop
+    queue.pop();
+    journal.wait_compaction();
+    const std::size_t compacted = journal.size();
+    CHECK(compacted == 8 + 99 * 112);
+    CHECK(journal.compactions() == 1);
+    CHECK(!journal.needs_compaction(0));
+
+    // a push and a pop append 124 bytes: no compaction until the size doubled
+    while (journal.size() + 124 <= 2 * compacted) {
+        queue.push(elt);
+        queue.pop();
+    }
+    journal.wait_compaction();
+    CHECK(journal.compactions() == 1);
+    queue.push(elt);
+    queue.pop();
+    journal.wait_compaction();
+    CHECK(journal.compactions() == 2);
+    CHECK(journal.size() == compacted);
+}
+
+void test_timeout_queue_replay()
+{
+    TmpPath tmp("timeout_queue");
+    std::vector<std::pair<PersistentTimeoutQueue::Id, std::string>> fired;
+    auto handler = [&](PersistentTimeoutQueue::Id id, int64_t, const std::string& payload)
+        {
+            fired.emplace_back(id, payload);
+        };
+
+    PersistentTimeoutQueue::Id a, b, r;
+    {
+        Journal journal(tmp.path);
+        PersistentTimeoutQueue timers(journal, handler);
+        a = timers.add(0, 10, "a");
+        b = timers.add(0, 20, "b");
+        r = timers.add_repeating(0, 5, "r");
+        timers.add(0, 30, "erased");
+        CHECK(timers.erase(r + 1));
+        CHECK(timers.run_once(10) == 15);   // a done
+        CHECK((fired == decltype(fired){{r, "r"}, {a, "a"}}));
+    }
+
+    fired.clear();
+    Journal journal(tmp.path);
+    PersistentTimeoutQueue timers(journal, handler);
+    CHECK(timers.size() == 2);
+    // the repeating timer fires at the first run, b at its expiration
+    timers.run_once(20);
+    CHECK((fired == decltype(fired){{r, "r"}, {b, "b"}}));
+    // ids are not reused
+    CHECK(timers.add(20, 10, "c") > r + 1);
+}
+
+} /* namespace */
+
+int main()
+{
+    const TestCase tests[] = {
+        {"replay",                  test_replay},
+        {"corrupted_tail",          test_corrupted_tail},
+        {"torn_tail",               test_torn_tail},
+        {"not_a_journal",           test_not_a_journal},
+        {"wait_queue_replay",       test_wait_queue_replay},
+        {"no_compaction_on_startup", test_no_compaction_on_startup},
+        {"concurrent_compaction",   test_concurrent_compaction},
+        {"compaction_threshold",    test_compaction_threshold},
+        {"timeout_queue_replay",    test_timeout_queue_replay},
+    };
+    return run_tests(tests);
+}
@@ -0,0 +1,259 @@
+/**
+ * Unit test of the binary json encoding: MsgpackWriter output decoded back,
+ * and frames split across arbitrary chunks by StreamDecoder.
+ */
+
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "common/json_binary.h"
+
+using namespace common;
+
+namespace app {
+
+struct Point
+{
+    int32_t x;
+    int32_t y;
+};
+COMMON_JSON_BIND(Point, x, y)
+
+struct Message
+{
+    uint64_t                       id;
+    std::string                    name;
+    std::vector<Point>             path;
+    std::map<std::string, double>  weights;
+    std::optional<int64_t>         parent;
+    std::vector<int64_t>           ints;
+    std::vector<uint64_t>          uints;
+    float                          f;
+    bool                           flag;
+    json                           extra;
+};
+COMMON_JSON_BIND(Message, id, name, path, weights, parent, ints, uints, f, flag, extra)
+
+} /* namespace app */
+
+namespace {
+
+// a message crossing the size classes of the MessagePack encoding
+app::Message make_message(uint64_t id)
+{
+    app::Message m;
+    m.id   = id;
+    m.name = std::string(id % 300, 'n');
+    for (int i = 0; i < int(id % 20); i++)
+        m.path.push_back({i, -i * 1000});
+    for (int i = 0; i < int(id % 18); i++)
+        m.weights["w" + std::to_string(i)] = i / 4.0;
+    if (id % 2)
+        m.parent = -int64_t(id);
+    m.ints  = {0, -1, -32, -33, -128, -129, -32768, -32769, std::numeric_limits<int32_t>::min(),
+               int64_t(std::numeric_limits<int32_t>::min()) - 1, std::numeric_limits<int64_t>::min(),
+               127, 128, std::numeric_limits<int64_t>::max()};
+    m.uints = {0, 127, 128, 255, 256, 65535, 65536, 0xffffffff, 0x100000000,
+               std::numeric_limits<uint64_t>::max()};
+    m.f     = 1.5f;
+    m.flag  = id % 3 == 0;
+    m.extra = {{"k", json::array({1, "two", nullptr})}};
+    return m;
+}
+
+void check_equal(const app::Message& a, const app::Message& b)
+{
+    CHECK(a.id == b.id);
+    CHECK(a.name == b.name);
+    CHECK(a.path.size() == b.path.size());
+    for (std::size_t i = 0; i < a.path.size(); i++)
+        CHECK(a.path[i].x == b.path[i].x && a.path[i].y == b.path[i].y);
+    CHECK(a.weights == b.weights);
+    CHECK(a.parent == b.parent);
+    CHECK(a.ints == b.ints);
+    CHECK(a.uints == b.uints);
+    CHECK(a.f == b.f);
+    CHECK(a.flag == b.flag);
+    CHECK(a.extra == b.extra);
+}
+
+void test_writer_round_trip()
+{
+    MsgpackWriter writer;
+    for (uint64_t id: {0ull, 1ull, 17ull, 255ull, 299ull, 65536ull}) {
+        const auto m = make_message(id);
+        const Bytes& bytes = writer.encode(m);
+        check_equal(decode<app::Message>(bytes.data(), bytes.size()), m);
+
+        // same document as the one encoded by nlohmann
+        const json j = decode(bytes, BinaryFormat::msgpack);
+        CHECK(j["name"] == m.name);
+        CHECK(j["path"].size() == m.path.size());
+        CHECK(j["parent"].is_null() == !m.parent);
+        CHECK(decode(json::to_msgpack(j), BinaryFormat::msgpack) == j);
+    }
+
+    // long strings and containers
+    const std::string s(70000, 's');
+    CHECK(decode(writer.encode(s), BinaryFormat::msgpack) == s);
+    const std::vector<int64_t> v(70000, -5);
+    CHECK(decode(writer.encode(v), BinaryFormat::msgpack) == json(v));
+    std::map<std::string, int> big;
+    for (int i = 0; i < 70000; i++)
+        big[std::to_string(i)] = i;
+    CHECK(decode(writer.encode(big), BinaryFormat::msgpack) == json(big));
+}
+
+void test_writer_reuse()
+{
+    // the buffer is replaced by encode() and accumulated by append_frame()
+    MsgpackWriter writer;
+    writer.encode(make_message(299));
+    const auto size = writer.buffer().size();
+    CHECK(writer.encode(int64_t(1)).size() == 1);
+    CHECK(writer.encode(make_message(299)).size() == size);
+
+    writer.clear();
+    writer.append_frame(int64_t(1));
+    writer.append_frame(std::string("ab"));
+    CHECK(writer.buffer().size() == 4 + 1 + 4 + 3);
+}
+
+// frames of several encoders, fed in chunks of the given size
+void check_stream(std::size_t chunk, std::mt19937& rng)
+{
+    const int nb_messages = 50;
+
+    MsgpackWriter writer;
+    for (int i = 0; i < nb_messages; i++)
+        writer.append_frame(make_message(i));
+    const Bytes& bytes = writer.buffer();
+
+    StreamDecoder decoder;
+    std::vector<json> decoded;
+    std::size_t pos = 0;
+    while (pos < bytes.size()) {
+        const auto n = std::min(bytes.size() - pos, chunk ? chunk : 1 + rng() % 300);
+        decoder.feed(&bytes[pos], n);
+        pos += n;
+        json j;
+        while (decoder.next(j))
+            decoded.push_back(std::move(j));
+    }
+    CHECK(decoder.pending() == 0);
+    CHECK(int(decoded.size()) == nb_messages);
+    for (int i = 0; i < nb_messages; i++) {
+        app::Message m;
+        common::bind(decoded[i], m);
+        check_equal(m, make_message(i));
+    }
+}
+
+void test_stream_decoder()
+{
+    std::mt19937 rng(42);
+    for (std::size_t chunk: {1, 3, 4, 5, 64, 4096, 1 << 20})
+        check_stream(chunk, rng);
+    for (int i = 0; i < 10; i++)
+        check_stream(0, rng);
+}
+
+void test_stream_decoder_cbor()
+{
+    BinaryEncoder encoder(BinaryFormat::cbor);
+    for (int i = 0; i < 10; i++)
+        encoder.append_frame(json{{"i", i}, {"s", std::string(i * 10, 'x')}});
+
+    StreamDecoder decoder(BinaryFormat::cbor);
+    const Bytes& bytes = encoder.buffer();
+    int n = 0;
+    json j;
+    for (std::size_t i = 0; i < bytes.size(); i++) {
+        decoder.feed(&bytes[i], 1);
+        if (decoder.next(j)) {
+            CHECK(j["i"] == n);
+            CHECK(j["s"].get<std::string>().size() == std::size_t(n) * 10);
+            n++;
+        }
+        CHECK(!decoder.next(j));
+    }
+    CHECK(n == 10);
+}
+
+void test_stream_decoder_partial()
+{
+    MsgpackWriter writer;
+    writer.append_frame(std::string("hello"));
+    const Bytes bytes = writer.buffer();
+
+    StreamDecoder decoder;
+    json j;
+    // incomplete header, then incomplete payload
+    decoder.feed(bytes.data(), 3);
+    CHECK(!decoder.next(j));
+    decoder.feed(bytes.data() + 3, bytes.size() - 4);
+    CHECK(!decoder.next(j));
+    CHECK(decoder.pending() == bytes.size() - 1);
+    decoder.feed(bytes.data() + bytes.size() - 1, 1);
+    CHECK(decoder.next(j));
+    CHECK(j == "hello");
+
+    // a malformed payload throws, the following frames still decode
+    const uint8_t bad[] = {2, 0, 0, 0, 0xc1, 0xc1};
+    decoder.feed(bad, sizeof(bad));
+    decoder.feed(bytes.data(), bytes.size());
+    CHECK_THROWS(decoder.next(j), json::parse_error);
+    CHECK(decoder.next(j));
+    CHECK(j == "hello");
+    CHECK(decoder.pending() == 0);
+}
+
+void test_stream_decoder_frame_size()
+{
+    // an empty frame ending the buffer
+    const uint8_t empty[] = {0, 0, 0, 0};
+    StreamDecoder decoder(BinaryFormat::msgpack, 8);
+    decoder.feed(empty, sizeof(empty));
+    std::size_t size = 1;
+    CHECK(decoder.next_frame(size) != nullptr);
+    CHECK(size == 0 && decoder.pending() == 0);
+
+    // the largest frame accepted
+    const uint8_t max[] = {8, 0, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8};
+    decoder.feed(max, sizeof(max));
+    const uint8_t * payload = decoder.next_frame(size);
+    CHECK(payload && size == 8 && payload[7] == 8);
+
+    // a larger one is rejected once its header is received
+    const uint8_t large[] = {9, 0, 0, 0};
+    decoder.feed(large, sizeof(large));
+    CHECK_THROWS(decoder.next_frame(size), std::length_error);
+    json j;
+    CHECK_THROWS(decoder.next(j), std::length_error);
+
+    const uint8_t huge[] = {0xff, 0xff, 0xff, 0xff};
+    StreamDecoder defaults;
+    defaults.feed(huge, sizeof(huge));
+    CHECK_THROWS(defaults.next(j), std::length_error);
+}
+
+} /* namespace */
+
+int main()
+{
+    const TestCase tests[] = {
+        {"writer_round_trip",         test_writer_round_trip},
+        {"writer_reuse",              test_writer_reuse},
+        {"stream_decoder",            test_stream_decoder},
+        {"stream_decoder_cbor",       test_stream_decoder_cbor},
+        {"stream_decoder_partial",    test_stream_decoder_partial},
+        {"stream_decoder_frame_size", test_stream_decoder_frame_size},
+    };
+    return run_tests(tests);
+}
@@ -0,0 +1,244 @@
+/**
+ * Unit test of the typed json binding: bound values, the paths reported by
+ * bind_error and the reload of a ConfigHandle read concurrently.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "check.h"
+#include "common/json_bind.h"
+
+using namespace common;
+
+namespace app {
+
+struct Endpoint
+{
+    std::string host;
+    uint16_t    port;
+};
+COMMON_JSON_BIND(Endpoint, host, port)
+
+struct Config
+{
+    std::string                    name;
+    std::vector<Endpoint>          servers;
+    std::map<std::string, int32_t> limits;
+    std::optional<double>          ratio;
+    bool                           verbose;
+};
+COMMON_JSON_BIND(Config, name, servers, limits, ratio, verbose)
+
+// bound through its nlohmann serializer
+struct Level
+{
+    int value;
+};
+
+inline void from_json(const json& j, Level& l)
+{
+    l.value = j.at("value").get<int>();
+}
+
+struct Logging
+{
+    Level level;
+};
+COMMON_JSON_BIND(Logging, level)
+
+// invariant checked by the concurrent readers: b == 2 * a
+struct Pair
+{
+    int64_t a;
+    int64_t b;
+};
+COMMON_JSON_BIND(Pair, a, b)
+
+} /* namespace app */
+
+namespace {
+
+json config_json()
+{
+    return json::parse(R"({
+        "name": "test",
+        "servers": [{"host": "a", "port": 80}, {"host": "b", "port": 8080}],
+        "limits": {"conn": 10, "rate": -1},
+        "verbose": true
+    })");
+}
+
+// path of the bind_error thrown binding j, or "" if none
+template<typename T>
+std::string error_path(const json& j)
+{
+    try {
+        common::bind<T>(j);
+    } catch (const bind_error& e) {
+        // the message starts with the path
+        CHECK(std::string(e.what()).rfind(e.path + ": ", 0) == 0);
+        return e.path;
+    }
+    return "";
+}
+
+void test_bind()
+{
+    const auto c = common::bind<app::Config>(config_json());
+    CHECK(c.name == "test");
+    CHECK(c.servers.size() == 2);
+    CHECK(c.servers[1].host == "b");
+    CHECK(c.servers[1].port == 8080);
+    CHECK(c.limits.at("rate") == -1);
+    CHECK(!c.ratio);
+    CHECK(c.verbose);
+
+    auto j = config_json();
+    j["ratio"] = 0.5;
+    CHECK(common::bind<app::Config>(j).ratio == 0.5);
+    j["ratio"] = nullptr;
+    CHECK(!common::bind<app::Config>(j).ratio);
+
+    CHECK(common::bind<app::Logging>(json::parse(R"({"level": {"value": 3}})")).level.value == 3);
+}
+
+void test_bind_errors()
+{
+    auto j = config_json();
+    j.erase("verbose");
+    CHECK(error_path<app::Config>(j) == "$.verbose");
+
+    j = config_json();
+    j["servers"][1].erase("port");
+    CHECK(error_path<app::Config>(j) == "$.servers[1].port");
+
+    j = config_json();
+    j["servers"][1]["port"] = "80";
+    CHECK(error_path<app::Config>(j) == "$.servers[1].port");
+
+    // out of the range of uint16_t, negative into an unsigned
+    j["servers"][1]["port"] = 65536;
+    CHECK(error_path<app::Config>(j) == "$.servers[1].port");
+    j["servers"][1]["port"] = -1;
+    CHECK(error_path<app::Config>(j) == "$.servers[1].port");
+
+    j = config_json();
+    j["limits"]["rate"] = int64_t(1) << 40;
+    CHECK(error_path<app::Config>(j) == "$.limits.rate");
+
+    j = config_json();
+    j["servers"] = json::object();
+    CHECK(error_path<app::Config>(j) == "$.servers");
+    j["servers"] = json::array({1});
+    CHECK(error_path<app::Config>(j) == "$.servers[0]");
+
+    j = config_json();
+    j["ratio"] = "half";
+    CHECK(error_path<app::Config>(j) == "$.ratio");
+    j["ratio"] = 1;
+    CHECK(error_path<app::Config>(j) == "");
+    j["verbose"] = 1;
+    CHECK(error_path<app::Config>(j) == "$.verbose");
+
+    CHECK(error_path<app::Config>(json::array()) == "$");
+
+    // the errors of a nlohmann serializer are reported with their path
+    CHECK(error_path<app::Logging>(json::parse(R"({"level": {}})")) == "$.level");
+
+    try {
+        common::bind<app::Config>(json::object());
+        CHECK(false);
+    } catch (const bind_error& e) {
+        CHECK(std::string(e.what()) == "$.name: missing field");
+    }
+}
+
+void test_config_reload()
+{
+    ConfigHandle<app::Config> handle(config_json());
+    CHECK(handle.version() == 0);
+    CHECK(handle.read()->name == "test");
+
+    auto j = config_json();
+    j["name"] = "next";
+    handle.reload(j);
+    CHECK(handle.version() == 1);
+    CHECK(handle.read()->name == "next");
+
+    // a document that does not bind leaves the current config in place
+    j["servers"][0]["port"] = "x";
+    CHECK_THROWS(handle.reload(j), bind_error);
+    CHECK(handle.version() == 1);
+    CHECK(handle.read()->name == "next");
+    CHECK(handle.read()->servers[0].port == 80);
+
+    char tmpl[] = "/tmp/common_test_json_bind.XXXXXX";
+    const int fd = ::mkstemp(tmpl);
+    CHECK(fd >= 0);
+    ::close(fd);
+    const std::string path = tmpl;
+    j = config_json();
+    j["name"] = "file";
+    std::ofstream(path) << j.dump();
+    handle.reload(path);
+    CHECK(handle.version() == 2);
+    CHECK(handle.read()->name == "file");
+
+    ::unlink(path.c_str());
+    CHECK_THROWS(handle.reload(path), bind_error);
+    CHECK(handle.version() == 2);
+}
+
+// readers never see a torn or freed config while it is reloaded
+void test_config_concurrent_reload()
+{
+    const int64_t reloads = 2000;
+
+    ConfigHandle<app::Pair> handle(json{{"a", 0}, {"b", 0}});
+    std::atomic<bool> done {false};
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; i++) {
+        readers.emplace_back([&]
+            {
+                int64_t last = 0;
+                while (!done) {
+                    auto guard = handle.read();
+                    CHECK(guard->b == 2 * guard->a);
+                    // the versions seen by a reader do not go backward
+                    CHECK(guard->a >= last);
+                    last = guard->a;
+                }
+            });
+    }
+    for (int64_t k = 1; k <= reloads; k++)
+        handle.reload(json{{"a", k}, {"b", 2 * k}});
+    done = true;
+    for (auto& t: readers)
+        t.join();
+    CHECK(handle.version() == uint64_t(reloads));
+    CHECK(handle.read()->a == reloads);
+}
+
+} /* namespace */
+
+int main()
+{
+    const TestCase tests[] = {
+        {"bind",                     test_bind},
+        {"bind_errors",              test_bind_errors},
+        {"config_reload",            test_config_reload},
+        {"config_concurrent_reload", test_config_concurrent_reload},
+    };
+    return run_tests(tests);
+}
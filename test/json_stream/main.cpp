@@ -0,0 +1,228 @@
+/**
+ * Unit test of the streaming json parsing, on complete and truncated input,
+ * from mapped files and from pipes.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "check.h"
+#include "common/json_stream.h"
+
+using namespace common;
+
+namespace {
+
+const std::string array     = R"([1, {"a": [2, 3]}, "x", [4]])";
+const std::string truncated = R"([1, {"a": [2, 3]}, "x", [4)";
+
+// temporary file holding content, removed on destruction
+struct TmpFile
+{
+    explicit TmpFile(const std::string& content)
+    {
+        char tmpl[] = "/tmp/common_test_json_stream.XXXXXX";
+        const int fd = ::mkstemp(tmpl);
+        CHECK(fd >= 0);
+        CHECK(::write(fd, content.data(), content.size()) == ssize_t(content.size()));
+        ::close(fd);
+        path = tmpl;
+    }
+
+    ~TmpFile() {::unlink(path.c_str());}
+
+    std::string path;
+};
+
+// read end of a pipe fed with content by a thread
+struct Pipe
+{
+    explicit Pipe(const std::string& content)
+    {
+        int fds[2];
+        CHECK(::pipe(fds) == 0);
+        fd = fds[0];
+        writer = std::thread([content, wfd = fds[1]]
+            {
+                // by small chunks, to cross the buffer boundaries
+                for (std::size_t i = 0; i < content.size(); i += 3)
+                    CHECK(::write(wfd, content.data() + i, std::min<std::size_t>(3, content.size() - i)) > 0);
+                ::close(wfd);
+            });
+    }
+
+    ~Pipe()
+    {
+        writer.join();
+        ::close(fd);
+    }
+
+    int         fd;
+    std::thread writer;
+};
+
+// records the SAX events as a string
+struct Recorder: json::json_sax_t
+{
+    bool null() override                                        {return add("n");}
+    bool boolean(bool) override                                 {return add("b");}
+    bool number_integer(number_integer_t v) override            {return add(std::to_string(v));}
+    bool number_unsigned(number_unsigned_t v) override          {return add(std::to_string(v));}
+    bool number_float(number_float_t, const string_t&) override {return add("f");}
+    bool string(string_t& s) override                           {return add(s);}
+    bool binary(binary_t&) override                             {return add("bin");}
+    bool start_object(std::size_t) override                     {return add("{");}
+    bool key(string_t& k) override                              {return add(k + ":");}
+    bool end_object() override                                  {return add("}");}
+    bool start_array(std::size_t) override                      {return add("[");}
+    bool end_array() override                                   {return add("]");}
+
+    bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception&) override
+    {
+        error = true;
+        return false;
+    }
+
+    bool add(const std::string& e)
+    {
+        events += e + " ";
+        return true;
+    }
+
+    std::string events;
+    bool        error = false;
+};
+
+const std::string array_events = "[ 1 { a: [ 2 3 ] } x [ 4 ] ] ";
+
+void test_elements_mapped()
+{
+    TmpFile f(array);
+    MappedFile file(f.path);
+    std::vector<json> elts;
+    CHECK(for_each_element(file, [&](json&& j) {elts.push_back(std::move(j));}) == 4);
+    CHECK(elts.size() == 4);
+    CHECK(elts[0] == 1);
+    CHECK(elts[1]["a"][1] == 3);
+    CHECK(elts[2] == "x");
+    CHECK(elts[3] == json::array({4}));
+}
+
+void test_elements_truncated()
+{
+    TmpFile f(truncated);
+    MappedFile file(f.path);
+    std::vector<json> elts;
+    CHECK_THROWS(for_each_element(file, [&](json&& j) {elts.push_back(std::move(j));}),
+                 json::parse_error);
+    // the complete elements are delivered before the error
+    CHECK(elts.size() == 3);
+    CHECK(elts[2] == "x");
+
+    // cut inside a string and right after the opening bracket
+    for (const char * content: {R"([1, "ab)", "[", ""}) {
+        TmpFile g(content);
+        MappedFile cut(g.path);
+        std::size_t n = 0;
+        CHECK_THROWS(for_each_element(cut, [&](json&&) {n++;}), std::exception);
+        CHECK(n <= 1);
+    }
+}
+
+void test_elements_pipe()
+{
+    {
+        Pipe p(array);
+        std::size_t n = 0;
+        CHECK(for_each_element(p.fd, [&](json&&) {n++;}) == 4);
+        CHECK(n == 4);
+    }
+    {
+        Pipe p(truncated);
+        std::size_t n = 0;
+        CHECK_THROWS(for_each_element(p.fd, [&](json&&) {n++;}), json::parse_error);
+        CHECK(n == 3);
+    }
+}
+
+void test_elements_stop()
+{
+    TmpFile f(array);
+    MappedFile file(f.path);
+    std::size_t n = 0;
+    // stopping early does not parse the rest, truncated or not
+    CHECK(for_each_element(file, [&](json&&) {return ++n < 2;}) == 2);
+    CHECK(n == 2);
+
+    TmpFile g(truncated);
+    MappedFile cut(g.path);
+    CHECK(for_each_element(cut, [&](json&&) {return false;}) == 1);
+}
+
+void test_elements_not_array()
+{
+    TmpFile f(R"({"a": 1})");
+    MappedFile file(f.path);
+    CHECK_THROWS(for_each_element(file, [](json&&) {}), std::invalid_argument);
+}
+
+void test_sax()
+{
+    {
+        TmpFile f(array);
+        MappedFile file(f.path);
+        Recorder r;
+        CHECK(sax_parse(file, &r));
+        CHECK(!r.error);
+        CHECK(r.events == array_events);
+    }
+    {
+        Pipe p(array);
+        Recorder r;
+        CHECK(sax_parse(p.fd, &r));
+        CHECK(r.events == array_events);
+    }
+}
+
+void test_sax_truncated()
+{
+    // the events before the truncation are delivered, then the error
+    const std::string prefix = "[ 1 { a: [ 2 3 ] } x [ 4 ";
+    {
+        TmpFile f(truncated);
+        MappedFile file(f.path);
+        Recorder r;
+        CHECK(!sax_parse(file, &r));
+        CHECK(r.error);
+        CHECK(r.events == prefix);
+    }
+    {
+        Pipe p(truncated);
+        Recorder r;
+        CHECK(!sax_parse(p.fd, &r));
+        CHECK(r.error);
+        CHECK(r.events == prefix);
+    }
+}
+
+} /* namespace */
+
+int main()
+{
+    const TestCase tests[] = {
+        {"elements_mapped",    test_elements_mapped},
+        {"elements_truncated", test_elements_truncated},
+        {"elements_pipe",      test_elements_pipe},
+        {"elements_stop",      test_elements_stop},
+        {"elements_not_array", test_elements_not_array},
+        {"sax",                test_sax},
+        {"sax_truncated",      test_sax_truncated},
+    };
+    return run_tests(tests);
+}
@@ -0,0 +1,211 @@
+/**
+ * Unit test of the metrics: the bucket math of the histograms, the accuracy
+ * of the percentiles, the merging of snapshots and shards, and the registry.
+ */
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "common/metrics.h"
+#include "common/metrics_registry.h"
+
+using namespace common;
+using Snapshot = metrics::HistogramSnapshot;
+
+namespace {
+
+// values to check: the small exact ones, and every bucket edge
+std::vector<uint64_t> edge_values()
+{
+    std::vector<uint64_t> values;
+    for (uint64_t v = 0; v < 64; v++)
+        values.push_back(v);
+    for (unsigned b = 4; b < 64; b++) {
+        const uint64_t p = uint64_t(1) << b;
+        for (uint64_t v: {p - 1, p, p + 1, p + p / 2, 2 * p - 1})
+            values.push_back(v);
+    }
+    values.push_back(std::numeric_limits<uint64_t>::max());
+    return values;
+}
+
+void test_bucket_index()
+{
+    // exact below sub_bucket_count, then sub_bucket_count buckets per power
+    // of two
+    for (uint64_t v = 0; v < Snapshot::sub_bucket_count; v++)
+        CHECK(Snapshot::bucket_index(v) == v);
+    CHECK(Snapshot::bucket_index(16) == 16);
+    CHECK(Snapshot::bucket_index(17) == 17);
+    CHECK(Snapshot::bucket_index(31) == 31);
+    CHECK(Snapshot::bucket_index(32) == 32);
+    CHECK(Snapshot::bucket_index(33) == 32);
+    CHECK(Snapshot::bucket_index(34) == 33);
+    CHECK(Snapshot::bucket_index(std::numeric_limits<uint64_t>::max()) == Snapshot::nb_buckets - 1);
+
+    // every value falls in [low, low + width) of its bucket
+    for (uint64_t v: edge_values()) {
+        const std::size_t i = Snapshot::bucket_index(v);
+        CHECK(i < Snapshot::nb_buckets);
+        CHECK(Snapshot::bucket_low(i) <= v);
+        CHECK(v - Snapshot::bucket_low(i) < Snapshot::bucket_width(i));
+    }
+
+    // the buckets are contiguous and increasing
+    for (std::size_t i = 0; i + 1 < Snapshot::nb_buckets; i++) {
+        CHECK(Snapshot::bucket_low(i) + Snapshot::bucket_width(i) == Snapshot::bucket_low(i + 1));
+        CHECK(Snapshot::bucket_index(Snapshot::bucket_low(i)) == i);
+        CHECK(Snapshot::bucket_index(Snapshot::bucket_low(i + 1) - 1) == i);
+    }
+    // and the width bounds the relative error
+    for (std::size_t i = Snapshot::sub_bucket_count; i < Snapshot::nb_buckets; i++)
+        CHECK(Snapshot::bucket_width(i) * Snapshot::sub_bucket_count <= Snapshot::bucket_low(i));
+}
+
+void test_percentile()
+{
+    metrics::Histogram h;
+    CHECK(h.snapshot().percentile(0.5) == 0);
+
+    // exact values
+    for (uint64_t v = 1; v <= 10; v++)
+        h.record(v);
+    auto s = h.snapshot();
+    CHECK(s.count == 10 && s.sum == 55 && s.min == 1 && s.max == 10);
+    CHECK(s.percentile(0) == 1);
+    CHECK(s.percentile(0.5) == 5);
+    CHECK(s.percentile(0.9) == 9);
+    CHECK(s.percentile(1) == 10);
+
+    // a value at the bottom edge of a bucket is reported as the top of its
+    // bucket, within 1 / sub_bucket_count, and clamped to max
+    for (uint64_t v: edge_values()) {
+        h.reset();
+        h.record(v);
+        h.record(Snapshot::bucket_low(Snapshot::bucket_index(v)));
+        s = h.snapshot();
+        const uint64_t p = s.percentile(0.5);
+        CHECK(p >= s.min && p <= s.max);
+        CHECK(p - s.min <= s.min / Snapshot::sub_bucket_count);
+        CHECK(s.percentile(1) == v);
+    }
+
+    // uniform values: every percentile within the relative error
+    h.reset();
+    for (uint64_t v = 1; v <= 100000; v++)
+        h.record(v);
+    s = h.snapshot();
+    for (double q: {0.01, 0.1, 0.5, 0.9, 0.99, 0.999}) {
+        const double expected = q * 100000;
+        const double p        = static_cast<double>(s.percentile(q));
+        CHECK(p >= expected - 1 && p <= expected * (1 + 1. / Snapshot::sub_bucket_count) + 1);
+    }
+}
+
+void test_merge()
+{
+    metrics::Histogram a, b, empty;
+    a.record(5);
+    a.record(1000);
+    b.record(3);
+    b.record(70000);
+
+    auto s = a.snapshot();
+    s.merge(empty.snapshot());
+    CHECK(s.count == 2 && s.min == 5 && s.max == 1000);
+
+    auto e = empty.snapshot();
+    e.merge(s);
+    CHECK(e.count == 2 && e.min == 5 && e.max == 1000 && e.sum == 1005);
+
+    s.merge(b.snapshot());
+    CHECK(s.count == 4);
+    CHECK(s.sum == 5 + 1000 + 3 + 70000);
+    CHECK(s.min == 3 && s.max == 70000);
+    CHECK(s.counts[Snapshot::bucket_index(3)] == 1);
+    CHECK(s.counts[Snapshot::bucket_index(1000)] == 1);
+    CHECK(s.percentile(0.25) == 3);
+    CHECK(s.percentile(1) == 70000);
+}
+
+// shards written by many threads are merged by snapshot()
+void test_shards()
+{
+    const int      nb_threads = 32;      // more than nb_shards
+    const uint64_t per_thread = 10000;
+
+    metrics::Histogram h;
+    metrics::Counter   c;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nb_threads; t++)
+        threads.emplace_back([&, t]
+            {
+                for (uint64_t i = 0; i < per_thread; i++) {
+                    h.record(t * per_thread + i);
+                    c.add(2);
+                }
+            });
+    for (auto& t: threads)
+        t.join();
+
+    const uint64_t n = nb_threads * per_thread;
+    const auto s = h.snapshot();
+    CHECK(s.count == n);
+    CHECK(s.sum == n * (n - 1) / 2);
+    CHECK(s.min == 0 && s.max == n - 1);
+    uint64_t total = 0;
+    for (auto v: s.counts)
+        total += v;
+    CHECK(total == n);
+    CHECK(c.value() == 2 * n);
+
+    h.reset();
+    c.reset();
+    CHECK(h.snapshot().count == 0 && c.value() == 0);
+}
+
+void test_registry()
+{
+    metrics::Registry registry;
+    registry.counter("requests").add(3);
+    registry.gauge("depth").set(-2);
+    registry.histogram("latency").record(100);
+    registry.gauge("pulled", [] {return int64_t(7);});
+    CHECK(&registry.counter("requests") == &registry.counter("requests"));
+
+    auto j = registry.snapshot();
+    CHECK(j["counters"]["requests"] == 3);
+    CHECK(j["gauges"]["depth"] == -2);
+    CHECK(j["gauges"]["pulled"] == 7);
+    CHECK(j["histograms"]["latency"]["count"] == 1);
+    CHECK(j["histograms"]["latency"]["p99"] == 100);
+
+    // a shared metric outlives its removal, and is no longer exported
+    auto requests = registry.counter_ptr("requests");
+    registry.remove("requests");
+    registry.remove("pulled");
+    requests->add();
+    CHECK(requests->value() == 4);
+    j = registry.snapshot();
+    CHECK(!j["counters"].contains("requests"));
+    CHECK(!j["gauges"].contains("pulled"));
+    CHECK(registry.counter("requests").value() == 0);
+}
+
+} /* namespace */
+
+int main()
+{
+    const TestCase tests[] = {
+        {"bucket_index", test_bucket_index},
+        {"percentile",   test_percentile},
+        {"merge",        test_merge},
+        {"shards",       test_shards},
+        {"registry",     test_registry},
+    };
+    return run_tests(tests);
+}
@@ -0,0 +1,286 @@
+/**
+ * Unit test of the pool and arena allocators: reuse of freed blocks, blocks
+ * freed by another thread than the one allocating them, and the fallbacks.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "common/pool.h"
+#include "common/wait_queue.h"
+
+using namespace common;
+
+namespace {
+
+bool aligned(const void * p, std::size_t align)
+{
+    return reinterpret_cast<uintptr_t>(p) % align == 0;
+}
+
+void test_size_class()
+{
+    CHECK(FixedSizePool::size_class(1) == 0);
+    CHECK(FixedSizePool::size_class(16) == 0);
+    CHECK(FixedSizePool::size_class(17) == 1);
+    CHECK(FixedSizePool::size_class(32) == 1);
+    CHECK(FixedSizePool::size_class(33) == 2);
+    CHECK(FixedSizePool::size_class(4096) == FixedSizePool::nb_classes - 1);
+    for (std::size_t cls = 0; cls < FixedSizePool::nb_classes; cls++)
+        CHECK(FixedSizePool::for_class(cls).block_size() == FixedSizePool::min_block_size << cls);
+    CHECK(&FixedSizePool::for_size(100) == &FixedSizePool::for_class(3));
+}
+
+void test_reuse()
+{
+    auto& pool = FixedSizePool::for_size(64);
+
+    // the last freed block is the next allocated
+    void * a = pool.allocate();
+    pool.deallocate(a);
+    CHECK(pool.allocate() == a);
+
+    // live blocks are distinct, aligned and writable, and are reused once
+    // freed, across refills and releases of the thread cache
+    std::set<void*> live;
+    for (int i = 0; i < 1000; i++) {
+        void * p = pool.allocate();
+        CHECK(aligned(p, alignof(std::max_align_t)));
+        CHECK(live.insert(p).second);
+        std::memset(p, 0xab, 64);
+    }
+    const std::set<void*> first = live;
+    for (void * p: live)
+        pool.deallocate(p);
+    live.clear();
+    // except for the blocks the thread cache held before (less than two
+    // batches of 64)
+    int reused = 0;
+    for (int i = 0; i < 1000; i++) {
+        void * p = pool.allocate();
+        live.insert(p);
+        reused += first.count(p);
+    }
+    CHECK(reused >= 1000 - 128);
+    for (void * p: live)
+        pool.deallocate(p);
+    pool.deallocate(a);
+}
+
+// blocks allocated by a producer and freed by a consumer thread: each one
+// is live in one place at a time, and the freed blocks are reused
+void test_cross_thread_free()
+{
+    const int nb_rounds = 20;
+    const int per_round = 5000;
+    auto&     pool      = FixedSizePool::for_size(128);
+
+    WaitQueue<uint64_t*> queue;
+    std::set<void*> freed;
+    std::thread consumer([&]
+        {
+            for (;;) {
+                uint64_t * p = queue.pop();
+                if (!p)
+                    return;
+                // written by the producer, intact until freed
+                for (int i = 0; i < 16; i++)
+                    CHECK(p[i] == p[0] + i);
+                freed.insert(p);
+                pool.deallocate(p);
+            }
+        });
+
+    std::thread producer([&]
+        {
+            uint64_t v = 0;
+            for (int r = 0; r < nb_rounds; r++) {
+                for (int k = 0; k < per_round; k++, v++) {
+                    auto * p = static_cast<uint64_t*>(pool.allocate());
+                    for (int i = 0; i < 16; i++)
+                        p[i] = v + i;
+                    queue.push(p);
+                }
+            }
+            queue.push(nullptr);
+        });
+    producer.join();
+    consumer.join();
+
+    // the blocks freed by the consumer went back to the shared list, a thread
+    // starting afresh takes them (and the less than 64 blocks the producer
+    // still cached when it exited)
+    std::thread([&]
+        {
+            std::vector<void*> blocks;
+            int reused = 0;
+            for (int i = 0; i < 1000; i++) {
+                blocks.push_back(pool.allocate());
+                reused += freed.count(blocks.back());
+            }
+            CHECK(reused >= 1000 - 64);
+            for (void * p: blocks)
+                pool.deallocate(p);
+        }).join();
+}
+
+// frees its block when destroyed, after the thread cache if it was
+// constructed before the cache
+struct LateFree
+{
+    ~LateFree()
+    {
+        if (block)
+            FixedSizePool::for_size(2048).deallocate(block);
+    }
+
+    void * block = nullptr;
+};
+
+// a block freed after the destruction of the thread cache goes to the shared
+// list, rather than to the destroyed cache where it would be lost
+void test_free_after_cache()
+{
+    auto& pool = FixedSizePool::for_size(2048);
+    void * late = nullptr;
+    std::thread([&]
+        {
+            thread_local LateFree holder;       // constructed before the cache
+            holder.block = pool.allocate();
+            late = holder.block;
+        }).join();
+
+    std::thread([&]
+        {
+            std::vector<void*> blocks;
+            bool reused = false;
+            for (int i = 0; i < 64; i++) {
+                blocks.push_back(pool.allocate());
+                reused |= blocks.back() == late;
+            }
+            CHECK(reused);
+            for (void * p: blocks)
+                pool.deallocate(p);
+        }).join();
+}
+
+struct Counted
+{
+    static inline int alive = 0;
+
+    explicit Counted(int v): v(v)
+    {
+        if (v < 0)
+            throw std::invalid_argument("negative");
+        alive++;
+    }
+    ~Counted() {alive--;}
+
+    int  v;
+    char pad[40];
+};
+
+void test_object_pool()
+{
+    {
+        auto p = ObjectPool<Counted>::make(1);
+        CHECK(p->v == 1);
+        CHECK(Counted::alive == 1);
+    }
+    CHECK(Counted::alive == 0);
+
+    Counted * c = ObjectPool<Counted>::create(2);
+    ObjectPool<Counted>::destroy(c);
+    ObjectPool<Counted>::destroy(nullptr);
+
+    // the block of a throwing constructor goes back to the pool
+    CHECK_THROWS(ObjectPool<Counted>::create(-1), std::invalid_argument);
+    Counted * d = ObjectPool<Counted>::create(3);
+    CHECK(d == c);
+    ObjectPool<Counted>::destroy(d);
+    CHECK(Counted::alive == 0);
+}
+
+struct alignas(64) OverAligned
+{
+    char data[64];
+};
+
+void test_pool_allocator()
+{
+    std::list<int, PoolAllocator<int>> l;
+    std::map<int, int, std::less<int>, PoolAllocator<std::pair<const int, int>>> m;
+    for (int i = 0; i < 10000; i++) {
+        l.push_back(i);
+        m[i] = i;
+    }
+    CHECK(l.size() == 10000 && m.size() == 10000);
+    CHECK(m[9999] == 9999);
+
+    // larger than the largest class: operator new
+    std::vector<int, PoolAllocator<int>> v(100000, 1);
+    CHECK(v[99999] == 1);
+
+    PoolAllocator<OverAligned> a;
+    OverAligned * o = a.allocate(3);
+    CHECK(aligned(o, 64));
+    a.deallocate(o, 3);
+
+    CHECK(PoolAllocator<int>() == PoolAllocator<double>());
+}
+
+void test_arena()
+{
+    MonotonicArena arena(1024);
+    void * a = arena.allocate(10, 1);
+    void * b = arena.allocate(8, 8);
+    CHECK(aligned(b, 8));
+    CHECK(static_cast<char*>(b) >= static_cast<char*>(a) + 10);
+    CHECK(aligned(arena.allocate(1, 64), 64));
+
+    // larger than a chunk
+    std::memset(arena.allocate(5000), 0, 5000);
+    const std::size_t capacity = arena.capacity();
+    CHECK(capacity >= 1024 + 5000);
+
+    // reset reuses the chunks without growing
+    arena.reset();
+    CHECK(arena.allocate(10, 1) == a);
+    for (int i = 0; i < 40; i++)
+        arena.allocate(50);
+    CHECK(arena.capacity() == capacity);
+
+    MonotonicArena other;
+    ArenaAllocator<int> x(arena);
+    ArenaAllocator<double> y(x);
+    CHECK(x == y);
+    CHECK(x != ArenaAllocator<int>(other));
+
+    std::vector<int, ArenaAllocator<int>> v(x);
+    for (int i = 0; i < 1000; i++)
+        v.push_back(i);
+    CHECK(v[999] == 999);
+}
+
+} /* namespace */
+
+int main()
+{
+    const TestCase tests[] = {
+        {"size_class",        test_size_class},
+        {"reuse",             test_reuse},
+        {"cross_thread_free", test_cross_thread_free},
+        {"free_after_cache",  test_free_after_cache},
+        {"object_pool",       test_object_pool},
+        {"pool_allocator",    test_pool_allocator},
+        {"arena",             test_arena},
+    };
+    return run_tests(tests);
+}
@@ -0,0 +1,159 @@
+/**
+ * Unit test of PriorityWaitQueue and DeadlineWaitQueue: lane order, the
+ * starvation bound of the less urgent lanes, and deadline order.
+ */
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "common/priority_wait_queue.h"
+
+using namespace common;
+using namespace std::chrono_literals;
+
+namespace {
+
+std::vector<int> pop_all(PriorityWaitQueue<int, 4>& queue)
+{
+    std::vector<int> out;
+    while (!queue.empty())
+        out.push_back(queue.pop());
+    return out;
+}
+
+void test_lanes()
+{
+    PriorityWaitQueue<int, 4> queue;
+    queue.push(30, 3);
+    queue.push(31);         // least urgent lane
+    queue.push(10, 1);
+    queue.push(0, 0);
+    queue.push(11, 1);
+    queue.push(1, 0);
+    CHECK(queue.size() == 6);
+    CHECK((pop_all(queue) == std::vector<int>{0, 1, 10, 11, 30, 31}));
+
+    CHECK_THROWS(queue.push(4, 4), std::out_of_range);
+    CHECK(queue.empty());
+}
+
+// without max_wait a less urgent element waits as long as urgent ones come
+void test_strict()
+{
+    PriorityWaitQueue<int, 4> queue;
+    queue.push(3, 3);
+    std::this_thread::sleep_for(5ms);
+    for (int i = 0; i < 10; i++)
+        queue.push(0, 0);
+    CHECK((pop_all(queue) == std::vector<int>{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3}));
+}
+
+void test_overdue()
+{
+    PriorityWaitQueue<int, 4> queue(10ms);
+    queue.push(3, 3);
+    queue.push(2, 2);
+    queue.push(1, 1);
+    std::this_thread::sleep_for(20ms);
+    queue.push(20, 2);
+    for (int i = 0; i < 3; i++)
+        queue.push(0, 0);
+
+    // the overdue elements come first, the oldest first whatever its lane,
+    // then the lanes are served in order again
+    CHECK((pop_all(queue) == std::vector<int>{3, 2, 1, 0, 0, 0, 20}));
+}
+
+// an element of the least urgent lane is served about max_wait after its
+// push while the most urgent lane is never empty (each pop pushes again)
+void test_starvation_bound()
+{
+    const auto max_wait = 20ms;
+
+    PriorityWaitQueue<int, 4> queue(max_wait);
+    for (int i = 0; i < 10; i++)
+        queue.push(0, 0);
+
+    const auto pushed = std::chrono::steady_clock::now();
+    queue.push(3, 3);
+    while (queue.pop() != 3)
+        queue.push(0, 0);
+    const auto waited = std::chrono::steady_clock::now() - pushed;
+
+    CHECK(waited >= max_wait);
+    // generous, to tolerate loaded machines and sanitizers
+    CHECK(waited < max_wait + 500ms);
+    CHECK(queue.size() == 10);
+}
+
+void test_deadline()
+{
+    DeadlineWaitQueue<std::string> queue;
+    const auto now = std::chrono::steady_clock::now();
+    queue.push("c", now + 30ms);
+    queue.push("a", now + 10ms);
+    queue.push("b1", now + 20ms);
+    queue.push("b2", now + 20ms);    // same deadline: FIFO
+    queue.push("d", 1h);              // relative to the push
+    queue.push("e");                  // default deadline, 1s
+
+    CHECK(queue.pop() == "a");
+    CHECK(queue.pop() == "b1");
+    CHECK(queue.pop() == "b2");
+    CHECK(queue.pop() == "c");
+    CHECK(queue.pop() == "e");
+    CHECK(queue.pop() == "d");
+    CHECK(queue.empty());
+}
+
+// elements pushed without deadline end up before later explicit deadlines
+void test_default_deadline()
+{
+    DeadlineWaitQueue<int> queue(10ms);
+    queue.push(0);
+    std::this_thread::sleep_for(20ms);
+    queue.push(1, 5ms);
+    queue.push(2);
+    CHECK(queue.pop() == 0);
+    CHECK(queue.pop() == 1);
+    CHECK(queue.pop() == 2);
+}
+
+// pop() blocks until an element is pushed, as for WaitQueue
+void test_blocking_pop()
+{
+    DeadlineWaitQueue<int> queue;
+    std::thread consumer([&]
+        {
+            CHECK(queue.pop() == 2);
+            CHECK(queue.pop() == 1);
+        });
+    std::this_thread::sleep_for(10ms);
+    // the earliest deadline is pushed first, so that the order does not
+    // depend on when the consumer wakes up
+    const auto now = std::chrono::steady_clock::now();
+    queue.push(2, now);
+    queue.push(1, now + 1ms);
+    consumer.join();
+    CHECK(queue.empty());
+}
+
+} /* namespace */
+
+int main()
+{
+    const TestCase tests[] = {
+        {"lanes",            test_lanes},
+        {"strict",           test_strict},
+        {"overdue",          test_overdue},
+        {"starvation_bound", test_starvation_bound},
+        {"deadline",         test_deadline},
+        {"default_deadline", test_default_deadline},
+        {"blocking_pop",     test_blocking_pop},
+    };
+    return run_tests(tests);
+}
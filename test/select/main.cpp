@@ -0,0 +1,138 @@
+/**
+ * Unit test of Selector and select(): ready sources returned without
+ * blocking, the scan orders, timeouts and wakeups by other threads.
+ */
+
+#include <chrono>
+#include <optional>
+#include <thread>
+
+#include "check.h"
+#include "common/select.h"
+
+using namespace common;
+using namespace std::chrono_literals;
+
+namespace {
+
+enum class Event {start, stop};
+
+// a source ready before the wait is returned at once
+void test_ready_first()
+{
+    WaitQueue<int> a, b;
+    b.push(1);
+    CHECK(select(a, b) == 1);
+
+    Selector sel;
+    CHECK(!sel.poll());
+    sel.add(a);
+    sel.add(b);
+    CHECK(sel.size() == 2);
+    CHECK(sel.poll() == std::optional<std::size_t>(1));
+    const auto start = std::chrono::steady_clock::now();
+    CHECK(sel.wait() == 1);
+    CHECK(sel.wait_for(10s) == std::optional<std::size_t>(1));
+    CHECK(std::chrono::steady_clock::now() - start < 1s);
+}
+
+void test_timeout()
+{
+    WaitQueue<int> a;
+    EventMngr<Event> events;
+    Selector sel;
+    sel.add(a);
+    sel.add(events, Event::stop);
+    events.notify(Event::start);     // not selected
+
+    const auto start = std::chrono::steady_clock::now();
+    CHECK(!sel.wait_for(20ms));
+    CHECK(std::chrono::steady_clock::now() - start >= 20ms);
+    CHECK(!sel.wait_for(0ms));
+}
+
+// several ready sources: the first in argument order, or each in turn
+void test_multiple_ready()
+{
+    WaitQueue<int> a, b, c;
+    b.push(1);
+    c.push(2);
+    CHECK(select(a, b, c) == 1);
+    CHECK(select(c, b) == 0);
+
+    Selector prio(Selector::Order::priority);
+    prio.add(a);
+    prio.add(b);
+    prio.add(c);
+    for (int i = 0; i < 3; i++)
+        CHECK(prio.wait() == 1);
+
+    Selector rr;
+    rr.add(a);
+    rr.add(b);
+    rr.add(c);
+    CHECK(rr.wait() == 1);
+    CHECK(rr.wait() == 2);
+    CHECK(rr.wait() == 1);
+    a.push(0);
+    CHECK(rr.wait() == 2);
+    CHECK(rr.wait() == 0);
+    CHECK(rr.wait() == 1);
+}
+
+// the selector sleeps until a source becomes ready
+void test_wakeup()
+{
+    WaitQueue<int> a, b;
+    EventMngr<Event> events;
+    Selector sel;
+    sel.add(a);
+    sel.add(b);
+    sel.add(events, Event::stop);
+
+    std::thread producer([&]
+        {
+            std::this_thread::sleep_for(10ms);
+            b.push(1);
+            std::this_thread::sleep_for(10ms);
+            events.notify(Event::stop);
+        });
+    CHECK(sel.wait_for(10s) == std::optional<std::size_t>(1));
+    int elt = 0;
+    CHECK(b.try_pop(elt) && elt == 1);
+    CHECK(sel.wait() == 2);
+    producer.join();
+
+    std::thread pusher([&] {std::this_thread::sleep_for(10ms); a.push(2);});
+    CHECK(select(a, b) == 0);
+    pusher.join();
+}
+
+// a destroyed selector is unsubscribed from its sources
+void test_unsubscribe()
+{
+    WaitQueue<int> a;
+    EventMngr<Event> events;
+    {
+        Selector sel;
+        sel.add(a);
+        sel.add(events, Event::start);
+    }
+    a.push(1);
+    events.notify(Event::start);
+    CHECK(a.size() == 1 && events.contains(Event::start));
+}
+
+} /* namespace */
+
+int main()
+{
+    const TestCase tests[] = {
+        {"ready_first",    test_ready_first},
+        {"timeout",        test_timeout},
+        {"multiple_ready", test_multiple_ready},
+        {"wakeup",         test_wakeup},
+        {"unsubscribe",    test_unsubscribe},
+    };
+    return run_tests(tests);
+}
@@ -0,0 +1,503 @@
+/**
+ * Stress test of the concurrency primitives, hammered from many threads. The
+ * timeouts are driven by a VirtualClock, so that the test is deterministic
+ * and does not sleep.
+ *
+ * Usage: common_test_stress [scale], scale multiplying the number of
+ * iterations (1 by default). Build with -DCOMMON_STRESS_TSAN=ON to run it
+ * under ThreadSanitizer.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "common/clock.h"
+#include "common/event_mngr.h"
+#include "common/select.h"
+#include "common/shm_queue.h"
+#include "common/statemachine.h"
+#include "common/thread.h"
+#include "common/timeout_queue.h"
+#include "common/wait_queue.h"
+
+using namespace common;
+using namespace std::chrono_literals;
+
+#define CHECK(cond)                                                             \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            std::exit(1);                                                       \
+        }                                                                       \
+    } while (0)
+
+namespace {
+
+int64_t scale = 1;
+
+template<typename F>
+void run_threads(int n, F f)
+{
+    std::vector<std::thread> threads;
+    for (int i = 0; i < n; i++)
+        threads.emplace_back(f, i);
+    for (auto& t: threads)
+        t.join();
+}
+
+// every pushed element is popped exactly once
+void stress_wait_queue()
+{
+    const int     nb_producers = 4;
+    const int     nb_consumers = 4;
+    const int64_t per_producer = 50000 * scale;
+
+    WaitQueue<int64_t>   queue;
+    std::atomic<int64_t> sum {0};
+    std::atomic<int64_t> count {0};
+
+    std::thread consumers([&]
+        {
+            run_threads(nb_consumers, [&](int i)
+                {
+                    int64_t v;
+                    for (;;) {
+                        // mix the blocking and non-blocking paths
+                        if (i % 2 == 0)
+                            v = queue.pop();
+                        else if (!queue.try_pop(v))
+                            continue;
+                        if (v < 0)
+                            return;
+                        sum += v;
+                        count++;
+                    }
+                });
+        });
+
+    run_threads(nb_producers, [&](int)
+        {
+            for (int64_t i = 1; i <= per_producer; i++) {
+                queue.push(i);
+                if (i % 1024 == 0)
+                    CHECK(queue.size() <= size_t(nb_producers * per_producer));
+            }
+        });
+    for (int i = 0; i < nb_consumers; i++)
+        queue.push(-1);
+    consumers.join();
+
+    CHECK(count == nb_producers * per_producer);
+    CHECK(sum == nb_producers * per_producer * (per_producer + 1) / 2);
+    CHECK(queue.empty());
+}
+
+// ping-pong between thread pairs, plus timeouts in virtual time
+void stress_event_mngr()
+{
+    const int     nb_pairs = 4;
+    const int64_t rounds   = 20000 * scale;
+
+    EventMngr<int> events;
+    run_threads(2 * nb_pairs, [&](int i)
+        {
+            const int pair = i / 2;
+            const int ping = 2 * pair;
+            const int pong = 2 * pair + 1;
+            for (int64_t r = 0; r < rounds; r++) {
+                if (i % 2 == 0) {
+                    events.notify(ping);
+                    events.wait(pong);
+                    events.erase(pong);
+                } else {
+                    events.wait(ping);
+                    events.erase(ping);
+                    events.notify(pong);
+                }
+            }
+        });
+
+    VirtualClock clock;
+    EventMngr<int> timed(clock);
+
+    std::cv_status status = std::cv_status::no_timeout;
+    std::thread waiter([&] {status = timed.wait_for(1, 10s);});
+    clock.wait_waiters(1);
+    clock.advance(9s);
+    CHECK(clock.nb_waiters() == 1);
+    clock.advance(1s);
+    waiter.join();
+    CHECK(status == std::cv_status::timeout);
+
+    waiter = std::thread([&] {status = timed.wait_for(1, 10s);});
+    clock.wait_waiters(1);
+    timed.notify(1);
+    waiter.join();
+    CHECK(status == std::cv_status::no_timeout);
+}
+
+// timers added and erased from several threads while another one runs them:
+// each timer not erased runs once
+void stress_timeout_queue()
+{
+    const int     nb_threads = 4;
+    const int64_t per_thread = 20000 * scale;
+
+    TimeoutQueue         queue;
+    std::atomic<int64_t> now {0};
+    std::atomic<int64_t> fired {0};
+    std::atomic<int64_t> erased {0};
+    std::atomic<bool>    adding {true};
+
+    std::thread runner([&]
+        {
+            while (adding || queue.next_expiration() != std::numeric_limits<int64_t>::max())
+                queue.run_loop(now += 10);
+        });
+
+    run_threads(nb_threads, [&](int i)
+        {
+            for (int64_t k = 0; k < per_thread; k++) {
+                const auto id = queue.add(now, k % 100, k % 3 ? 0 : 20,
+                                          [&](TimeoutQueue::Id, int64_t) {fired++;});
+                if ((k + i) % 4 == 0 && queue.erase(id))
+                    erased++;
+            }
+        });
+    adding = false;
+    runner.join();
+
+    CHECK(fired + erased == nb_threads * per_thread);
+}
+
+// state changes driven by a thread, observed by waiting threads
+void stress_statemachine()
+{
+    enum class St {a, b, c};
+    const int64_t rounds = 5000 * scale;
+
+    std::atomic<int> target {0};
+    auto goto_state = [&](int st) {return [&target, st]
+        {
+            return target == st ? transition_status::goto_next_state :
+                                  transition_status::stay_curr_state;
+        };};
+
+    VirtualClock clock;
+    Statemachine<St> sm("stress", {
+            {"a", St::a, {{St::b, goto_state(1)}}},
+            {"b", St::b, {{St::c, goto_state(2)}}},
+            {"c", St::c, {{St::a, goto_state(0)}}},
+        }, St::a, clock);
+
+    std::atomic<bool> done {false};
+    std::thread driver([&]
+        {
+            while (!done)
+                sm.wakeup();
+        });
+
+    for (int64_t r = 0; r < rounds; r++) {
+        target = 1;
+        sm.wait(St::b);
+        target = 2;
+        sm.wait(St::c);
+        target = 0;
+        sm.wait(St::a);
+    }
+
+    // a state that is never reached times out in virtual time
+    sm.disable();
+    std::cv_status status = std::cv_status::no_timeout;
+    std::thread waiter([&] {status = sm.wait_for(St::c, 1000ms);});
+    clock.wait_waiters(1);
+    clock.advance(1s);
+    waiter.join();
+    CHECK(status == std::cv_status::timeout);
+
+    done = true;
+    driver.join();
+}
+
+// periodic thread sleeping in virtual time
+void stress_thread()
+{
+    struct Ticker: Thread
+    {
+        void run() override
+        {
+            notify_running();
+            while (is_running()) {
+                sleep_for(1h);
+                ticks++;
+            }
+            finished = true;
+        }
+
+        std::atomic<int64_t> ticks {0};
+        std::atomic<bool>    finished {false};
+    };
+
+    VirtualClock clock;
+    Ticker t;
+    t.set_clock(clock);
+    t.start(true);
+    for (int i = 0; i < 100; i++) {
+        clock.wait_waiters(1);
+        // one hour of virtual time per tick, without waiting
+        while (t.ticks <= i) {
+            clock.advance(1h);
+            std::this_thread::yield();
+        }
+    }
+    t.stop();
+    while (!t.finished) {
+        clock.advance(1h);
+        std::this_thread::yield();
+    }
+    t.join();
+    CHECK(t.ticks >= 100);
+}
+
+// one consumer selecting over queues fed by several producers
+void stress_select()
+{
+    const int     nb_queues = 4;
+    const int64_t per_queue = 20000 * scale;
+
+    std::vector<WaitQueue<int64_t>> queues(nb_queues);
+    Selector sel;
+    for (auto& q: queues)
+        sel.add(q);
+
+    std::thread producers([&]
+        {
+            run_threads(nb_queues, [&](int i)
+                {
+                    for (int64_t k = 0; k < per_queue; k++)
+                        queues[i].push(k);
+                });
+        });
+
+    int64_t n = 0;
+    int64_t v;
+    while (n < nb_queues * per_queue) {
+        if (queues[sel.wait()].try_pop(v))
+            n++;
+    }
+    producers.join();
+    for (auto& q: queues)
+        CHECK(q.empty());
+}
+
+// producer processes killed at random points, in or out of the lock of the
+// queue: the queue is recovered and keeps working
+void stress_shm_queue()
+{
+    const std::string name = "/common_test_stress." + std::to_string(::getpid());
+    const int64_t     rounds = 50 * scale;
+
+    ShmWaitQueue<int64_t>::unlink(name);
+    {
+        ShmWaitQueue<int64_t> queue(name, 16);
+        for (int64_t r = 0; r < rounds; r++) {
+            const pid_t pid = ::fork();
+            CHECK(pid >= 0);
+            if (pid == 0) {
+                ShmWaitQueue<int64_t> peer(name, 16);
+                int64_t v = 0;
+                for (;;) {
+                    peer.try_push(v++);
+                    peer.try_pop(v);
+                }
+            }
+            ::usleep(100 + 37 * r % 400);
+            ::kill(pid, SIGKILL);
+            ::waitpid(pid, nullptr, 0);
+
+            int64_t v;
+            while (queue.try_pop(v))
+                ;
+            queue.push(r);
+            CHECK(queue.pop() == r);
+        }
+    }
+    ShmWaitQueue<int64_t>::unlink(name);
+}
+
+// creators killed before initializing the segment: right after shm_open (or
+// its truncation), or at a random point of their constructor while other
+// processes open it. The processes opening it initialize it in their place.
+void stress_shm_queue_creator()
+{
+    const std::string name = "/common_test_stress_creator." + std::to_string(::getpid());
+    const int64_t     rounds = 50 * scale;
+
+    for (int64_t r = 0; r < rounds; r++) {
+        ShmWaitQueue<int64_t>::unlink(name);
+        int ready[2];
+        CHECK(::pipe(ready) == 0);
+        const bool partial = r % 2 == 0;
+        const pid_t pid = ::fork();
+        CHECK(pid >= 0);
+        if (pid == 0) {
+            if (partial) {
+                const int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+                if (fd < 0 || (r % 4 == 2 && ::ftruncate(fd, 4096) < 0))
+                    ::_exit(1);
+            } else {
+                ShmWaitQueue<int64_t> queue(name, 16);
+            }
+            if (::write(ready[1], "", 1) != 1) {}
+            ::pause();
+        }
+        ::close(ready[1]);
+
+        if (partial) {
+            char c;
+            CHECK(::read(ready[0], &c, 1) == 1);
+            ::kill(pid, SIGKILL);
+        }
+        std::thread killer([&]
+            {
+                if (!partial) {
+                    ::usleep(37 * r % 300);
+                    ::kill(pid, SIGKILL);
+                }
+            });
+        run_threads(4, [&](int i)
+            {
+                ShmWaitQueue<int64_t> queue(name, 16);
+                queue.push(i);
+            });
+        killer.join();
+        ::waitpid(pid, nullptr, 0);
+        ::close(ready[0]);
+
+        ShmWaitQueue<int64_t> queue(name, 16);
+        int64_t sum = 0;
+        for (int i = 0; i < 4; i++)
+            sum += queue.pop();
+        CHECK(sum == 0 + 1 + 2 + 3);
+        CHECK(queue.empty());
+    }
+    ShmWaitQueue<int64_t>::unlink(name);
+}
+
+// large elements written in place by producer processes killed at random
+// points: the elements popped are never partly written
+void stress_shm_queue_in_place()
+{
+    struct Message
+    {
+        int64_t seq;
+        int64_t payload[128];
+    };
+
+    const std::string name = "/common_test_stress_in_place." + std::to_string(::getpid());
+    const int64_t     rounds = 50 * scale;
+
+    auto write = [](int64_t seq)
+        {
+            return [seq](Message& m)
+                {
+                    m.seq = seq;
+                    for (auto& v: m.payload)
+                        v = seq;
+                };
+        };
+    auto check = [](const Message& m)
+        {
+            for (auto v: m.payload)
+                CHECK(v == m.seq);
+        };
+
+    ShmWaitQueue<Message>::unlink(name);
+    {
+        ShmWaitQueue<Message> queue(name, 16);
+        for (int64_t r = 0; r < rounds; r++) {
+            const pid_t pid = ::fork();
+            CHECK(pid >= 0);
+            if (pid == 0) {
+                ShmWaitQueue<Message> peer(name, 16);
+                for (int64_t seq = 0;; seq++) {
+                    peer.try_push_in_place(write(seq));
+                    peer.try_pop_in_place(check);
+                }
+            }
+            ::usleep(100 + 37 * r % 400);
+            ::kill(pid, SIGKILL);
+            ::waitpid(pid, nullptr, 0);
+            while (queue.try_pop_in_place(check))
+                ;
+        }
+
+        // a throwing write pushes nothing, a throwing read pops nothing
+        auto throwing = [](const Message&) {throw std::runtime_error("in place");};
+        bool thrown = false;
+        try {
+            queue.push_in_place(throwing);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        CHECK(thrown && queue.empty());
+        queue.push_in_place(write(7));
+        thrown = false;
+        try {
+            queue.pop_in_place(throwing);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        CHECK(thrown && queue.size() == 1);
+        int64_t seq = -1;
+        queue.pop_in_place([&](const Message& m) {check(m); seq = m.seq;});
+        CHECK(seq == 7);
+    }
+    ShmWaitQueue<Message>::unlink(name);
+}
+
+} /* namespace */
+
+int main(int argc, char ** argv)
+{
+    if (argc > 1)
+        scale = std::max<int64_t>(std::atoll(argv[1]), 1);
+
+    const struct {
+        const char * name;
+        void (*run)();
+    } tests[] = {
+        {"wait_queue",    stress_wait_queue},
+        {"event_mngr",    stress_event_mngr},
+        {"timeout_queue", stress_timeout_queue},
+        {"statemachine",  stress_statemachine},
+        {"thread",        stress_thread},
+        {"select",        stress_select},
+        {"shm_queue",     stress_shm_queue},
+        {"shm_creator",   stress_shm_queue_creator},
+        {"shm_in_place",  stress_shm_queue_in_place},
+    };
+
+    for (const auto& t: tests) {
+        const auto start = std::chrono::steady_clock::now();
+        t.run();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::printf("%-14s ok (%.2fs)\n", t.name, elapsed.count());
+    }
+    return 0;
+}
@@ -0,0 +1,209 @@
+/**
+ * Unit test of Mutex, Semaphore and EventCount: mutual exclusion, timeouts,
+ * cancelled waits and the prepare_wait / wait protocol under contention.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "common/sync.h"
+
+using namespace common;
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+void test_mutex()
+{
+    const int nb_threads = 8;
+    const int per_thread = 100000;
+
+    Mutex m;
+    CHECK(m.try_lock());
+    CHECK(!m.try_lock());
+    m.unlock();
+
+    int64_t counter = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nb_threads; t++)
+        threads.emplace_back([&]
+            {
+                for (int i = 0; i < per_thread; i++) {
+                    std::lock_guard<Mutex> lk(m);
+                    counter++;
+                }
+            });
+    for (auto& t: threads)
+        t.join();
+    CHECK(counter == int64_t(nb_threads) * per_thread);
+}
+
+void test_semaphore()
+{
+    Semaphore sem(2);
+    CHECK(sem.try_wait());
+    CHECK(sem.try_wait());
+    CHECK(!sem.try_wait());
+
+    // timeout
+    auto start = Clock::now();
+    CHECK(!sem.wait_for(20ms));
+    CHECK(Clock::now() - start >= 20ms);
+    CHECK(!sem.wait_for(0ms));
+
+    // a post wakes up the waiters
+    std::atomic<int> woken {0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+        threads.emplace_back([&] {sem.wait(); woken++;});
+    std::this_thread::sleep_for(10ms);
+    CHECK(woken == 0);
+    sem.post(3);
+    sem.post();
+    for (auto& t: threads)
+        t.join();
+    CHECK(woken == 4);
+    CHECK(!sem.try_wait());
+}
+
+// a notification without waiters does nothing, the waiters count the
+// registered waits only
+void test_prepare_cancel()
+{
+    EventCount ec;
+    const auto key = ec.prepare_wait();
+    ec.cancel_wait();
+    ec.notify();
+    CHECK(ec.prepare_wait() == key);
+
+    // a notification between prepare_wait() and wait() is not lost
+    ec.notify();
+    const auto start = Clock::now();
+    ec.wait(key);
+    CHECK(Clock::now() - start < 1s);
+
+    // the wait is unregistered: the next notification is a no-op again
+    const auto next = ec.prepare_wait();
+    CHECK(next != key);
+    ec.cancel_wait();
+    ec.notify_all();
+    CHECK(ec.prepare_wait() == next);
+    ec.cancel_wait();
+}
+
+void test_wait_until()
+{
+    EventCount ec;
+
+    // timeout, and the waiter is unregistered
+    auto key = ec.prepare_wait();
+    auto start = Clock::now();
+    CHECK(!ec.wait_until(key, start + 20ms));
+    CHECK(Clock::now() - start >= 20ms);
+    ec.notify();
+    CHECK(ec.prepare_wait() == key);
+
+    // deadline already passed
+    CHECK(!ec.wait_until(key, Clock::now() - 1s));
+
+    // notified before the deadline
+    key = ec.prepare_wait();
+    std::thread notifier([&]
+        {
+            std::this_thread::sleep_for(10ms);
+            ec.notify();
+        });
+    start = Clock::now();
+    CHECK(ec.wait_until(key, start + 10s));
+    CHECK(Clock::now() - start < 5s);
+    notifier.join();
+}
+
+void test_wait_predicate()
+{
+    EventCount ec;
+    Mutex      m;
+    bool       ready = false;
+
+    std::unique_lock<Mutex> lk(m);
+    auto start = Clock::now();
+    CHECK(!ec.wait_for(lk, 20ms, [&] {return ready;}));
+    CHECK(Clock::now() - start >= 20ms);
+    CHECK(lk.owns_lock());
+
+    std::thread notifier([&]
+        {
+            std::this_thread::sleep_for(10ms);
+            std::lock_guard<Mutex> guard(m);
+            ready = true;
+            ec.notify();
+        });
+    CHECK(ec.wait_for(lk, 10s, [&] {return ready;}));
+    CHECK(ready && lk.owns_lock());
+    lk.unlock();
+    notifier.join();
+
+    // the untimed wait returns at once when the predicate holds
+    lk.lock();
+    ec.wait(lk, [&] {return ready;});
+}
+
+// ping-pong between two threads with lock-free conditions: a lost wakeup
+// blocks the test
+void test_no_lost_wakeup()
+{
+    const uint64_t rounds = 100000;
+
+    EventCount ec;
+    std::atomic<uint64_t> turn {0};     // even: ping, odd: pong
+
+    auto wait_turn = [&](uint64_t value)
+        {
+            for (;;) {
+                if (turn.load() == value)
+                    break;
+                const auto key = ec.prepare_wait();
+                if (turn.load() == value) {
+                    ec.cancel_wait();
+                    break;
+                }
+                ec.wait(key);
+            }
+        };
+    std::thread pong([&]
+        {
+            for (uint64_t i = 0; i < rounds; i++) {
+                wait_turn(2 * i + 1);
+                turn.store(2 * i + 2);
+                ec.notify_all();
+            }
+        });
+    for (uint64_t i = 0; i < rounds; i++) {
+        wait_turn(2 * i);
+        turn.store(2 * i + 1);
+        ec.notify_all();
+    }
+    pong.join();
+    CHECK(turn == 2 * rounds);
+}
+
+} /* namespace */
+
+int main()
+{
+    const TestCase tests[] = {
+        {"mutex",          test_mutex},
+        {"semaphore",      test_semaphore},
+        {"prepare_cancel", test_prepare_cancel},
+        {"wait_until",     test_wait_until},
+        {"wait_predicate", test_wait_predicate},
+        {"no_lost_wakeup", test_no_lost_wakeup},
+    };
+    return run_tests(tests);
+}
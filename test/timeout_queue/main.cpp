@@ -0,0 +1,267 @@
+/**
+ * Unit test of TimeoutQueue: expirations of one-time and repeating events,
+ * the events kept when a callback throws, and the expirations of events
+ * coalesced within their slack.
+ */
+
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "check.h"
+#include "common/timeout_queue.h"
+
+using namespace common;
+
+namespace {
+
+const int64_t never = std::numeric_limits<int64_t>::max();
+
+void test_run()
+{
+    TimeoutQueue queue;
+    std::vector<TimeoutQueue::Id> fired;
+    auto record = [&](TimeoutQueue::Id id, int64_t) {fired.push_back(id);};
+
+    const auto a = queue.add(0, 10, record);
+    const auto b = queue.add(0, 5, record);
+    const auto r = queue.add_repeating(0, 4, record);
+    CHECK(queue.next_expiration() == 4);
+
+    CHECK(queue.run_once(3) == 4);
+    CHECK(fired.empty());
+    CHECK(queue.run_once(5) == 9);
+    CHECK((fired == std::vector<TimeoutQueue::Id>{r, b}));
+
+    // repeating events run at most once per run, rescheduled from now
+    fired.clear();
+    CHECK(queue.run_once(20) == 24);
+    CHECK((fired == std::vector<TimeoutQueue::Id>{r, a}));
+
+    CHECK(queue.erase(r));
+    CHECK(!queue.erase(r));
+    CHECK(queue.next_expiration() == never);
+}
+
+// a callback adding an event already due: run_loop() runs it, run_once()
+// leaves it for the next call
+void test_run_loop()
+{
+    TimeoutQueue queue;
+    int fired = 0;
+    queue.add(0, 1, [&](TimeoutQueue::Id, int64_t now)
+        {
+            fired++;
+            queue.add(now, 0, [&](TimeoutQueue::Id, int64_t) {fired++;});
+        });
+    CHECK(queue.run_once(1) == 1);
+    CHECK(fired == 1);
+    CHECK(queue.run_loop(1) == never);
+    CHECK(fired == 2);
+}
+
+// two repeating events, the first one throwing once: the second one keeps
+// its expiration and runs on the next call, then fires on each run
+void test_throwing_repeating()
+{
+    TimeoutQueue queue;
+    int first = 0, second = 0;
+    queue.add_repeating(0, 10, [&](TimeoutQueue::Id, int64_t)
+        {
+            if (first++ == 0)
+                throw std::runtime_error("first");
+        });
+    queue.add_repeating(0, 10, [&](TimeoutQueue::Id, int64_t) {second++;});
+
+    CHECK_THROWS(queue.run_once(10), std::runtime_error);
+    CHECK(first == 1 && second == 0);
+    CHECK(queue.next_expiration() == 10);
+    CHECK(queue.run_once(11) == 20);
+    CHECK(first == 1 && second == 1);
+    for (int64_t now = 20; now <= 50; now += 10)
+        queue.run_once(now);
+    CHECK(first == 5);
+    CHECK(second == 4);
+}
+
+// a one-time event after the throwing one in the batch runs on the next
+// call, the throwing one does not run again
+void test_throwing_once()
+{
+    TimeoutQueue queue;
+    int thrower = 0, other = 0;
+    queue.add(0, 5, [&](TimeoutQueue::Id, int64_t)
+        {
+            thrower++;
+            throw std::runtime_error("once");
+        });
+    const auto id = queue.add(0, 6, [&](TimeoutQueue::Id, int64_t) {other++;});
+
+    CHECK_THROWS(queue.run_once(10), std::runtime_error);
+    CHECK(thrower == 1 && other == 0);
+    CHECK(queue.next_expiration() == 6);
+    CHECK(queue.run_once(10) == never);
+    CHECK(thrower == 1 && other == 1);
+
+    // an event kept after a throw can still be erased
+    queue.add(0, 1, [](TimeoutQueue::Id, int64_t) {throw std::runtime_error("x");});
+    const auto later = queue.add(0, 2, [&](TimeoutQueue::Id, int64_t) {other++;});
+    CHECK_THROWS(queue.run_once(2), std::runtime_error);
+    CHECK(queue.erase(later));
+    CHECK(!queue.erase(id));
+    queue.run_once(2);
+    CHECK(other == 1);
+}
+
+// a repeating event erasing itself before throwing is not rescheduled
+void test_throwing_erased()
+{
+    TimeoutQueue queue;
+    int fired = 0;
+    queue.add_repeating(0, 1, [&](TimeoutQueue::Id id, int64_t)
+        {
+            fired++;
+            queue.erase(id);
+            throw std::runtime_error("erased");
+        });
+    CHECK_THROWS(queue.run_once(1), std::runtime_error);
+    CHECK(queue.next_expiration() == never);
+    CHECK(fired == 1);
+}
+
+// a repeating event due again in a run nested in its callback is not run
+// by the nested run, and keeps its callback
+void test_nested_run()
+{
+    TimeoutQueue queue;
+    int fired = 0;
+    queue.add_repeating(0, 0, [&](TimeoutQueue::Id, int64_t now)
+        {
+            if (fired++ == 0)
+                queue.run_once(now);
+        });
+    CHECK(queue.run_once(0) == 0);
+    CHECK(fired == 1);
+    CHECK(queue.run_once(1) == 1);
+    CHECK(fired == 2);
+    CHECK(queue.run_once(2) == 2);
+    CHECK(fired == 3);
+}
+
+void test_empty_callback()
+{
+    TimeoutQueue queue;
+    CHECK_THROWS(queue.add(0, 1, nullptr), std::invalid_argument);
+    CHECK_THROWS(queue.add(0, 1, 1, TimeoutQueue::Callback()), std::invalid_argument);
+    CHECK_THROWS(queue.add_repeating(0, 1, nullptr), std::invalid_argument);
+    CHECK_THROWS(queue.add_repeating(0, 1, 1, nullptr), std::invalid_argument);
+    CHECK(queue.next_expiration() == never);
+}
+
+// an event with a slack joins the first event due in its window
+void test_coalesce_existing()
+{
+    TimeoutQueue queue;
+    std::vector<std::pair<TimeoutQueue::Id, int64_t>> fired;
+    auto record = [&](TimeoutQueue::Id id, int64_t now) {fired.emplace_back(id, now);};
+
+    const auto a = queue.add(0, 100, record);
+    const auto b = queue.add(0, 90, 20, record);     // [90, 110]: with a
+    const auto c = queue.add(0, 101, 5, record);     // [101, 106]: alone
+    const auto d = queue.add(0, 100, 0, record);     // no slack: exact
+    CHECK(queue.next_expiration() == 100);
+    CHECK(queue.run_once(100) > 100);
+    CHECK((fired == decltype(fired){{a, 100}, {b, 100}, {d, 100}}));
+
+    fired.clear();
+    const int64_t next = queue.next_expiration();
+    CHECK(next >= 101 && next <= 106);
+    queue.run_once(next);
+    CHECK((fired == decltype(fired){{c, next}}));
+}
+
+// random events (negative times included) expire inside their slack window,
+// and share fewer expirations than there are events
+void test_coalesce_window()
+{
+    struct Window
+    {
+        int64_t first;
+        int64_t last;
+    };
+
+    TimeoutQueue queue;
+    std::map<TimeoutQueue::Id, Window> windows;
+    std::set<int64_t> expirations;
+    std::size_t fired = 0;
+    auto check = [&](TimeoutQueue::Id id, int64_t now)
+        {
+            const auto& w = windows.at(id);
+            CHECK(now >= w.first && now <= w.last);
+            expirations.insert(now);
+            fired++;
+        };
+
+    uint64_t seed = 42;
+    auto random = [&](int64_t n)
+        {
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            return static_cast<int64_t>((seed >> 33) % uint64_t(n));
+        };
+
+    const int nb_events = 10000;
+    for (int i = 0; i < nb_events; i++) {
+        const int64_t now   = random(1000) - 500;
+        const int64_t delay = random(100000);
+        const int64_t slack = random(4) == 0 ? 0 : random(1000);
+        const auto id = queue.add(now, delay, slack, check);
+        windows[id] = {now + delay, now + delay + slack};
+    }
+
+    // run at each expiration, so that the events fire at their expiration
+    for (int64_t next = queue.next_expiration(); next != never; next = queue.next_expiration())
+        queue.run_once(next);
+    CHECK(fired == nb_events);
+    CHECK(expirations.size() < nb_events / 2);
+}
+
+// each expiration of a repeating event is coalesced from the time it ran
+void test_coalesce_repeating()
+{
+    TimeoutQueue queue;
+    std::vector<int64_t> fired;
+    queue.add_repeating(0, 100, 30, [&](TimeoutQueue::Id, int64_t now) {fired.push_back(now);});
+
+    int64_t prev = 0;
+    for (int i = 0; i < 20; i++) {
+        const int64_t next = queue.next_expiration();
+        CHECK(next >= prev + 100 && next <= prev + 130);
+        // run late: the next expiration is computed from now
+        prev = next + i;
+        queue.run_once(prev);
+    }
+    CHECK(fired.size() == 20);
+}
+
+} /* namespace */
+
+int main()
+{
+    const TestCase tests[] = {
+        {"run",                test_run},
+        {"run_loop",           test_run_loop},
+        {"throwing_repeating", test_throwing_repeating},
+        {"throwing_once",      test_throwing_once},
+        {"throwing_erased",    test_throwing_erased},
+        {"nested_run",         test_nested_run},
+        {"empty_callback",     test_empty_callback},
+        {"coalesce_existing",  test_coalesce_existing},
+        {"coalesce_window",    test_coalesce_window},
+        {"coalesce_repeating", test_coalesce_repeating},
+    };
+    return run_tests(tests);
+}
@@ -0,0 +1,189 @@
+/**
+ * Unit test of the trace buffers: spans read while the writer wraps around
+ * the ring are never torn, and the Chrome trace export is valid json.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "check.h"
+#include "common/json.h"
+#include "common/trace.h"
+
+using namespace common;
+
+namespace {
+
+const char * const names[] = {"even", "odd"};
+
+void test_spans()
+{
+    trace::ThreadBuffer buffer(5, 1);
+    CHECK(buffer.spans().empty());
+    for (int64_t k = 0; k < 3; k++)
+        buffer.record(names[k % 2], k, 10 * k);
+    auto spans = buffer.spans();
+    CHECK(spans.size() == 3);
+    CHECK(spans[2].start_ns == 2 && spans[2].duration_ns == 20);
+
+    // rounded up to 8 slots, the oldest are overwritten
+    for (int64_t k = 3; k < 20; k++)
+        buffer.record(names[k % 2], k, 10 * k);
+    spans = buffer.spans();
+    CHECK(spans.size() == 8);
+    CHECK(spans.front().start_ns == 12 && spans.back().start_ns == 19);
+
+    buffer.clear();
+    CHECK(buffer.spans().empty());
+    buffer.record(names[0], 20, 200);
+    spans = buffer.spans();
+    CHECK(spans.size() == 1 && spans[0].start_ns == 20);
+}
+
+// a writer wrapping around a small ring while another thread copies it:
+// every copied span is one that was recorded, oldest first
+void test_concurrent_spans()
+{
+    const int64_t nb_spans = 2000000;
+
+    trace::ThreadBuffer buffer(8, 1);
+    std::atomic<bool> done {false};
+    std::thread writer([&]
+        {
+            for (int64_t k = 0; k < nb_spans; k++)
+                buffer.record(names[k % 2], k, 3 * k);
+            done = true;
+        });
+
+    int64_t copied = 0;
+    while (!done) {
+        int64_t last = -1;
+        for (const auto& s: buffer.spans()) {
+            CHECK(s.duration_ns == 3 * s.start_ns);
+            CHECK(s.name == names[s.start_ns % 2]);
+            CHECK(s.start_ns > last);
+            last = s.start_ns;
+            copied++;
+        }
+    }
+    writer.join();
+    CHECK(copied > 0);
+    CHECK(buffer.spans().size() == 8);
+}
+
+void test_chrome_trace()
+{
+    auto& tracer = trace::Tracer::instance();
+    tracer.enable();
+    tracer.set_thread_name("main \"thread\"");
+
+    std::thread worker([&]
+        {
+            tracer.set_thread_name("worker");
+            for (int i = 0; i < 100; i++)
+                COMMON_TRACE_SCOPE("work");
+        });
+    {
+        COMMON_TRACE_SCOPE("main");
+        // exported while the worker records
+        for (int i = 0; i < 10; i++) {
+            std::ostringstream os;
+            tracer.write_chrome_trace(os);
+            CHECK(json::parse(os.str())["traceEvents"].is_array());
+        }
+    }
+    worker.join();
+    tracer.disable();
+    {
+        COMMON_TRACE_SCOPE("disabled");
+    }
+
+    std::ostringstream os;
+    tracer.write_chrome_trace(os);
+    const auto events = json::parse(os.str())["traceEvents"];
+    int work = 0, main = 0, thread_names = 0;
+    for (const auto& e: events) {
+        if (e["ph"] == "M")
+            thread_names++;
+        else if (e["name"] == "work")
+            work++;
+        else if (e["name"] == "main")
+            main++;
+        CHECK(e["name"] != "disabled");
+    }
+    CHECK(work == 100);
+    CHECK(main == 1);
+    CHECK(thread_names == 2);
+
+    // the buffer of the exited worker is released
+    tracer.clear();
+    std::ostringstream cleared;
+    tracer.write_chrome_trace(cleared);
+    CHECK(json::parse(cleared.str())["traceEvents"].size() == 1);
+}
+
+// thread names of the threads whose buffer is exported
+std::set<std::string> exported_threads()
+{
+    std::ostringstream os;
+    trace::Tracer::instance().write_chrome_trace(os);
+    const auto events = json::parse(os.str())["traceEvents"];
+    std::set<std::string> out;
+    for (const auto& e: events) {
+        if (e["ph"] == "M")
+            out.insert(e["args"]["name"].get<std::string>());
+    }
+    return out;
+}
+
+// the buffers of the exited threads are kept for the export, up to a limit
+void test_exited_threads()
+{
+    auto& tracer = trace::Tracer::instance();
+    tracer.clear();
+    tracer.enable();
+    tracer.set_buffer_capacity(16);
+    tracer.set_max_exited_buffers(2);
+
+    for (int i = 0; i < 4; i++) {
+        std::thread([&, i]
+            {
+                tracer.set_thread_name("worker " + std::to_string(i));
+                CHECK(tracer.thread_buffer().spans().empty());
+                for (int k = 0; k < 100; k++)
+                    COMMON_TRACE_SCOPE("work");
+                CHECK(tracer.thread_buffer().spans().size() == 16);
+            }).join();
+    }
+    CHECK((exported_threads() == std::set<std::string>{"main \"thread\"", "worker 2", "worker 3"}));
+
+    // a thread without spans is released when it exits
+    std::thread([&] {tracer.set_thread_name("idle");}).join();
+    CHECK(exported_threads().count("idle") == 0);
+
+    tracer.set_max_exited_buffers(1);
+    CHECK(exported_threads().count("worker 2") == 0);
+    tracer.clear();
+    CHECK((exported_threads() == std::set<std::string>{"main \"thread\""}));
+
+    tracer.disable();
+    tracer.set_buffer_capacity(1 << 16);
+    tracer.set_max_exited_buffers(16);
+}
+
+} /* namespace */
+
+int main()
+{
+    const TestCase tests[] = {
+        {"spans",            test_spans},
+        {"concurrent_spans", test_concurrent_spans},
+        {"chrome_trace",     test_chrome_trace},
+        {"exited_threads",   test_exited_threads},
+    };
+    return run_tests(tests);
+}